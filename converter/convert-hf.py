@@ -59,7 +59,7 @@ class Processor:
     def __preparePlan(self):
         wt = self.config['weights_float_type']
         p = self.plan
-        p.append([FloatType.F32,
+        p.append([FloatType.F16 if wt == FloatType.F16 else FloatType.F32,
             'model.embed_tokens.weight'])
         for l in range(0, self.config['n_layers']):
             p.append([wt, self.__transformQ,
@@ -191,7 +191,7 @@ def loadConfig(folderPath: str, weightsFloatType: int):
         raise Exception('Not found any model file')
 
     result = {
-        'version': 0,
+        'version': 1,
         'arch_type': parseArchType(config['model_type']),
         'hidden_act': parseHiddenAct(config['hidden_act']),
         'dim': config['hidden_size'],
@@ -17,6 +17,7 @@ def convert(modelPath, outputPath, targetFloatType):
             raise Exception('vocab_size is invalid, please update params.json file')
         if (params.get('max_seq_len') is None):
             raise Exception('max_seq_len is required, please update params.json file')
+        params['version'] = 1
         params['n_kv_heads'] = params.get('n_kv_heads') or params['n_heads']
         params['head_size'] = params['dim'] / params['n_heads']
         params['arch_type'] = 0xABCD00
@@ -77,7 +78,7 @@ def convert(modelPath, outputPath, targetFloatType):
                 layerName.endswith('.feed_forward.w2.weight')
             )
             isAlwaysF32 = (
-                layerName == 'tok_embeddings.weight' or
+                (layerName == 'tok_embeddings.weight' and targetFloatType != FloatType.F16) or
                 layerName.endswith('.attention_norm.weight') or
                 layerName.endswith('.ffn_norm.weight') or
                 layerName == 'norm.weight'
@@ -8,12 +8,16 @@ class FloatType:
     F16 = 1
     Q40 = 2
     Q80 = 3
+    Q4K = 4
+    Q6K = 5
 
 floatTypeMap = {
     'f32': FloatType.F32,
     'f16': FloatType.F16,
     'q40': FloatType.Q40,
     'q80': FloatType.Q80,
+    'q4k': FloatType.Q4K,
+    'q6k': FloatType.Q6K,
 }
 floatTypeNames = list(floatTypeMap.keys())
 
@@ -73,6 +77,80 @@ def writeQuantizedQ80Tensor(file, x):
         nBytes += len(buffer)
     return nBytes
 
+def writeQuantizedQ4KTensor(file, x):
+    x = x.to(torch.float32).numpy().astype(np.float32)
+    blockSize = 256
+    subBlockSize = 32
+    assert(x.shape[0] % blockSize == 0)
+    blocks = x.reshape(-1, blockSize // subBlockSize, subBlockSize)
+    mins = np.minimum(np.min(blocks, axis=2), 0)
+    maxs = np.max(blocks, axis=2)
+    scales = (maxs - mins) / 15
+    negMins = -mins
+
+    deltas16 = (np.max(scales, axis=1) / 63).astype(np.float16)
+    deltasMin16 = (np.max(negMins, axis=1) / 63).astype(np.float16)
+    deltas = deltas16.astype(np.float32)
+    deltasMin = deltasMin16.astype(np.float32)
+    ids = np.where(deltas != 0, 1.0 / np.where(deltas != 0, deltas, 1), 0)
+    idMins = np.where(deltasMin != 0, 1.0 / np.where(deltasMin != 0, deltasMin, 1), 0)
+    ls = np.clip(np.round(scales * ids[:, np.newaxis]), 0, 63).astype(np.uint8)
+    lm = np.clip(np.round(negMins * idMins[:, np.newaxis]), 0, 63).astype(np.uint8)
+
+    subDeltas = deltas[:, np.newaxis] * ls
+    subMins = deltasMin[:, np.newaxis] * lm
+    subIds = np.where(subDeltas != 0, 1.0 / np.where(subDeltas != 0, subDeltas, 1), 0)
+    q = np.round((blocks + subMins[:, :, np.newaxis]) * subIds[:, :, np.newaxis])
+    q = np.clip(q, 0, 15).astype(np.uint8)
+
+    # Sub-block 2i is stored in low nibbles, sub-block 2i+1 in high nibbles
+    qs = (q[:, 0::2, :] | (q[:, 1::2, :] << 4)).reshape(-1, blockSize // 2)
+    packedScales = np.concatenate([
+        ls[:, 0:4] | ((ls[:, 4:8] >> 4) << 6),
+        lm[:, 0:4] | ((lm[:, 4:8] >> 4) << 6),
+        (ls[:, 4:8] & 0xF) | ((lm[:, 4:8] & 0xF) << 4),
+    ], axis=1).astype(np.uint8)
+
+    buffer = np.concatenate([
+        deltas16.reshape(-1, 1).view(np.uint8),
+        deltasMin16.reshape(-1, 1).view(np.uint8),
+        packedScales,
+        qs,
+    ], axis=1).tobytes()
+    file.write(buffer)
+    return len(buffer)
+
+def writeQuantizedQ6KTensor(file, x):
+    x = x.to(torch.float32).numpy().astype(np.float32)
+    blockSize = 256
+    subBlockSize = 16
+    assert(x.shape[0] % blockSize == 0)
+    blocks = x.reshape(-1, blockSize // subBlockSize, subBlockSize)
+    scales = np.max(np.abs(blocks), axis=2) / 31
+
+    deltas16 = (np.max(scales, axis=1) / 127).astype(np.float16)
+    deltas = deltas16.astype(np.float32)
+    ids = np.where(deltas != 0, 1.0 / np.where(deltas != 0, deltas, 1), 0)
+    ls = np.clip(np.round(scales * ids[:, np.newaxis]), 0, 127).astype(np.int8)
+
+    subDeltas = deltas[:, np.newaxis] * ls
+    subIds = np.where(subDeltas != 0, 1.0 / np.where(subDeltas != 0, subDeltas, 1), 0)
+    q = np.clip(np.round(blocks * subIds[:, :, np.newaxis]), -32, 31) + 32
+    q = q.astype(np.uint8).reshape(-1, blockSize)
+
+    # Low 4 bits of values i and i+128, high 2 bits of values i, i+64, i+128 and i+192
+    ql = (q[:, 0:128] & 0xF) | ((q[:, 128:256] & 0xF) << 4)
+    qh = (q[:, 0:64] >> 4) | ((q[:, 64:128] >> 4) << 2) | ((q[:, 128:192] >> 4) << 4) | ((q[:, 192:256] >> 4) << 6)
+
+    buffer = np.concatenate([
+        ql,
+        qh,
+        ls.view(np.uint8),
+        deltas16.reshape(-1, 1).view(np.uint8),
+    ], axis=1).tobytes()
+    file.write(buffer)
+    return len(buffer)
+
 def writeF32Tensor(file, d):
     chunkSize = 10000
     nBytes = 0
@@ -101,6 +179,10 @@ def writeTensor(file, tensor, floatType):
         nBytes = writeQuantizedQ40Tensor(file, d)
     elif (floatType == FloatType.Q80):
         nBytes = writeQuantizedQ80Tensor(file, d)
+    elif (floatType == FloatType.Q4K):
+        nBytes = writeQuantizedQ4KTensor(file, d)
+    elif (floatType == FloatType.Q6K):
+        nBytes = writeQuantizedQ6KTensor(file, d)
     else:
         raise Exception(f'Unknown float type')
     t1 = time.time()
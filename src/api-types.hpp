@@ -107,6 +107,8 @@ struct InferenceParams {
     int max_tokens;
     float temperature;
     float top_p;
+    int top_k;
+    float min_p;
     std::vector<std::string> stop;
     bool stream;
     unsigned long long seed;
@@ -1,6 +1,9 @@
 #include "app.hpp"
+#include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <cstring>
+#include <cstdio>
 #include <stdexcept>
 #if defined(DLLAMA_VULKAN)
     #include "nn/nn-vulkan.hpp"
@@ -39,11 +42,22 @@ AppCliArgs AppCliArgs::parse(int argc, char* *argv, bool requireMode) {
     args.port = 9990;
     args.temperature = 0.8f;
     args.topp = 0.9f;
+    args.topk = 0;
+    args.minp = 0.0f;
     args.steps = 0;
     args.seed = (unsigned long long)time(nullptr);
     args.chatTemplateType = TEMPLATE_UNKNOWN;
     args.maxSeqLen = 0;
+    args.nSlots = 1;
+    args.ctxKeep = 0;
+    args.kvCacheDir = nullptr;
+    args.logitsTopk = 0;
+    args.draftModelPath = nullptr;
+    args.nDraftTokens = 4;
+    args.lookupNgram = 0;
     args.netTurbo = true;
+    args.tracePath = nullptr;
+    args.nTraceForwards = 16;
     args.gpuIndex = -1;
     args.gpuSegmentFrom = -1;
     args.gpuSegmentTo = -1;
@@ -108,12 +122,30 @@ AppCliArgs AppCliArgs::parse(int argc, char* *argv, bool requireMode) {
             args.temperature = atof(value);
         } else if (std::strcmp(name, "--topp") == 0) {
             args.topp = atof(value);
+        } else if (std::strcmp(name, "--topk") == 0) {
+            args.topk = (unsigned int)atoi(value);
+        } else if (std::strcmp(name, "--minp") == 0) {
+            args.minp = atof(value);
         } else if (std::strcmp(name, "--seed") == 0) {
             args.seed = atoll(value);
         } else if (std::strcmp(name, "--chat-template") == 0) {
             args.chatTemplateType = parseChatTemplateType(value);
         } else if (std::strcmp(name, "--max-seq-len") == 0) {
             args.maxSeqLen = (unsigned int)atoi(value);
+        } else if (std::strcmp(name, "--n-slots") == 0) {
+            args.nSlots = (unsigned int)atoi(value);
+        } else if (std::strcmp(name, "--ctx-keep") == 0) {
+            args.ctxKeep = (unsigned int)atoi(value);
+        } else if (std::strcmp(name, "--kv-cache-dir") == 0) {
+            args.kvCacheDir = value;
+        } else if (std::strcmp(name, "--logits-topk") == 0) {
+            args.logitsTopk = (unsigned int)atoi(value);
+        } else if (std::strcmp(name, "--draft-model") == 0) {
+            args.draftModelPath = value;
+        } else if (std::strcmp(name, "--draft-tokens") == 0) {
+            args.nDraftTokens = (unsigned int)atoi(value);
+        } else if (std::strcmp(name, "--lookup-ngram") == 0) {
+            args.lookupNgram = (unsigned int)atoi(value);
         } else if (std::strcmp(name, "--gpu-index") == 0) {
             args.gpuIndex = atoi(value);
         } else if (std::strcmp(name, "--gpu-segments") == 0) {
@@ -124,6 +156,10 @@ AppCliArgs AppCliArgs::parse(int argc, char* *argv, bool requireMode) {
             args.gpuSegmentTo = atoi(separator + 1);
         } else if (std::strcmp(name, "--net-turbo") == 0) {
             args.netTurbo = atoi(value) == 1;
+        } else if (std::strcmp(name, "--trace") == 0) {
+            args.tracePath = value;
+        } else if (std::strcmp(name, "--trace-forwards") == 0) {
+            args.nTraceForwards = (unsigned int)atoi(value);
         } else {
             throw std::runtime_error("Unknown option: " + std::string(name));
         }
@@ -131,6 +167,14 @@ AppCliArgs AppCliArgs::parse(int argc, char* *argv, bool requireMode) {
 
     if (args.nThreads < 1)
         throw std::runtime_error("Number of threads must be at least 1");
+    if (args.nSlots < 1)
+        throw std::runtime_error("Number of slots must be at least 1");
+    if (args.nTraceForwards < 1)
+        throw std::runtime_error("Number of traced forward passes must be at least 1");
+    if (args.draftModelPath != nullptr && args.lookupNgram > 0)
+        throw std::runtime_error("Draft model and prompt lookup cannot be used together");
+    if ((args.draftModelPath != nullptr || args.lookupNgram > 0) && (args.nDraftTokens < 1 || args.nDraftTokens >= args.nBatches))
+        throw std::runtime_error("Number of draft tokens must be at least 1 and less than the number of batches");
     return args;
 }
 
@@ -165,28 +209,193 @@ static std::vector<NnExecutorDevice> resolveDevices(AppCliArgs *args, NnNetConfi
     return devices;
 }
 
-RootLlmInference::RootLlmInference(LlmNet *net, NnNetExecution *execution, NnExecutor *executor, NnNetwork *network) {
+#define KV_CACHE_FILE_MAGIC 0x4B564331
+
+typedef struct {
+    NnUint magic;
+    NnUint nodeIndex;
+    NnUint nLayers;
+    NnUint nRows;
+    NnSize keyRowBytes;
+    NnSize valueRowBytes;
+} LlmKvCacheFileHeader;
+
+LlmKvCache::LlmKvCache(NnNodeConfig *nodeConfig, NnExecutor *executor) {
+    this->nodeConfig = nodeConfig;
+    this->executor = executor;
+    this->keyRowBytes = 0;
+    this->valueRowBytes = 0;
+    this->nRows = 0;
+
+    // The ROPE_KV op of every layer writes the key cache and knows the value cache
+    for (NnUint segmentIndex = 0; segmentIndex < nodeConfig->nSegments; segmentIndex++) {
+        NnSegmentConfig *segmentConfig = &nodeConfig->segments[segmentIndex];
+        for (NnUint opIndex = 0; opIndex < segmentConfig->nOps; opIndex++) {
+            NnOpConfig *opConfig = &segmentConfig->ops[opIndex];
+            if (opConfig->code != OP_ROPE_KV)
+                continue;
+            NnRopeKvOpConfig *config = (NnRopeKvOpConfig *)opConfig->config;
+            layers.push_back(LlmKvCacheLayer{segmentIndex, opConfig->output.pointerIndex, config->valueCacheBufferIndex, &config->rope});
+        }
+    }
+    if (layers.empty())
+        return;
+    NnSize3D *keySize = &nodeConfig->buffers[layers[0].keyBufferIndex].size;
+    NnSize3D *valueSize = &nodeConfig->buffers[layers[0].valueBufferIndex].size;
+    assert(keySize->y == valueSize->y);
+    nRows = keySize->y;
+    keyRowBytes = keySize->nBytes / keySize->y;
+    valueRowBytes = valueSize->nBytes / valueSize->y;
+}
+
+std::string LlmKvCache::getFilePath(const char *path) {
+    return std::string(path) + ".kv" + std::to_string(nodeConfig->nodeIndex);
+}
+
+void LlmKvCache::save(NnUint rowOffset, NnUint nRows, const char *path) {
+    if (rowOffset + nRows > this->nRows)
+        throw std::runtime_error("KV cache rows out of range");
+    std::string filePath = getFilePath(path);
+    std::string tempPath = filePath + ".tmp";
+    FILE *fd = fopen(tempPath.c_str(), "wb");
+    if (fd == nullptr)
+        throw std::runtime_error("Cannot open file: " + tempPath);
+
+    LlmKvCacheFileHeader header;
+    header.magic = KV_CACHE_FILE_MAGIC;
+    header.nodeIndex = nodeConfig->nodeIndex;
+    header.nLayers = (NnUint)layers.size();
+    header.nRows = nRows;
+    header.keyRowBytes = keyRowBytes;
+    header.valueRowBytes = valueRowBytes;
+
+    std::vector<NnByte> rows(nRows * std::max(keyRowBytes, valueRowBytes));
+    bool isOk = fwrite(&header, sizeof(header), 1, fd) == 1;
+    for (NnUint i = 0; isOk && i < layers.size(); i++) {
+        LlmKvCacheLayer *layer = &layers[i];
+        executor->readBuffer(layer->segmentIndex, layer->keyBufferIndex, rowOffset * keyRowBytes, nRows * keyRowBytes, rows.data());
+        isOk = fwrite(rows.data(), 1, nRows * keyRowBytes, fd) == nRows * keyRowBytes;
+        if (!isOk)
+            break;
+        executor->readBuffer(layer->segmentIndex, layer->valueBufferIndex, rowOffset * valueRowBytes, nRows * valueRowBytes, rows.data());
+        isOk = fwrite(rows.data(), 1, nRows * valueRowBytes, fd) == nRows * valueRowBytes;
+    }
+    isOk = fclose(fd) == 0 && isOk;
+    // The old file is replaced only by a complete snapshot
+    if (!isOk || std::rename(tempPath.c_str(), filePath.c_str()) != 0) {
+        std::remove(tempPath.c_str());
+        throw std::runtime_error("Cannot write file: " + filePath);
+    }
+}
+
+NnUint LlmKvCache::load(NnUint rowOffset, NnUint maxRows, const char *path) {
+    std::string filePath = getFilePath(path);
+    FILE *fd = fopen(filePath.c_str(), "rb");
+    if (fd == nullptr)
+        throw std::runtime_error("Cannot open file: " + filePath);
+
+    LlmKvCacheFileHeader header;
+    if (fread(&header, sizeof(header), 1, fd) != 1 || header.magic != KV_CACHE_FILE_MAGIC) {
+        fclose(fd);
+        throw std::runtime_error("Invalid KV cache file: " + filePath);
+    }
+    if (header.nodeIndex != nodeConfig->nodeIndex ||
+        header.nLayers != layers.size() ||
+        header.keyRowBytes != keyRowBytes ||
+        header.valueRowBytes != valueRowBytes ||
+        header.nRows > maxRows ||
+        rowOffset + header.nRows > this->nRows) {
+        fclose(fd);
+        throw std::runtime_error("KV cache file does not match the model: " + filePath);
+    }
+
+    std::vector<NnByte> rows(header.nRows * std::max(keyRowBytes, valueRowBytes));
+    bool isOk = true;
+    for (NnUint i = 0; isOk && i < layers.size(); i++) {
+        LlmKvCacheLayer *layer = &layers[i];
+        isOk = fread(rows.data(), 1, header.nRows * keyRowBytes, fd) == header.nRows * keyRowBytes;
+        if (!isOk)
+            break;
+        executor->writeBuffer(layer->segmentIndex, layer->keyBufferIndex, rowOffset * keyRowBytes, header.nRows * keyRowBytes, rows.data());
+        isOk = fread(rows.data(), 1, header.nRows * valueRowBytes, fd) == header.nRows * valueRowBytes;
+        if (isOk)
+            executor->writeBuffer(layer->segmentIndex, layer->valueBufferIndex, rowOffset * valueRowBytes, header.nRows * valueRowBytes, rows.data());
+    }
+    fclose(fd);
+    if (!isOk)
+        throw std::runtime_error("Cannot read file: " + filePath);
+    return header.nRows;
+}
+
+void LlmKvCache::shift(NnUint rowOffset, NnUint nKeep, NnUint nDiscard, NnUint nRows) {
+    assert(nKeep + nDiscard <= nRows);
+    assert(rowOffset + nRows <= this->nRows);
+    const NnUint nMoved = nRows - nKeep - nDiscard;
+    if (nMoved == 0)
+        return;
+    const NnSize fromRow = rowOffset + nKeep + nDiscard;
+    const NnSize toRow = rowOffset + nKeep;
+    assert(keyRowBytes % sizeof(float) == 0);
+
+    std::vector<NnByte> rows(nMoved * std::max(keyRowBytes, valueRowBytes));
+    for (NnUint i = 0; i < layers.size(); i++) {
+        LlmKvCacheLayer *layer = &layers[i];
+        executor->readBuffer(layer->segmentIndex, layer->keyBufferIndex, fromRow * keyRowBytes, nMoved * keyRowBytes, rows.data());
+        shiftRopeKeys(layer->rope, (float *)rows.data(), nMoved, nDiscard);
+        executor->writeBuffer(layer->segmentIndex, layer->keyBufferIndex, toRow * keyRowBytes, nMoved * keyRowBytes, rows.data());
+        executor->readBuffer(layer->segmentIndex, layer->valueBufferIndex, fromRow * valueRowBytes, nMoved * valueRowBytes, rows.data());
+        executor->writeBuffer(layer->segmentIndex, layer->valueBufferIndex, toRow * valueRowBytes, nMoved * valueRowBytes, rows.data());
+    }
+}
+
+RootLlmInference::RootLlmInference(LlmNet *net, NnUint nSlots, NnNetExecution *execution, NnExecutor *executor, NnNetwork *network)
+    : kvCache(&net->nodeConfigs[0], executor)
+{
     this->header = net->header;
+    this->nSlots = nSlots;
     this->tokenPipe = (float *)execution->pipes[net->tokenPipeIndex];
     this->positionPipe = (float *)execution->pipes[net->positionPipeIndex];
+    this->slotPipe = (float *)execution->pipes[net->slotPipeIndex];
     this->logitsPipe = (float *)execution->pipes[net->logitsPipeIndex];
+    this->nLogitsTopk = net->nLogitsTopk;
+    this->logitsTopkPipe = nLogitsTopk > 0 ? (float *)execution->pipes[net->logitsTopkPipeIndex] : nullptr;
+    this->nNodes = net->netConfig.nNodes;
     this->execution = execution;
     this->executor = executor;
     this->network = network; // May be nullptr!
+
+    controlBuffer.reset(new NnByte[sizeof(LlmControlPacket) + execution->nBatches * sizeof(LlmControlRow)]);
+    controlPacket = (LlmControlPacket *)controlBuffer.get();
+    controlRows = (LlmControlRow *)&controlBuffer[sizeof(LlmControlPacket)];
+    controlPacket->command = CONTROL_FORWARD;
+    controlPacket->batchSize = 0;
+    tracePath = nullptr;
+    nTraceForwards = 0;
 }
 
 void RootLlmInference::setBatchSize(NnUint batchSize) {
     execution->setBatchSize(batchSize);
-    controlPacket.batchSize = batchSize;
+    controlPacket->command = CONTROL_FORWARD;
+    controlPacket->batchSize = batchSize;
 }
 
 void RootLlmInference::setPosition(NnUint position) {
     assert(position >= 0);
     assert(position + execution->batchSize - 1 < header->seqLen);
 
-    controlPacket.position = position;
     for (NnUint i = 0; i < execution->batchSize; i++)
-        positionPipe[i] = (float)(position + i);
+        setRowPosition(i, position + i, 0);
+}
+
+void RootLlmInference::setRowPosition(NnUint batchIndex, NnUint position, NnUint slot) {
+    assert(batchIndex < execution->batchSize);
+    assert(position < header->seqLen);
+    assert(slot < nSlots);
+
+    controlRows[batchIndex].position = position;
+    controlRows[batchIndex].slot = slot;
+    positionPipe[batchIndex] = (float)position;
+    slotPipe[batchIndex] = (float)slot;
 }
 
 void RootLlmInference::setToken(NnUint batchIndex, NnUint token) {
@@ -196,39 +405,402 @@ void RootLlmInference::setToken(NnUint batchIndex, NnUint token) {
 
 void RootLlmInference::forward() {
     if (network != nullptr) 
-        network->writeAll(&controlPacket, sizeof(LlmControlPacket));
+        network->writeAll(controlBuffer.get(), sizeof(LlmControlPacket) + controlPacket->batchSize * sizeof(LlmControlRow));
     executor->forward();
+    if (nLogitsTopk > 0)
+        mergeLogitsTopk();
+    if (tracePath != nullptr && --nTraceForwards == 0)
+        writeTrace();
+}
+
+void RootLlmInference::mergeLogitsTopk() {
+    // Logits outside of the top-k of every slice get no probability
+    const NnUint nPairs = nNodes * nLogitsTopk;
+    for (NnUint batchIndex = 0; batchIndex < controlPacket->batchSize; batchIndex++) {
+        float *logits = &logitsPipe[batchIndex * header->vocabSize];
+        const float *pairs = &logitsTopkPipe[batchIndex * nPairs * 2];
+        std::fill(logits, logits + header->vocabSize, -INFINITY);
+        for (NnUint i = 0; i < nPairs; i++)
+            logits[(NnUint)pairs[i * 2]] = pairs[i * 2 + 1];
+    }
+}
+
+void RootLlmInference::saveKvCache(NnUint slot, NnUint nTokens, const char *path) {
+    assert(slot < nSlots);
+    assert(nTokens <= header->seqLen);
+    kvCache.save(slot * header->seqLen, nTokens, path);
+    sendKvCacheCommand(CONTROL_SAVE_KV_CACHE, slot, nTokens, path);
+}
+
+NnUint RootLlmInference::loadKvCache(NnUint slot, const char *path) {
+    assert(slot < nSlots);
+    NnUint nTokens = kvCache.load(slot * header->seqLen, header->seqLen, path);
+    sendKvCacheCommand(CONTROL_LOAD_KV_CACHE, slot, nTokens, path);
+    return nTokens;
+}
+
+void RootLlmInference::shiftKvCache(NnUint slot, NnUint nKeep, NnUint nDiscard, NnUint nTokens) {
+    assert(slot < nSlots);
+    assert(nTokens <= header->seqLen);
+    if (network != nullptr) {
+        LlmControlPacket packet;
+        packet.command = CONTROL_SHIFT_KV_CACHE;
+        packet.batchSize = 0;
+        LlmKvShiftPacket shiftPacket{slot * header->seqLen, nKeep, nDiscard, nTokens};
+        network->writeAll(&packet, sizeof(packet));
+        network->writeAll(&shiftPacket, sizeof(shiftPacket));
+    }
+    // Workers shift their slices in parallel, the next forward pass is read after it
+    kvCache.shift(slot * header->seqLen, nKeep, nDiscard, nTokens);
+}
+
+void RootLlmInference::sendKvCacheCommand(LlmControlCommand command, NnUint slot, NnUint nTokens, const char *path) {
+    if (network == nullptr)
+        return;
+    if (std::strlen(path) >= LLM_KV_CACHE_PATH_MAX)
+        throw std::runtime_error("KV cache path is too long");
+
+    LlmControlPacket packet;
+    packet.command = command;
+    packet.batchSize = 0;
+    LlmKvCachePacket kvPacket;
+    std::memset(&kvPacket, 0, sizeof(kvPacket));
+    kvPacket.rowOffset = slot * header->seqLen;
+    kvPacket.nRows = nTokens;
+    std::strcpy(kvPacket.path, path);
+    network->writeAll(&packet, sizeof(packet));
+    network->writeAll(&kvPacket, sizeof(kvPacket));
+
+    // Every worker confirms its slice, so the cache is consistent across nodes when this returns
+    NnUint nFailed = 0;
+    for (NnUint socketIndex = 0; socketIndex < network->nSockets; socketIndex++) {
+        NnUint isOk;
+        network->read(socketIndex, &isOk, sizeof(isOk));
+        if (!isOk)
+            nFailed++;
+    }
+    if (nFailed > 0)
+        throw std::runtime_error("KV cache command failed on " + std::to_string(nFailed) + " worker(s)");
+}
+
+void RootLlmInference::startTrace(const char *path, NnUint nForwards) {
+    assert(nForwards > 0);
+    tracePath = path;
+    nTraceForwards = nForwards;
+    executor->enableProfiler();
+    if (network != nullptr) {
+        LlmControlPacket packet;
+        packet.command = CONTROL_START_TRACE;
+        packet.batchSize = 0;
+        network->writeAll(&packet, sizeof(packet));
+    }
+}
+
+// Every worker measures its steps on its own clock. The offset of the clock is estimated from the
+// fastest of a few round trips, then the worker moves its events to the timeline of the root node
+void RootLlmInference::writeTrace() {
+    NnProfiler *profiler = executor->getProfiler();
+    std::string events = executor->getTraceEvents(0, 0);
+    if (network != nullptr) {
+        LlmControlPacket packet;
+        packet.command = CONTROL_COLLECT_TRACE;
+        packet.batchSize = 0;
+        network->writeAll(&packet, sizeof(packet));
+
+        for (NnUint socketIndex = 0; socketIndex < network->nSockets; socketIndex++) {
+            long long bestRoundTripUs = -1;
+            long long offsetUs = 0;
+            for (NnUint sample = 0; sample < LLM_TRACE_CLOCK_SAMPLES; sample++) {
+                long long sentUs = profiler->now();
+                network->write(socketIndex, &sample, sizeof(sample));
+                long long workerUs;
+                network->read(socketIndex, &workerUs, sizeof(workerUs));
+                long long receivedUs = profiler->now();
+                if (bestRoundTripUs < 0 || receivedUs - sentUs < bestRoundTripUs) {
+                    bestRoundTripUs = receivedUs - sentUs;
+                    offsetUs = workerUs - (sentUs + receivedUs) / 2;
+                }
+            }
+            network->write(socketIndex, &offsetUs, sizeof(offsetUs));
+
+            NnSize size;
+            network->read(socketIndex, &size, sizeof(size));
+            if (size == 0)
+                continue;
+            std::string workerEvents(size, '\0');
+            network->read(socketIndex, &workerEvents[0], size);
+            events += ",\n" + workerEvents;
+        }
+    }
+    executor->disableProfiler();
+
+    const char *path = tracePath;
+    tracePath = nullptr;
+    FILE *fd = fopen(path, "wb");
+    if (fd == nullptr)
+        throw std::runtime_error("Cannot open trace file: " + std::string(path));
+    bool isOk = fputs("{\"traceEvents\":[\n", fd) >= 0 &&
+        fwrite(events.data(), 1, events.size(), fd) == events.size() &&
+        fputs("\n],\"displayTimeUnit\":\"ms\"}\n", fd) >= 0;
+    if (fclose(fd) != 0 || !isOk)
+        throw std::runtime_error("Cannot write trace file: " + std::string(path));
+    printf("📊 Trace written to %s\n", path);
 }
 
 void RootLlmInference::finish() {
+    if (tracePath != nullptr)
+        writeTrace();
     if (network != nullptr) {
-        controlPacket.batchSize = 0;
-        network->writeAll(&controlPacket, sizeof(LlmControlPacket));
+        controlPacket->command = CONTROL_STOP;
+        controlPacket->batchSize = 0;
+        network->writeAll(controlPacket, sizeof(LlmControlPacket));
     }
 }
 
-WorkerLlmInference::WorkerLlmInference(NnNetExecution *execution, NnNetwork *network) {
+static float *findPipe(NnNetConfig *netConfig, NnNetExecution *execution, const char *name) {
+    for (NnUint i = 0; i < netConfig->nPipes; i++) {
+        if (std::strcmp(netConfig->pipes[i].name, name) == 0)
+            return (float *)execution->pipes[i];
+    }
+    throw std::runtime_error("Cannot find pipe: " + std::string(name));
+}
+
+WorkerLlmInference::WorkerLlmInference(NnNetConfig *netConfig, NnNodeConfig *nodeConfig, NnNetExecution *execution, NnExecutor *executor, NnNetwork *network)
+    : kvCache(nodeConfig, executor)
+{
     this->isFinished = false;
+    this->hasBatch = false;
     this->execution = execution;
+    this->executor = executor;
     this->network = network;
-    this->positionPipe = (float *)execution->pipes[0];
+    this->nodeIndex = nodeConfig->nodeIndex;
+    this->positionPipe = findPipe(netConfig, execution, "POS");
+    this->slotPipe = findPipe(netConfig, execution, "SLOT");
+    this->controlRows.reset(new LlmControlRow[execution->nBatches]);
 }
 
 bool WorkerLlmInference::tryReadControlPacket() {
     const unsigned long maxAttempts = 10000;
     if (!network->tryReadWithMaxAttempts(ROOT_SOCKET_INDEX, &controlPacket, sizeof(LlmControlPacket), maxAttempts))
         return false;
-    if (controlPacket.batchSize == 0) {
+    hasBatch = false;
+    if (controlPacket.command == CONTROL_STOP) {
         printf("🛑 Stop signal\n");
         isFinished = true;
         return true;
     }
-    for (NnUint i = 0; i < controlPacket.batchSize; i++)
-        positionPipe[i] = (float)(controlPacket.position + i);
+    if (controlPacket.command == CONTROL_SAVE_KV_CACHE || controlPacket.command == CONTROL_LOAD_KV_CACHE) {
+        handleKvCacheCommand();
+        return true;
+    }
+    if (controlPacket.command == CONTROL_SHIFT_KV_CACHE) {
+        handleKvShiftCommand();
+        return true;
+    }
+    if (controlPacket.command == CONTROL_START_TRACE) {
+        executor->enableProfiler();
+        return true;
+    }
+    if (controlPacket.command == CONTROL_COLLECT_TRACE) {
+        handleCollectTraceCommand();
+        return true;
+    }
+    assert(controlPacket.command == CONTROL_FORWARD);
+    assert(controlPacket.batchSize <= execution->nBatches);
+    network->read(ROOT_SOCKET_INDEX, controlRows.get(), controlPacket.batchSize * sizeof(LlmControlRow));
+    for (NnUint i = 0; i < controlPacket.batchSize; i++) {
+        positionPipe[i] = (float)controlRows[i].position;
+        slotPipe[i] = (float)controlRows[i].slot;
+    }
     execution->setBatchSize(controlPacket.batchSize);
+    hasBatch = true;
     return true;
 }
 
+void WorkerLlmInference::handleKvCacheCommand() {
+    LlmKvCachePacket kvPacket;
+    network->read(ROOT_SOCKET_INDEX, &kvPacket, sizeof(kvPacket));
+    kvPacket.path[LLM_KV_CACHE_PATH_MAX - 1] = '\0';
+
+    NnUint isOk = 1;
+    try {
+        if (controlPacket.command == CONTROL_SAVE_KV_CACHE) {
+            kvCache.save(kvPacket.rowOffset, kvPacket.nRows, kvPacket.path);
+            printf("💾 Saved KV cache: %u rows\n", kvPacket.nRows);
+        } else {
+            NnUint nRows = kvCache.load(kvPacket.rowOffset, kvPacket.nRows, kvPacket.path);
+            if (nRows != kvPacket.nRows)
+                throw std::runtime_error("KV cache file holds a different number of rows than the root node");
+            printf("💾 Loaded KV cache: %u rows\n", nRows);
+        }
+    } catch (const std::runtime_error &e) {
+        printf("🚨 KV cache error: %s\n", e.what());
+        isOk = 0;
+    }
+    network->write(ROOT_SOCKET_INDEX, &isOk, sizeof(isOk));
+}
+
+void WorkerLlmInference::handleKvShiftCommand() {
+    LlmKvShiftPacket shiftPacket;
+    network->read(ROOT_SOCKET_INDEX, &shiftPacket, sizeof(shiftPacket));
+    kvCache.shift(shiftPacket.rowOffset, shiftPacket.nKeep, shiftPacket.nDiscard, shiftPacket.nRows);
+}
+
+void WorkerLlmInference::handleCollectTraceCommand() {
+    NnProfiler *profiler = executor->getProfiler();
+    for (NnUint sample = 0; sample < LLM_TRACE_CLOCK_SAMPLES; sample++) {
+        NnUint rootSample;
+        network->read(ROOT_SOCKET_INDEX, &rootSample, sizeof(rootSample));
+        long long nowUs = profiler != nullptr ? profiler->now() : 0;
+        network->write(ROOT_SOCKET_INDEX, &nowUs, sizeof(nowUs));
+    }
+    long long offsetUs;
+    network->read(ROOT_SOCKET_INDEX, &offsetUs, sizeof(offsetUs));
+
+    std::string events = executor->getTraceEvents(nodeIndex, offsetUs);
+    executor->disableProfiler();
+    NnSize size = events.size();
+    network->write(ROOT_SOCKET_INDEX, &size, sizeof(size));
+    if (size > 0)
+        network->write(ROOT_SOCKET_INDEX, events.data(), size);
+    printf("📊 Sent trace: %zu bytes\n", size);
+}
+
+LlmDraftModel::LlmDraftModel(AppCliArgs *args, LlmHeader *mainHeader) {
+    header = loadLlmHeader(args->draftModelPath, mainHeader->seqLen, F_32);
+    if (header.weightType != F_32 && header.weightType != F_16)
+        header.syncType = F_Q80;
+    if (header.vocabSize != mainHeader->vocabSize)
+        throw std::runtime_error("The draft model has a different vocabulary than the main model");
+    if (header.seqLen < mainHeader->seqLen)
+        throw std::runtime_error("The draft model supports a shorter context than the main model");
+
+    net = buildLlmNet(&header, 1, args->nBatches, args->nSlots, 0);
+    NnNodeConfig *nodeConfig = &net.nodeConfigs[0];
+    if (args->info) {
+        printf("📝 Draft model\n");
+        printLlmHeader(&header);
+        printNodeRequiredMemory(&net.netConfig, nodeConfig);
+    }
+
+    execution.reset(new NnNetExecution(args->nThreads, &net.netConfig));
+    synchronizer.reset(new NnFakeNodeSynchronizer());
+    devices.push_back(NnExecutorDevice(new NnCpuDevice(&net.netConfig, nodeConfig, execution.get()), -1, -1));
+    executor.reset(new NnExecutor(&net.netConfig, nodeConfig, &devices, execution.get(), synchronizer.get(), false));
+
+    NnRootWeightLoader weightLoader(executor.get(), nullptr, 1);
+    loadLlmNetWeight(args->draftModelPath, &net, &weightLoader);
+
+    inference.reset(new RootLlmInference(&net, args->nSlots, execution.get(), executor.get(), nullptr));
+    nCachedTokens.resize(args->nSlots, 0);
+}
+
+LlmDraftModel::~LlmDraftModel() {
+    inference.reset();
+    executor.reset();
+    devices.clear();
+    releaseLlmNet(&net);
+}
+
+NnUint LlmDraftModel::argmax(NnUint batchIndex) {
+    const float *logits = &inference->logitsPipe[batchIndex * header.vocabSize];
+    NnUint best = 0;
+    for (NnUint i = 1; i < header.vocabSize; i++) {
+        if (logits[i] > logits[best])
+            best = i;
+    }
+    return best;
+}
+
+void LlmDraftModel::propose(NnUint nRequests, LlmDraftRequest *requests) {
+    const NnUint nBatches = execution->nBatches;
+    assert(nRequests <= nBatches);
+
+    // Catch up with the tokens the main model has accepted since the last proposal
+    NnUint batchSize = 0;
+    for (NnUint r = 0; r < nRequests; r++) {
+        LlmDraftRequest *request = &requests[r];
+        request->nDraftTokens = 0;
+        NnUint *nCached = &nCachedTokens[request->slot];
+        if (*nCached > request->pos)
+            *nCached = request->pos;
+        while (*nCached < request->pos) {
+            if (batchSize == nBatches) {
+                inference->setBatchSize(batchSize);
+                inference->forward();
+                batchSize = 0;
+            }
+            if (batchSize == 0)
+                inference->setBatchSize(nBatches);
+            inference->setRowPosition(batchSize, *nCached, request->slot);
+            inference->setToken(batchSize, request->tokens[*nCached]);
+            batchSize++;
+            (*nCached)++;
+        }
+    }
+    if (batchSize > 0) {
+        inference->setBatchSize(batchSize);
+        inference->forward();
+    }
+
+    // Every step feeds the last token of each request, the greedy prediction becomes the next draft token
+    std::vector<NnUint> rowRequests(nRequests);
+    for (NnUint step = 0; ; step++) {
+        batchSize = 0;
+        for (NnUint r = 0; r < nRequests; r++) {
+            LlmDraftRequest *request = &requests[r];
+            if (step >= request->maxDraftTokens)
+                continue;
+            int token = step == 0 ? request->tokens[request->pos] : request->draftTokens[step - 1];
+            rowRequests[batchSize] = r;
+            batchSize++;
+            inference->setBatchSize(batchSize);
+            inference->setRowPosition(batchSize - 1, request->pos + step, request->slot);
+            inference->setToken(batchSize - 1, token);
+            nCachedTokens[request->slot] = request->pos + step + 1;
+        }
+        if (batchSize == 0)
+            break;
+        inference->forward();
+        for (NnUint i = 0; i < batchSize; i++) {
+            LlmDraftRequest *request = &requests[rowRequests[i]];
+            request->draftTokens[step] = argmax(i);
+            request->nDraftTokens = step + 1;
+        }
+    }
+}
+
+void LlmDraftModel::rewind(NnUint slot, NnUint pos) {
+    if (nCachedTokens[slot] > pos)
+        nCachedTokens[slot] = pos;
+}
+
+LlmPromptLookup::LlmPromptLookup(NnUint maxNgram) {
+    this->maxNgram = maxNgram;
+}
+
+void LlmPromptLookup::propose(NnUint nRequests, LlmDraftRequest *requests) {
+    for (NnUint r = 0; r < nRequests; r++) {
+        LlmDraftRequest *request = &requests[r];
+        request->nDraftTokens = 0;
+        const int *tokens = request->tokens;
+        const NnUint nTokens = request->pos + 1;
+
+        // Longer n-grams first, the latest occurrence wins
+        for (NnUint n = std::min(maxNgram, nTokens - 1); n > 0 && request->nDraftTokens == 0; n--) {
+            const int *ngram = &tokens[nTokens - n];
+            for (NnUint start = nTokens - n; start-- > 0;) {
+                if (std::memcmp(&tokens[start], ngram, n * sizeof(int)) != 0)
+                    continue;
+                NnUint nFollowing = std::min(nTokens - (start + n), request->maxDraftTokens);
+                std::memcpy(request->draftTokens, &tokens[start + n], nFollowing * sizeof(int));
+                request->nDraftTokens = nFollowing;
+                break;
+            }
+        }
+    }
+}
+
 void runInferenceApp(AppCliArgs *args, void (*handler)(AppInferenceContext *context)) {
     NnUint nNodes = args->nWorkers + 1;
 
@@ -236,16 +808,16 @@ void runInferenceApp(AppCliArgs *args, void (*handler)(AppInferenceContext *cont
     if (nNodes > header.nKvHeads)
         // TODO: https://github.com/b4rtaz/distributed-llama/issues/70
         throw std::runtime_error("This version does not support more nodes than the number of KV heads in the model");
-    if (header.weightType == F_Q40 && header.syncType != F_Q80)
-        throw std::runtime_error("This version supports only Q40 weights with Q80 sync type");
+    if (header.weightType != F_32 && header.weightType != F_16 && header.syncType != F_Q80)
+        throw std::runtime_error("This version supports only Q80 sync type for quantized weights");
 
-    Tokenizer tokenizer(args->tokenizerPath);
+    Tokenizer tokenizer(args->tokenizerPath, args->nThreads);
     if (args->info && tokenizer.vocabSize != header.vocabSize)
         printf("Tokenizer vocab size (%d) does not match the model vocab size (%d)\n", tokenizer.vocabSize, header.vocabSize);
 
-    Sampler sampler(tokenizer.vocabSize, args->temperature, args->topp, args->seed);
+    Sampler sampler(tokenizer.vocabSize, args->temperature, args->topp, args->topk, args->minp, args->seed, args->nThreads);
 
-    LlmNet net = buildLlmNet(&header, nNodes, args->nBatches);
+    LlmNet net = buildLlmNet(&header, nNodes, args->nBatches, args->nSlots, args->logitsTopk);
     std::unique_ptr<LlmNet, void(*)(LlmNet *)> netPtr(&net, releaseLlmNet);
 
     NnNodeConfig *rootNodeConfig = &net.nodeConfigs[0];
@@ -279,7 +851,13 @@ void runInferenceApp(AppCliArgs *args, void (*handler)(AppInferenceContext *cont
     NnRootWeightLoader weightLoader(&executor, network, nNodes);
     loadLlmNetWeight(args->modelPath, &net, &weightLoader);
 
-    RootLlmInference inference(&net, &execution, &executor, network);
+    RootLlmInference inference(&net, args->nSlots, &execution, &executor, network);
+
+    std::unique_ptr<LlmDraftProposer> draft;
+    if (args->draftModelPath != nullptr)
+        draft.reset(new LlmDraftModel(args, &header));
+    else if (args->lookupNgram > 0)
+        draft.reset(new LlmPromptLookup(args->lookupNgram));
 
     if (network != nullptr) {
         network->resetStats();
@@ -297,6 +875,10 @@ void runInferenceApp(AppCliArgs *args, void (*handler)(AppInferenceContext *cont
     context.tokenizer = &tokenizer;
     context.network = network;
     context.executor = &executor;
+    context.draft = draft.get();
+
+    if (args->tracePath != nullptr)
+        inference.startTrace(args->tracePath, args->nTraceForwards);
 
     handler(&context);
 
@@ -325,7 +907,7 @@ void runWorkerApp(AppCliArgs *args) {
         NnWorkerWeightReader weightReader(&executor, network);
         weightReader.read();
 
-        WorkerLlmInference inference(&execution, network);
+        WorkerLlmInference inference(&netConfig, &nodeConfig, &execution, &executor, network);
         bool isFirstAttempt = true;
         bool isTurboEnabled = false;
         clock_t startTime;
@@ -345,6 +927,10 @@ void runWorkerApp(AppCliArgs *args) {
                 }
                 if (inference.isFinished)
                     break;
+                if (!inference.hasBatch) {
+                    isFirstAttempt = true;
+                    continue;
+                }
 
                 if (args->netTurbo && !isTurboEnabled) {
                     network->setTurbo(true);
@@ -2,6 +2,9 @@
 #define APP_HPP
 
 #include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
 #include "nn/nn-core.hpp"
 #include "nn/nn-cpu.hpp"
 #include "tokenizer.hpp"
@@ -25,12 +28,23 @@ public:
     NnUint *workerPorts;
     float temperature;
     float topp;
+    NnUint topk;
+    float minp;
     NnUint steps;
     bool benchmark;
     unsigned long long seed;
     ChatTemplateType chatTemplateType;
     NnUint maxSeqLen;
+    NnUint nSlots;
+    NnUint ctxKeep;
+    char *kvCacheDir;
+    NnUint logitsTopk;
+    char *draftModelPath;
+    NnUint nDraftTokens;
+    NnUint lookupNgram;
     bool netTurbo;
+    char *tracePath;
+    NnUint nTraceForwards;
     int gpuIndex;
     int gpuSegmentFrom;
     int gpuSegmentTo;
@@ -43,42 +57,182 @@ public:
     ~AppCliArgs();
 };
 
+enum LlmControlCommand {
+    CONTROL_FORWARD = 0,
+    CONTROL_STOP = 1,
+    CONTROL_SAVE_KV_CACHE = 2,
+    CONTROL_LOAD_KV_CACHE = 3,
+    CONTROL_SHIFT_KV_CACHE = 4,
+    CONTROL_START_TRACE = 5,
+    CONTROL_COLLECT_TRACE = 6,
+};
+
 typedef struct {
-    NnUint position;
-    NnUint batchSize; // 0 = stop signal
+    NnUint command;
+    NnUint batchSize;
 } LlmControlPacket;
 
+// Sent right after the control packet, one per batch row
+typedef struct {
+    NnUint position;
+    NnUint slot;
+} LlmControlRow;
+
+#define LLM_KV_CACHE_PATH_MAX 256
+#define LLM_TRACE_CLOCK_SAMPLES 8 // Round trips measured to align the clock of a worker with the root node
+
+// Sent right after the control packet by the KV cache commands
+typedef struct {
+    NnUint rowOffset;
+    NnUint nRows;
+    char path[LLM_KV_CACHE_PATH_MAX];
+} LlmKvCachePacket;
+
+// Sent right after the control packet by the shift command
+typedef struct {
+    NnUint rowOffset;
+    NnUint nKeep;
+    NnUint nDiscard;
+    NnUint nRows;
+} LlmKvShiftPacket;
+
+typedef struct {
+    NnUint segmentIndex;
+    NnUint keyBufferIndex;
+    NnUint valueBufferIndex;
+    NnRopeOpConfig *rope;
+} LlmKvCacheLayer;
+
+// Operates on the rows of the KV cache slice held by one node. Every node persists its slice in
+// its own file, the file name is the given path with the `.kv<nodeIndex>` suffix.
+class LlmKvCache {
+private:
+    NnNodeConfig *nodeConfig;
+    NnExecutor *executor;
+    std::vector<LlmKvCacheLayer> layers;
+    NnSize keyRowBytes;
+    NnSize valueRowBytes;
+    NnUint nRows;
+public:
+    LlmKvCache(NnNodeConfig *nodeConfig, NnExecutor *executor);
+    void save(NnUint rowOffset, NnUint nRows, const char *path);
+    NnUint load(NnUint rowOffset, NnUint maxRows, const char *path);
+    void shift(NnUint rowOffset, NnUint nKeep, NnUint nDiscard, NnUint nRows);
+private:
+    std::string getFilePath(const char *path);
+};
+
 class RootLlmInference {
 public:
     float *logitsPipe;
 private:
     float *tokenPipe;
     float *positionPipe;
+    float *slotPipe;
+    float *logitsTopkPipe;
+    NnUint nLogitsTopk;
+    NnUint nNodes;
     LlmHeader *header;
+    NnUint nSlots;
     NnNetExecution *execution;
     NnExecutor *executor;
     NnNetwork *network;
-    LlmControlPacket controlPacket;
+    LlmKvCache kvCache;
+    std::unique_ptr<NnByte[]> controlBuffer;
+    LlmControlPacket *controlPacket;
+    LlmControlRow *controlRows;
+    const char *tracePath; // Not nullptr while the profiler records
+    NnUint nTraceForwards;
 public:
-    RootLlmInference(LlmNet *net, NnNetExecution *execution, NnExecutor *executor, NnNetwork *network);
+    RootLlmInference(LlmNet *net, NnUint nSlots, NnNetExecution *execution, NnExecutor *executor, NnNetwork *network);
     void setBatchSize(NnUint batchSize);
     void setPosition(NnUint position);
+    void setRowPosition(NnUint batchIndex, NnUint position, NnUint slot);
     void setToken(NnUint batchIndex, NnUint token);
     void forward();
+    void saveKvCache(NnUint slot, NnUint nTokens, const char *path);
+    NnUint loadKvCache(NnUint slot, const char *path);
+    void shiftKvCache(NnUint slot, NnUint nKeep, NnUint nDiscard, NnUint nTokens);
+    void startTrace(const char *path, NnUint nForwards);
     void finish();
+private:
+    void sendKvCacheCommand(LlmControlCommand command, NnUint slot, NnUint nTokens, const char *path);
+    void writeTrace();
+    void mergeLogitsTopk();
 };
 
 class WorkerLlmInference {
 public:
     bool isFinished;
+    bool hasBatch;
 private:
     float *positionPipe;
+    float *slotPipe;
     NnNetExecution *execution;
+    NnExecutor *executor;
     NnNetwork *network;
+    NnUint nodeIndex;
+    LlmKvCache kvCache;
     LlmControlPacket controlPacket;
+    std::unique_ptr<LlmControlRow[]> controlRows;
 public:
-    WorkerLlmInference(NnNetExecution *execution, NnNetwork *network);
+    WorkerLlmInference(NnNetConfig *netConfig, NnNodeConfig *nodeConfig, NnNetExecution *execution, NnExecutor *executor, NnNetwork *network);
     bool tryReadControlPacket();
+private:
+    void handleKvCacheCommand();
+    void handleKvShiftCommand();
+    void handleCollectTraceCommand();
+};
+
+typedef struct {
+    NnUint slot;
+    const int *tokens; // Tokens by position, `tokens[pos]` is the next token fed to the main model
+    NnUint pos;
+    NnUint maxDraftTokens;
+    NnUint nDraftTokens; // Output
+    int *draftTokens; // Output
+} LlmDraftRequest;
+
+// Proposes a few tokens that the main model verifies in one batched forward,
+// so one network round trip may yield several tokens
+class LlmDraftProposer {
+public:
+    virtual ~LlmDraftProposer() {}
+    virtual void propose(NnUint nRequests, LlmDraftRequest *requests) = 0;
+    // Forgets the state of the slot from the given position
+    virtual void rewind(NnUint slot, NnUint pos) = 0;
+};
+
+// A small model running on the root node only, it proposes tokens greedily
+class LlmDraftModel : public LlmDraftProposer {
+public:
+    LlmHeader header;
+private:
+    LlmNet net;
+    std::unique_ptr<NnNetExecution> execution;
+    std::unique_ptr<NnNodeSynchronizer> synchronizer;
+    std::vector<NnExecutorDevice> devices;
+    std::unique_ptr<NnExecutor> executor;
+    std::unique_ptr<RootLlmInference> inference;
+    std::vector<NnUint> nCachedTokens;
+public:
+    LlmDraftModel(AppCliArgs *args, LlmHeader *mainHeader);
+    ~LlmDraftModel() override;
+    void propose(NnUint nRequests, LlmDraftRequest *requests) override;
+    void rewind(NnUint slot, NnUint pos) override;
+private:
+    NnUint argmax(NnUint batchIndex);
+};
+
+// Proposes the tokens that followed the latest earlier occurrence of the last n-gram,
+// it needs no model and pays off when the output copies spans of the prompt
+class LlmPromptLookup : public LlmDraftProposer {
+private:
+    NnUint maxNgram;
+public:
+    LlmPromptLookup(NnUint maxNgram);
+    void propose(NnUint nRequests, LlmDraftRequest *requests) override;
+    void rewind(NnUint slot, NnUint pos) override {}
 };
 
 typedef struct {
@@ -89,6 +243,7 @@ typedef struct {
     Sampler *sampler;
     NnNetwork *network;
     NnExecutor *executor;
+    LlmDraftProposer *draft; // May be nullptr
 } AppInferenceContext;
 
 void runInferenceApp(AppCliArgs *args, void (*handler)(AppInferenceContext *context));
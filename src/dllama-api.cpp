@@ -11,14 +11,26 @@
 #include <csignal>
 #include <thread>
 #include <chrono>
+#include <memory>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <map>
+#include <set>
+#include <functional>
 
 #ifdef _WIN32
 #include <winsock2.h>
 #include <ws2tcpip.h>
+#define poll WSAPoll
+typedef SOCKET SOCKET_FD;
 #else
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <unistd.h>
+typedef int SOCKET_FD;
 #endif
 
 #include "tokenizer.hpp"
@@ -40,44 +52,208 @@ enum class HttpMethod {
     METHOD_UNKNOWN = 5
 };
 
+#define HTTP_MAX_HEADER_SIZE (64 * 1024)
+#define HTTP_IDLE_TIMEOUT_MS 15000
+
+// A client connection with a non-blocking socket. The I/O thread owning the connection reads it,
+// responses are written by any thread and the part the socket does not take at once is flushed
+// later by the I/O thread
+class HttpConnection {
+private:
+    std::mutex mutex;
+    std::string output;
+    int fd;
+    bool isResponseDone;
+
+    void flushOutput() {
+        size_t offset = 0;
+        while (offset < output.size()) {
+            ssize_t sent = send(fd, output.data() + offset, output.size() - offset, 0);
+            if (sent > 0) {
+                offset += sent;
+                continue;
+            }
+            if (sent < 0 && isEagainError())
+                break;
+            abort();
+            return;
+        }
+        output.erase(0, offset);
+    }
+
+    // The socket is only shut down here, the fd stays reserved until the I/O thread closes it, so
+    // it cannot be reused by a new client while the I/O thread still polls it
+    void abort() {
+        if (!isClosed.load())
+            shutdown(fd, 2);
+        isClosed.store(true);
+        output.clear();
+    }
+
+public:
+    // I/O thread only
+    std::string input;
+    bool hasNewInput; // The input has changed since the last framing attempt
+    bool hasRequest; // A request was dispatched and the connection waits for its response
+    bool keepAlive; // The connection serves the next request after the current response
+    bool isReadClosed; // The client has sent EOF, it may still wait for the response
+    std::chrono::steady_clock::time_point lastActivity;
+
+    std::atomic<bool> isClosed;
+
+    HttpConnection(int fd) {
+        this->fd = fd;
+        this->isResponseDone = false;
+        this->hasNewInput = false;
+        this->hasRequest = false;
+        this->keepAlive = false;
+        this->isReadClosed = false;
+        this->lastActivity = std::chrono::steady_clock::now();
+        this->isClosed.store(false);
+        setNonBlocking(fd, true);
+    }
+
+    ~HttpConnection() {
+        close();
+    }
+
+    // I/O thread only, no other thread changes the fd
+    int getFd() {
+        return fd;
+    }
+
+    void write(const char *data, size_t size, bool isLast) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (isClosed.load())
+            throw NnTransferSocketException(0, "Client disconnected");
+        output.append(data, size);
+        if (isLast)
+            isResponseDone = true;
+        flushOutput();
+    }
+
+    void flush() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!isClosed.load())
+            flushOutput();
+    }
+
+    bool hasOutput() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return !output.empty();
+    }
+
+    // The last part of the response is written, some of it may still wait in the output
+    bool hasCompleteResponse() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return isResponseDone;
+    }
+
+    // The whole response is written to the socket
+    bool isDone() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return isResponseDone && output.empty();
+    }
+
+    // I/O thread only. Returns false when the connection is broken. A client that half-closes the
+    // connection after its request looks the same as a gone one, so EOF closes the read side only
+    bool read() {
+        char buffer[1024 * 64];
+        for (;;) {
+            ssize_t bytesRead = recv(fd, buffer, sizeof(buffer), 0);
+            if (bytesRead > 0) {
+                input.append(buffer, bytesRead);
+                hasNewInput = true;
+                lastActivity = std::chrono::steady_clock::now();
+                continue;
+            }
+            if (bytesRead == 0) {
+                isReadClosed = true;
+                return true;
+            }
+            return isEagainError();
+        }
+    }
+
+    // Prepares a persistent connection for the next request, a pipelined one may be buffered already
+    void reset() {
+        std::lock_guard<std::mutex> lock(mutex);
+        isResponseDone = false;
+        hasRequest = false;
+        hasNewInput = true;
+        lastActivity = std::chrono::steady_clock::now();
+    }
+
+    // I/O thread only, or the destructor once nothing else holds the connection
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (fd >= 0)
+            destroySocket(fd);
+        fd = -1;
+        isClosed.store(true);
+        output.clear();
+    }
+};
+
 class HttpRequest {
 public:
-    static HttpRequest read(int serverSocket) {
-        HttpRequest req(serverSocket);
+    // Returns the size of the first complete request in the input, or 0 if more data is needed.
+    // The body is copied to `body`, a chunked body is decoded
+    static size_t frame(const std::string &input, size_t &headerSize, std::string &body) {
+        const size_t endRnRn = input.find("\r\n\r\n");
+        const size_t endNN = input.find("\n\n");
+        if (endRnRn != std::string::npos && (endNN == std::string::npos || endRnRn < endNN)) {
+            headerSize = endRnRn + 4;
+        } else if (endNN != std::string::npos) {
+            headerSize = endNN + 2;
+        } else {
+            if (input.size() > HTTP_MAX_HEADER_SIZE)
+                throw std::runtime_error("Headers are too large");
+            return 0;
+        }
+
+        std::string requestLine;
+        std::unordered_map<std::string, std::string> headers;
+        parseHeaders(input.substr(0, headerSize), requestLine, headers);
+
+        auto encoding = headers.find("transfer-encoding");
+        if (encoding != headers.end() && toLower(encoding->second).find("chunked") != std::string::npos)
+            return frameChunkedBody(input, headerSize, body);
+
+        size_t contentLength = 0;
+        auto length = headers.find("content-length");
+        if (length != headers.end()) {
+            try {
+                contentLength = std::stoul(length->second);
+            } catch (const std::exception& e) {
+                throw std::runtime_error("Bad Content-Length header - not a number");
+            }
+        }
+        if (input.size() - headerSize < contentLength)
+            return 0;
+        body = input.substr(headerSize, contentLength);
+        return headerSize + contentLength;
+    }
 
-        std::vector<char> httpRequest = req.readHttpRequest();
-        // Parse the HTTP request
-        std::string data = std::string(httpRequest.begin(), httpRequest.end());
+    static HttpRequest parse(std::shared_ptr<HttpConnection> connection, const std::string &header, const std::string &body) {
+        HttpRequest req(connection);
 
-        // Split request into lines
-        std::istringstream iss(data);
-        std::string line;
-        std::getline(iss, line);
+        std::string requestLine;
+        parseHeaders(header, requestLine, req.headers);
 
         // Parse request line
-        std::istringstream lineStream(line);
-        std::string methodStr, path;
-        lineStream >> methodStr >> path;
+        std::istringstream lineStream(requestLine);
+        std::string methodStr, path, version;
+        lineStream >> methodStr >> path >> version;
         req.method = parseMethod(methodStr);
         req.path = path;
 
-        // Parse headers
-        while (std::getline(iss, line) && line != "\r") {
-            size_t pos = line.find(':');
-            if (pos != std::string::npos) {
-                std::string key = line.substr(0, pos);
-                std::string value = line.substr(pos + 2); // Skip ': ' after key
-                // Trim whitespace and non-printable characters from header value
-                value.erase(std::remove_if(value.begin(), value.end(), [](unsigned char c) {
-                    return std::isspace(c) || !std::isprint(c);
-                }), value.end());
-                req.headers[key] = value;
-            }
-        }
-
-        // Parse body
-        std::getline(iss, req.body, '\0');
+        // HTTP/1.1 keeps the connection open unless the client asks to close it
+        auto connectionField = req.headers.find("connection");
+        std::string connectionValue = connectionField == req.headers.end() ? "" : toLower(connectionField->second);
+        req.keepAlive = version == "HTTP/1.1" ? connectionValue != "close" : connectionValue == "keep-alive";
 
+        req.body = body;
         if (req.body.size() > 0) {
             // printf("body: %s\n", req.body.c_str());
             req.parsedJson = json::parse(req.body);
@@ -95,94 +271,82 @@ public:
     }
 
 private:
-    int serverSocket;
-public:
-    std::string path;
-    std::unordered_map<std::string, std::string> headers;
-    std::string body;
-    json parsedJson;
-    HttpMethod method;
-
-    HttpRequest(int serverSocket) {
-        this->serverSocket = serverSocket;
+    static std::string toLower(std::string value) {
+        std::transform(value.begin(), value.end(), value.begin(), [](unsigned char c) { return std::tolower(c); });
+        return value;
     }
 
-    std::vector<char> readHttpRequest() {
-        std::string httpRequest;
-        char buffer[1024 * 64];
-        ssize_t bytesRead;
-
-        // First, read all headers
-        std::string headerData;
-        std::string extraReadPastHeader;
-        for (;;) {
-            bytesRead = recv(serverSocket, buffer, sizeof(buffer) - 1, 0);
-            if (bytesRead <= 0) {
-                throw std::runtime_error("Error while reading headers from socket");
-            }
-            buffer[bytesRead] = '\0';
-            headerData.append(buffer);
-
-            const size_t endRnRn = headerData.find("\r\n\r\n");
-            if (endRnRn != std::string::npos) {
-                if (endRnRn < headerData.size() - 4)
-                    extraReadPastHeader = headerData.substr(endRnRn + 4);
-                break;
-            }
-            const size_t endNN = headerData.find("\n\n");
-            if (endNN != std::string::npos) {
-                if (endNN < headerData.size() - 2)
-                    extraReadPastHeader = headerData.substr(endNN + 2);
-                break;
-            }
-        }
-
-        httpRequest.append(headerData);
-
-        // Next, find Content-Length header for body length
-        std::istringstream headerStream(headerData);
+    // Header names are case-insensitive, they are stored in lowercase
+    static void parseHeaders(const std::string &header, std::string &requestLine, std::unordered_map<std::string, std::string> &headers) {
+        std::istringstream iss(header);
         std::string line;
-        ssize_t contentLength = 0;
-        while (std::getline(headerStream, line) && line != "\r" && line != "\n") {
+        std::getline(iss, requestLine);
+        while (std::getline(iss, line) && line != "\r" && !line.empty()) {
             size_t pos = line.find(':');
             if (pos != std::string::npos) {
-                std::string key = line.substr(0, pos);
-                std::string value = line.substr(pos + 2); // Skip ': ' after key
-                if (key == "Content-Length") {
-                    try {
-                      contentLength = std::stoi(value);  // stoi ignores any whitespace
-                    } catch (const std::invalid_argument& e) {
-                      throw std::runtime_error("Bad Content-Length header - not a number");
-                    }
-                    break;
-                }
+                std::string key = toLower(line.substr(0, pos));
+                std::string value = line.substr(pos + 1);
+                // Trim whitespace and non-printable characters from header value
+                value.erase(std::remove_if(value.begin(), value.end(), [](unsigned char c) {
+                    return std::isspace(c) || !std::isprint(c);
+                }), value.end());
+                headers[key] = value;
             }
         }
+    }
 
-        // Now read the full content body
-        if (contentLength > 0) {
-            // If we read any extra past the header before, read that much less now
-            // But first, sanity check to make sure Content-Length isn't lying and there is actually more
-            if (extraReadPastHeader.size() > static_cast<size_t>(contentLength)) {
-                throw std::runtime_error("Received more body data than Content-Length header said");
-            }
-            contentLength -= extraReadPastHeader.size();
-
-            std::vector<char> body(contentLength);
-            ssize_t totalRead = 0;
-            while (totalRead < contentLength) {
-                bytesRead = recv(serverSocket, body.data() + totalRead, contentLength - totalRead, 0);
-                if (bytesRead <= 0) {
-                    throw std::runtime_error("Error while reading body from socket");
+    static size_t frameChunkedBody(const std::string &input, size_t pos, std::string &body) {
+        body.clear();
+        for (;;) {
+            size_t lineEnd = input.find("\r\n", pos);
+            if (lineEnd == std::string::npos)
+                return 0;
+            char *sizeEnd;
+            size_t size = std::strtoul(input.c_str() + pos, &sizeEnd, 16);
+            if (sizeEnd == input.c_str() + pos)
+                throw std::runtime_error("Bad chunk size");
+            pos = lineEnd + 2;
+            if (size == 0) {
+                // Trailer fields end with an empty line
+                for (;;) {
+                    lineEnd = input.find("\r\n", pos);
+                    if (lineEnd == std::string::npos)
+                        return 0;
+                    if (lineEnd == pos)
+                        return pos + 2;
+                    pos = lineEnd + 2;
                 }
-                totalRead += bytesRead;
-            }
-            if (body.size() > 0) {
-              httpRequest.append(body.data(), contentLength);
             }
+            if (input.size() - pos < size + 2)
+                return 0;
+            body.append(input, pos, size);
+            pos += size + 2;
         }
+    }
+
+    std::shared_ptr<HttpConnection> connection; // Keeps the connection open as long as any copy of the request lives
+public:
+    std::string path;
+    std::unordered_map<std::string, std::string> headers;
+    std::string body;
+    json parsedJson;
+    HttpMethod method;
+    bool keepAlive;
+
+    HttpRequest(std::shared_ptr<HttpConnection> connection) {
+        this->connection = connection;
+        this->keepAlive = false;
+    }
 
-        return std::vector<char>(httpRequest.begin(), httpRequest.end());
+    // The client has disconnected or reset the connection, nothing more can be written
+    bool isClosed() {
+        return connection->isClosed.load();
+    }
+
+    std::string connectionHeader() {
+        if (!keepAlive)
+            return "Connection: close\r\n";
+        return "Connection: keep-alive\r\nKeep-Alive: timeout=" + std::to_string(HTTP_IDLE_TIMEOUT_MS / 1000) + "\r\n";
     }
 
     std::string getMethod() {
@@ -200,32 +364,42 @@ public:
             << "Access-Control-Allow-Origin: *\r\n"
             << "Access-Control-Allow-Methods: GET, POST, PUT, DELETE\r\n"
             << "Access-Control-Allow-Headers: Content-Type, Authorization\r\n"
-            << "Connection: close\r\n"
+            << connectionHeader()
             << "\r\n";
         std::string data = buffer.str();
-        writeSocket(serverSocket, data.c_str(), data.size());
+        connection->write(data.c_str(), data.size(), true);
     }
 
     void writeNotFound() {
         std::ostringstream buffer;
         buffer << "HTTP/1.1 404 Not Found\r\n"
-            << "Connection: close\r\n"
+            << connectionHeader()
             << "Content-Length: 9\r\n"
             << "\r\n"
             << "Not Found";
         std::string data = buffer.str();
-        writeSocket(serverSocket, data.c_str(), data.size());
+        connection->write(data.c_str(), data.size(), true);
     }
 
-    void writeJson(std::string json) {
+    void writeText(const std::string &text, const char *contentType) {
         std::ostringstream buffer;
         buffer << "HTTP/1.1 200 OK\r\n"
+            << "Content-Type: " << contentType << "\r\n"
+            << connectionHeader()
+            << "Content-Length: " << text.length() << "\r\n\r\n" << text;
+        std::string data = buffer.str();
+        connection->write(data.c_str(), data.size(), true);
+    }
+
+    void writeJson(std::string json, const char *status = "200 OK") {
+        std::ostringstream buffer;
+        buffer << "HTTP/1.1 " << status << "\r\n"
             << "Access-Control-Allow-Origin: *\r\n"
             << "Content-Type: application/json; charset=utf-8\r\n"
-            << "Connection: close\r\n"
+            << connectionHeader()
             << "Content-Length: " << json.length() << "\r\n\r\n" << json;
         std::string data = buffer.str();
-        writeSocket(serverSocket, data.c_str(), data.size());
+        connection->write(data.c_str(), data.size(), true);
     }
 
     void writeStreamStartChunk() {
@@ -233,22 +407,22 @@ public:
         buffer << "HTTP/1.1 200 OK\r\n"
             << "Access-Control-Allow-Origin: *\r\n"
             << "Content-Type: text/event-stream; charset=utf-8\r\n"
-            << "Connection: close\r\n"
+            << connectionHeader()
             << "Transfer-Encoding: chunked\r\n\r\n";
         std::string data = buffer.str();
-        writeSocket(serverSocket, data.c_str(), data.size());
+        connection->write(data.c_str(), data.size(), false);
     }
 
     void writeStreamChunk(const std::string data) {
         std::ostringstream buffer;
         buffer << std::hex << data.size() << "\r\n" << data << "\r\n";
         std::string d = buffer.str();
-        writeSocket(serverSocket, d.c_str(), d.size());
+        connection->write(d.c_str(), d.size(), false);
     }
 
     void writeStreamEndChunk() {
         const char *endChunk = "0000\r\n\r\n";
-        writeSocket(serverSocket, endChunk, strlen(endChunk));
+        connection->write(endChunk, strlen(endChunk), true);
     }
 };
 
@@ -295,203 +469,1015 @@ void writeChatCompletionChunk(HttpRequest &request, const std::string &delta, co
     }
 }
 
-class NaiveCacheItem {
+// Token-level radix tree over the KV cache content of all slots. A slot is listed in every node
+// on the path of tokens it holds, so the deepest node with an available slot gives the longest
+// prefix that does not need to be prefilled again.
+class PrefixTree {
+private:
+    struct Node {
+        std::vector<int> tokens; // Edge from the parent
+        Node *parent;
+        std::map<int, std::unique_ptr<Node>> children;
+        std::set<NnUint> slots;
+    };
+    Node root;
+    std::vector<Node *> slotEnds;
+
 public:
-    pos_t endPos;
-    ChatMessage message;
-    NaiveCacheItem(pos_t endPos, ChatMessage message) {
-        this->endPos = endPos;
-        this->message = message;
+    PrefixTree(NnUint nSlots) {
+        root.parent = nullptr;
+        slotEnds.resize(nSlots, &root);
+    }
+
+    NnUint match(const int *tokens, NnUint nTokens, std::function<bool(NnUint)> isAvailable, std::vector<NnUint> &candidates) {
+        candidates.clear();
+        Node *node = &root;
+        NnUint matched = 0;
+        NnUint bestLength = 0;
+        while (matched < nTokens) {
+            auto it = node->children.find(tokens[matched]);
+            if (it == node->children.end())
+                break;
+            Node *child = it->second.get();
+            NnUint k = commonLength(child->tokens, &tokens[matched], nTokens - matched);
+
+            std::vector<NnUint> available;
+            for (NnUint slot : child->slots) {
+                if (isAvailable(slot))
+                    available.push_back(slot);
+            }
+            // Slots of a child are a subset of its parent's slots, nothing deeper can be available
+            if (available.empty())
+                break;
+            bestLength = matched + k;
+            candidates = available;
+
+            if (k < child->tokens.size())
+                break;
+            matched += k;
+            node = child;
+        }
+        return bestLength;
+    }
+
+    void insert(NnUint slot, const int *tokens, NnUint nTokens) {
+        assert(slotEnds[slot] == &root);
+        Node *node = &root;
+        NnUint i = 0;
+        while (i < nTokens) {
+            auto it = node->children.find(tokens[i]);
+            if (it == node->children.end()) {
+                Node *child = new Node();
+                child->tokens.assign(&tokens[i], &tokens[nTokens]);
+                child->parent = node;
+                node->children[tokens[i]] = std::unique_ptr<Node>(child);
+                child->slots.insert(slot);
+                node = child;
+                break;
+            }
+            Node *child = it->second.get();
+            NnUint k = commonLength(child->tokens, &tokens[i], nTokens - i);
+            if (k < child->tokens.size())
+                child = split(child, k);
+            child->slots.insert(slot);
+            i += k;
+            node = child;
+        }
+        slotEnds[slot] = node;
+    }
+
+    std::vector<int> getTokens(NnUint slot) {
+        std::vector<int> tokens;
+        for (Node *node = slotEnds[slot]; node != &root; node = node->parent)
+            tokens.insert(tokens.begin(), node->tokens.begin(), node->tokens.end());
+        return tokens;
+    }
+
+    void remove(NnUint slot) {
+        Node *node = slotEnds[slot];
+        while (node != &root) {
+            Node *parent = node->parent;
+            node->slots.erase(slot);
+            if (node->slots.empty())
+                parent->children.erase(node->tokens[0]);
+            node = parent;
+        }
+        slotEnds[slot] = &root;
+    }
+
+private:
+    static NnUint commonLength(const std::vector<int> &edge, const int *tokens, NnUint nTokens) {
+        NnUint n = std::min((NnUint)edge.size(), nTokens);
+        NnUint k = 0;
+        while (k < n && edge[k] == tokens[k])
+            k++;
+        return k;
+    }
+
+    Node *split(Node *node, NnUint length) {
+        Node *parent = node->parent;
+        std::unique_ptr<Node> nodePtr = std::move(parent->children[node->tokens[0]]);
+
+        Node *head = new Node();
+        head->tokens.assign(node->tokens.begin(), node->tokens.begin() + length);
+        head->parent = parent;
+        head->slots = node->slots;
+        parent->children[head->tokens[0]] = std::unique_ptr<Node>(head);
+
+        node->tokens.erase(node->tokens.begin(), node->tokens.begin() + length);
+        node->parent = head;
+        head->children[node->tokens[0]] = std::move(nodePtr);
+        return head;
     }
 };
 
-class NaiveCache {
+enum ApiRequestType {
+    REQUEST_COMPLETION,
+    REQUEST_SAVE_SLOT,
+    REQUEST_RESTORE_SLOT,
+};
+
+struct ApiRequest {
+    ApiRequestType type;
+    HttpRequest request;
+    InferenceParams params;
+    std::chrono::steady_clock::time_point receivedTime;
+};
+
+class ApiRequestQueue {
 private:
-    std::vector<NaiveCacheItem> cache;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::unique_ptr<ApiRequest>> items;
 public:
-    void push(NaiveCacheItem item) {
-        cache.push_back(item);
+    void push(std::unique_ptr<ApiRequest> item) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            items.push_back(std::move(item));
+        }
+        cv.notify_one();
     }
 
-    void clear() {
-        cache.clear();
+    size_t size() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return items.size();
     }
 
-    bool resolveDeltaPrompt(std::vector<ChatMessage>& messages, pos_t& startPos) {
-        size_t cacheSize = cache.size();
-        if (cacheSize == 0)
-            return false;
-        if (messages.size() > cacheSize) {
-            size_t i = 0;
-            while (i < cacheSize) {
-                if (
-                    cache[i].message.role != messages[i].role ||
-                    cache[i].message.content != messages[i].content
-                ) break;
-                i++;
-            }
-            if (i == cacheSize) {
-                startPos = cache[i - 1].endPos;
-                messages.erase(messages.begin(), messages.begin() + i);
-                printf("🐤 Found naive cache for %zu messages, pos=%d\n", i, startPos);
-                return true;
+    std::unique_ptr<ApiRequest> pop(bool wait) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (wait)
+            cv.wait(lock, [this] { return !items.empty(); });
+        if (items.empty())
+            return nullptr;
+        std::unique_ptr<ApiRequest> item = std::move(items.front());
+        items.pop_front();
+        return item;
+    }
+};
+
+static const double latencyBuckets[] = {0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0, 30.0};
+static const double throughputBuckets[] = {10.0, 25.0, 50.0, 100.0, 250.0, 500.0, 1000.0, 2500.0, 5000.0, 10000.0, 25000.0};
+
+class ApiHistogram {
+private:
+    std::vector<double> bounds;
+    std::vector<unsigned long long> counts;
+    double sum;
+    unsigned long long count;
+public:
+    ApiHistogram(const double *bounds, size_t nBounds)
+        : bounds(bounds, bounds + nBounds), counts(nBounds, 0)
+    {
+        this->sum = 0.0;
+        this->count = 0;
+    }
+
+    void observe(double value) {
+        for (size_t i = 0; i < bounds.size(); i++) {
+            if (value <= bounds[i]) {
+                counts[i]++;
+                break;
             }
         }
-        cache.clear();
-        return false;
+        sum += value;
+        count++;
+    }
+
+    void write(std::ostringstream &out, const char *name, const char *help) {
+        out << "# HELP " << name << " " << help << "\n"
+            << "# TYPE " << name << " histogram\n";
+        unsigned long long cumulative = 0;
+        for (size_t i = 0; i < bounds.size(); i++) {
+            cumulative += counts[i];
+            out << name << "_bucket{le=\"" << bounds[i] << "\"} " << cumulative << "\n";
+        }
+        out << name << "_bucket{le=\"+Inf\"} " << count << "\n"
+            << name << "_sum " << sum << "\n"
+            << name << "_count " << count << "\n";
+    }
+};
+
+// Collected by the inference thread and rendered in the Prometheus text format on an I/O thread
+class ApiMetrics {
+private:
+    std::mutex mutex;
+    NnNetwork *network; // May be nullptr
+    NnExecutor *executor;
+    std::vector<std::string> workerNames;
+    std::vector<unsigned long long> workerSentBytes;
+    std::vector<unsigned long long> workerRecvBytes;
+    ApiHistogram timeToFirstToken;
+    ApiHistogram interTokenLatency;
+    ApiHistogram prefillThroughput;
+    ApiHistogram forwardEvalTime;
+    ApiHistogram forwardSyncTime;
+    unsigned long long nPrefillTokens;
+    unsigned long long nGeneratedTokens;
+    unsigned long long nCompletedRequests;
+    unsigned long long nCancelledRequests;
+    NnUint nActiveSequences;
+    std::vector<NnUint> slotTokens;
+    NnUint seqLen;
+
+    static void writeCounter(std::ostringstream &out, const char *name, const char *help, unsigned long long value) {
+        out << "# HELP " << name << " " << help << "\n"
+            << "# TYPE " << name << " counter\n"
+            << name << " " << value << "\n";
+    }
+
+    static void writeGauge(std::ostringstream &out, const char *name, const char *help, unsigned long long value) {
+        out << "# HELP " << name << " " << help << "\n"
+            << "# TYPE " << name << " gauge\n"
+            << name << " " << value << "\n";
+    }
+
+public:
+    ApiMetrics(AppInferenceContext *context)
+        : timeToFirstToken(latencyBuckets, sizeof(latencyBuckets) / sizeof(double)),
+          interTokenLatency(latencyBuckets, sizeof(latencyBuckets) / sizeof(double)),
+          prefillThroughput(throughputBuckets, sizeof(throughputBuckets) / sizeof(double)),
+          forwardEvalTime(latencyBuckets, sizeof(latencyBuckets) / sizeof(double)),
+          forwardSyncTime(latencyBuckets, sizeof(latencyBuckets) / sizeof(double)),
+          slotTokens(context->args->nSlots, 0)
+    {
+        this->network = context->network;
+        this->executor = context->executor;
+        if (network != nullptr) {
+            for (NnUint i = 0; i < network->nSockets; i++)
+                workerNames.push_back(std::string(context->args->workerHosts[i]) + ":" + std::to_string(context->args->workerPorts[i]));
+        }
+        workerSentBytes.resize(workerNames.size(), 0);
+        workerRecvBytes.resize(workerNames.size(), 0);
+        this->nPrefillTokens = 0;
+        this->nGeneratedTokens = 0;
+        this->nCompletedRequests = 0;
+        this->nCancelledRequests = 0;
+        this->nActiveSequences = 0;
+        this->seqLen = context->header->seqLen;
+    }
+
+    void recordForward() {
+        std::lock_guard<std::mutex> lock(mutex);
+        forwardEvalTime.observe(executor->getTotalTime(STEP_EXECUTE_OP) / 1e6);
+        forwardSyncTime.observe(executor->getTotalTime(STEP_SYNC_NODES) / 1e6);
+        for (NnUint i = 0; i < workerNames.size(); i++) {
+            NnSize sentBytes, recvBytes;
+            network->getSocketStats(i, &sentBytes, &recvBytes);
+            workerSentBytes[i] += sentBytes;
+            workerRecvBytes[i] += recvBytes;
+        }
+    }
+
+    void recordFirstToken(double secondsSinceRequest, NnUint nFedPromptTokens, double prefillSeconds) {
+        std::lock_guard<std::mutex> lock(mutex);
+        timeToFirstToken.observe(secondsSinceRequest);
+        if (prefillSeconds > 0.0)
+            prefillThroughput.observe(nFedPromptTokens / prefillSeconds);
+        nPrefillTokens += nFedPromptTokens;
+        nGeneratedTokens++;
+    }
+
+    void recordNextToken(double seconds) {
+        std::lock_guard<std::mutex> lock(mutex);
+        interTokenLatency.observe(seconds);
+        nGeneratedTokens++;
+    }
+
+    void recordFinish(bool isCancelled) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (isCancelled)
+            nCancelledRequests++;
+        else
+            nCompletedRequests++;
+    }
+
+    void setActiveSequences(NnUint n) {
+        std::lock_guard<std::mutex> lock(mutex);
+        nActiveSequences = n;
+    }
+
+    // Tokens kept in the KV cache of the slot, an idle slot holds the prefix of its last sequence
+    void setSlotTokens(NnUint slot, NnUint nTokens) {
+        std::lock_guard<std::mutex> lock(mutex);
+        slotTokens[slot] = nTokens;
+    }
+
+    std::string render(size_t queueDepth) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::ostringstream out;
+        timeToFirstToken.write(out, "dllama_time_to_first_token_seconds", "Time from receiving a request to its first generated token.");
+        interTokenLatency.write(out, "dllama_inter_token_latency_seconds", "Time between two generated tokens of a sequence.");
+        prefillThroughput.write(out, "dllama_prefill_tokens_per_second", "Prompt tokens fed per second of a request, cached tokens excluded.");
+        forwardEvalTime.write(out, "dllama_forward_eval_seconds", "Time spent by the root node on executing ops in a forward pass.");
+        forwardSyncTime.write(out, "dllama_forward_sync_seconds", "Time spent by the root node on synchronizing with workers in a forward pass.");
+        writeCounter(out, "dllama_prompt_tokens_total", "Prompt tokens fed to the model.", nPrefillTokens);
+        writeCounter(out, "dllama_generated_tokens_total", "Tokens generated by the model.", nGeneratedTokens);
+        out << "# HELP dllama_requests_total Finished completion requests.\n"
+            << "# TYPE dllama_requests_total counter\n"
+            << "dllama_requests_total{result=\"completed\"} " << nCompletedRequests << "\n"
+            << "dllama_requests_total{result=\"cancelled\"} " << nCancelledRequests << "\n";
+        if (!workerNames.empty()) {
+            out << "# HELP dllama_worker_sent_bytes_total Bytes sent by the root node to a worker.\n"
+                << "# TYPE dllama_worker_sent_bytes_total counter\n";
+            for (size_t i = 0; i < workerNames.size(); i++)
+                out << "dllama_worker_sent_bytes_total{worker=\"" << workerNames[i] << "\"} " << workerSentBytes[i] << "\n";
+            out << "# HELP dllama_worker_received_bytes_total Bytes received by the root node from a worker.\n"
+                << "# TYPE dllama_worker_received_bytes_total counter\n";
+            for (size_t i = 0; i < workerNames.size(); i++)
+                out << "dllama_worker_received_bytes_total{worker=\"" << workerNames[i] << "\"} " << workerRecvBytes[i] << "\n";
+        }
+        writeGauge(out, "dllama_queue_depth", "Requests waiting for the inference thread.", queueDepth);
+        writeGauge(out, "dllama_active_sequences", "Sequences in the running batch.", nActiveSequences);
+        writeGauge(out, "dllama_kv_cache_slot_capacity_tokens", "Tokens one slot of the KV cache can hold.", seqLen);
+        out << "# HELP dllama_kv_cache_tokens Tokens held in the KV cache of a slot.\n"
+            << "# TYPE dllama_kv_cache_tokens gauge\n";
+        for (size_t i = 0; i < slotTokens.size(); i++)
+            out << "dllama_kv_cache_tokens{slot=\"" << i << "\"} " << slotTokens[i] << "\n";
+        return out.str();
+    }
+};
+
+// A slot owns one region of the KV cache, an active sequence occupies one slot until it finishes
+class ApiSlot {
+public:
+    NnUint index;
+    bool isBusy;
+    unsigned long long lastUsed;
+    Sampler sampler;
+    EosDetector eosDetector;
+
+    ApiSlot(NnUint index, AppCliArgs *args, Tokenizer *tokenizer, TokenizerChatStops *stops)
+        : sampler(tokenizer->vocabSize, args->temperature, args->topp, args->topk, args->minp, args->seed + index, args->nThreads),
+          eosDetector(stops->nStops, tokenizer->eosTokenIds.data(), stops->stops, stops->maxStopLength, stops->maxStopLength)
+    {
+        this->index = index;
+        this->isBusy = false;
+        this->lastUsed = 0;
+    }
+};
+
+class ApiSequence {
+public:
+    std::unique_ptr<ApiRequest> completion;
+    ApiSlot *slot;
+    std::vector<int> tokens; // The prompt followed by fed generated tokens, indexed by position
+    NnUint nPromptTokens;
+    NnUint nCachedPromptTokens;
+    NnUint nFedPromptTokens;
+    NnUint nKeep; // Tokens that survive context shifts
+    NnUint nDiscarded; // Tokens dropped by context shifts, positions below are logical (pos + nDiscarded)
+    pos_t pos; // Position of the next token fed to the model
+    pos_t promptEndPos;
+    pos_t maxPredPos;
+    int token; // Next token to feed, valid after the prompt is consumed
+    std::vector<int> draftTokens; // Proposed continuation of `token`, verified in the same forward
+    NnUint nDraftTokens;
+    NnUint nProposedTokens;
+    NnUint nAcceptedTokens;
+    std::string buffer;
+    std::string decoderState;
+    bool isFinished;
+    bool hasFailed;
+    NnUint nSampledTokens;
+    std::chrono::steady_clock::time_point startTime;
+    std::chrono::steady_clock::time_point lastTokenTime;
+
+    bool isDecoding() {
+        return nFedPromptTokens == nPromptTokens;
     }
 };
 
 class ApiServer {
 private:
     RootLlmInference *inference;
+    LlmDraftProposer *draft;
     Tokenizer *tokenizer;
-    Sampler *sampler;
     AppCliArgs *args;
     LlmHeader *header;
-    EosDetector *eosDetector;
     ChatTemplateGenerator *templateGenerator;
-    NaiveCache naiveCache;
+    ApiMetrics *metrics;
+    ApiRequestQueue queue;
+    std::vector<std::unique_ptr<ApiSlot>> slots;
+    PrefixTree prefixTree;
+    std::vector<IncrementalEncoder> promptEncoders;
+    std::vector<unsigned long long> promptEncoderUses;
+    std::vector<std::unique_ptr<ApiSequence>> sequences;
+    unsigned long long nSequences;
 
 public:
-    ApiServer(RootLlmInference *inference, Tokenizer *tokenizer, Sampler *sampler, AppCliArgs *args, LlmHeader *header, EosDetector *eosDetector, ChatTemplateGenerator *templateGenerator) {
+    ApiServer(RootLlmInference *inference, LlmDraftProposer *draft, Tokenizer *tokenizer, AppCliArgs *args, LlmHeader *header, TokenizerChatStops *stops, ChatTemplateGenerator *templateGenerator, ApiMetrics *metrics)
+        : prefixTree(args->nSlots)
+    {
         this->inference = inference;
+        this->draft = draft;
         this->tokenizer = tokenizer;
-        this->sampler = sampler;
         this->args = args;
         this->header = header;
-        this->eosDetector = eosDetector;
         this->templateGenerator = templateGenerator;
+        this->metrics = metrics;
+        this->nSequences = 0;
+        if (args->nSlots > args->nBatches)
+            throw std::runtime_error("The number of slots cannot exceed the number of batches");
+        for (NnUint i = 0; i < args->nSlots; i++) {
+            slots.push_back(std::unique_ptr<ApiSlot>(new ApiSlot(i, args, tokenizer, stops)));
+            promptEncoders.push_back(IncrementalEncoder(tokenizer));
+            promptEncoderUses.push_back(0);
+        }
     }
 
-    void complete(HttpRequest& request) {
-        InferenceParams params = parseRequest(request);
+    void enqueue(HttpRequest& request) {
+        std::unique_ptr<ApiRequest> completion(new ApiRequest{REQUEST_COMPLETION, request, parseRequest(request), std::chrono::steady_clock::now()});
+        queue.push(std::move(completion));
+    }
 
-        pos_t startPos = 0;
-        std::vector<ChatMessage> deltaPrompt = params.messages;
-        naiveCache.resolveDeltaPrompt(deltaPrompt, startPos);
+    // Slot commands run on the inference thread between two forward passes
+    void enqueueSlotCommand(HttpRequest& request, ApiRequestType type) {
+        std::unique_ptr<ApiRequest> command(new ApiRequest{type, request, InferenceParams(), std::chrono::steady_clock::now()});
+        queue.push(std::move(command));
+    }
 
-        size_t nInputItems = deltaPrompt.size();
-        std::unique_ptr<ChatItem[]> inputItemsPtr(new ChatItem[nInputItems]);
-        ChatItem *inputItems = inputItemsPtr.get();
-        for (size_t i = 0; i < nInputItems; i++) {
-            inputItems[i].role = deltaPrompt[i].role;
-            inputItems[i].message = deltaPrompt[i].content;
+    // Runs on an I/O thread
+    void writeMetrics(HttpRequest& request) {
+        request.writeText(metrics->render(queue.size()), "text/plain; version=0.0.4; charset=utf-8");
+    }
+
+    // Runs on the inference thread. Sequences join and leave the batch at token boundaries.
+    void run() {
+        while (true) {
+            admit();
+            step();
         }
+    }
 
-        GeneratedChat inputPrompt = templateGenerator->generate(nInputItems, inputItems, true);
-        printf("🔹%s🔸", inputPrompt.content);
+private:
+    void admit() {
+        while (sequences.size() < slots.size()) {
+            std::unique_ptr<ApiRequest> completion = queue.pop(sequences.empty());
+            if (!completion)
+                return;
+            if (completion->type != REQUEST_COMPLETION) {
+                runSlotCommand(completion.get());
+                continue;
+            }
+            if (completion->request.isClosed()) {
+                printf("🔶 Skipped a queued request, client disconnected\n");
+                continue;
+            }
+            std::unique_ptr<ApiSequence> sequence = start(std::move(completion));
+            if (sequence->isFinished)
+                finish(sequence.get());
+            else
+                sequences.push_back(std::move(sequence));
+        }
+    }
+
+    // Picks the free slot holding the longest prefix of the prompt, the least recently used one on a tie
+    ApiSlot *acquireSlot(const std::vector<int> &tokens, NnUint &prefixLength) {
+        std::vector<NnUint> candidates;
+        prefixLength = prefixTree.match(tokens.data(), tokens.size(),
+            [this](NnUint slot) { return !slots[slot]->isBusy; }, candidates);
+        if (prefixLength == 0) {
+            for (auto &slot : slots) {
+                if (!slot->isBusy)
+                    candidates.push_back(slot->index);
+            }
+        }
+        ApiSlot *best = nullptr;
+        for (NnUint index : candidates) {
+            ApiSlot *slot = slots[index].get();
+            if (best == nullptr || slot->lastUsed < best->lastUsed)
+                best = slot;
+        }
+        assert(best != nullptr);
+        best->isBusy = true;
+        prefixTree.remove(best->index);
+        return best;
+    }
+
+    // A conversation sends its whole history again, the encoder holding the longest common text
+    // encodes only the new tail. The least recently used encoder is taken on a tie
+    void encodePrompt(const char *prompt, std::vector<int> &tokens) {
+        size_t best = 0;
+        size_t bestMatch = 0;
+        for (size_t i = 0; i < promptEncoders.size(); i++) {
+            size_t match = promptEncoders[i].match(prompt);
+            if (i == 0 || match > bestMatch || (match == bestMatch && promptEncoderUses[i] < promptEncoderUses[best])) {
+                best = i;
+                bestMatch = match;
+            }
+        }
+        promptEncoders[best].encode(prompt);
+        promptEncoderUses[best] = ++nSequences;
+        tokens = promptEncoders[best].getTokens();
+    }
+
+    void runSlotCommand(ApiRequest *command) {
+        HttpRequest &request = command->request;
+        const char *status = "200 OK";
+        json response;
+        try {
+            if (command->type == REQUEST_SAVE_SLOT)
+                response = saveSlot(request.parsedJson);
+            else
+                response = restoreSlot(request.parsedJson);
+        } catch (const std::invalid_argument &e) {
+            status = "400 Bad Request";
+            response["error"]["message"] = e.what();
+        } catch (const json::exception &e) {
+            status = "400 Bad Request";
+            response["error"]["message"] = e.what();
+        } catch (const NnTransferSocketException &e) {
+            throw;
+        } catch (const NnExecutorException &e) {
+            throw;
+        } catch (const std::runtime_error &e) {
+            printf("🚨 Slot command error: %s\n", e.what());
+            status = "500 Internal Server Error";
+            response["error"]["message"] = e.what();
+        }
+        fflush(stdout);
+        try {
+            request.writeJson(response.dump(), status);
+        } catch (const NnTransferSocketException &e) {
+            // The client has disconnected, the command itself has completed
+        }
+    }
 
-        int nPromptTokens;
-        std::unique_ptr<int[]> promptTokensPtr(new int[inputPrompt.length + 2]);
-        int *promptTokens = promptTokensPtr.get();
-        bool isStart = startPos == 0;
-        tokenizer->encode((char*)inputPrompt.content, promptTokens, &nPromptTokens, isStart, true);
+    json saveSlot(json &body) {
+        std::string name = getSnapshotName(body);
+        NnUint index = body.contains("slot_id") ? body["slot_id"].get<NnUint>() : 0;
+        if (index >= slots.size())
+            throw std::invalid_argument("Invalid slot_id");
+        if (slots[index]->isBusy)
+            throw std::invalid_argument("The slot is busy");
+
+        std::string path = std::string(args->kvCacheDir) + "/" + name;
+        std::vector<int> tokens = prefixTree.getTokens(index);
+        inference->saveKvCache(index, tokens.size(), path.c_str());
+        writeSnapshotTokens(path, tokens);
+        printf("💾 Slot %u: saved %zu tokens to %s\n", index, tokens.size(), name.c_str());
+
+        json response;
+        response["slot_id"] = index;
+        response["filename"] = name;
+        response["n_saved"] = tokens.size();
+        return response;
+    }
 
-        pos_t promptEndPos = startPos + nPromptTokens - 1;
-        if (promptEndPos > header->seqLen)
-            promptEndPos = header->seqLen;
+    json restoreSlot(json &body) {
+        std::string name = getSnapshotName(body);
+        std::string path = std::string(args->kvCacheDir) + "/" + name;
+        std::vector<int> tokens = readSnapshotTokens(path);
+
+        NnUint prefixLength;
+        ApiSlot *slot = acquireSlot(std::vector<int>(), prefixLength);
+        // The slot is free again once the command ends, on a failure it simply holds no tokens
+        slot->isBusy = false;
+        slot->lastUsed = ++nSequences;
+        if (draft != nullptr)
+            draft->rewind(slot->index, 0);
+        NnUint nTokens = inference->loadKvCache(slot->index, path.c_str());
+        if (nTokens != tokens.size())
+            throw std::runtime_error("The KV cache and the token file do not match");
+        prefixTree.insert(slot->index, tokens.data(), nTokens);
+        metrics->setSlotTokens(slot->index, nTokens);
+        printf("💾 Slot %u: restored %u tokens from %s\n", slot->index, nTokens, name.c_str());
+
+        json response;
+        response["slot_id"] = slot->index;
+        response["filename"] = name;
+        response["n_restored"] = nTokens;
+        return response;
+    }
 
-        pos_t maxPredPos = params.max_tokens > 0 ? (promptEndPos + params.max_tokens) : header->seqLen;
-        if (maxPredPos > header->seqLen)
-            maxPredPos = header->seqLen;
+    static std::string getSnapshotName(json &body) {
+        std::string name = body.contains("filename") ? body["filename"].get<std::string>() : "";
+        if (!isValidSnapshotName(name))
+            throw std::invalid_argument("Invalid filename, allowed characters: a-z, A-Z, 0-9, - and _");
+        return name;
+    }
 
-        for (size_t j = 0; j < deltaPrompt.size(); j++) {
-            naiveCache.push(NaiveCacheItem(promptEndPos, deltaPrompt[j]));
+    static bool isValidSnapshotName(const std::string &name) {
+        if (name.empty() || name.size() > 64)
+            return false;
+        for (char c : name) {
+            if (!std::isalnum((unsigned char)c) && c != '-' && c != '_')
+                return false;
         }
+        return true;
+    }
 
-        std::string buffer;
+    static void writeSnapshotTokens(const std::string &path, const std::vector<int> &tokens) {
+        std::string tokensPath = path + ".tokens";
+        FILE *fd = fopen(tokensPath.c_str(), "wb");
+        if (fd == nullptr)
+            throw std::runtime_error("Cannot open file: " + tokensPath);
+        NnUint nTokens = tokens.size();
+        bool isOk = fwrite(&nTokens, sizeof(nTokens), 1, fd) == 1 &&
+            fwrite(tokens.data(), sizeof(int), nTokens, fd) == nTokens;
+        if (fclose(fd) != 0 || !isOk)
+            throw std::runtime_error("Cannot write file: " + tokensPath);
+    }
 
-        if (params.stream)
-            request.writeStreamStartChunk();
-        if (inputPrompt.publicPrompt != nullptr) {
-            if (params.stream)
-                writeChatCompletionChunk(request, inputPrompt.publicPrompt, false);
-            buffer += inputPrompt.publicPrompt;
+    std::vector<int> readSnapshotTokens(const std::string &path) {
+        std::string tokensPath = path + ".tokens";
+        FILE *fd = fopen(tokensPath.c_str(), "rb");
+        if (fd == nullptr)
+            throw std::runtime_error("Cannot open file: " + tokensPath);
+        NnUint nTokens;
+        std::vector<int> tokens;
+        bool isOk = fread(&nTokens, sizeof(nTokens), 1, fd) == 1 && nTokens <= header->seqLen;
+        if (isOk) {
+            tokens.resize(nTokens);
+            isOk = fread(tokens.data(), sizeof(int), nTokens, fd) == nTokens;
         }
+        fclose(fd);
+        if (!isOk)
+            throw std::runtime_error("Invalid token file: " + tokensPath);
+        return tokens;
+    }
 
-        NnUint pos = startPos;
-        int token;
-        for (NnUint i = 0; ;) {
-            long remainingTokens = promptEndPos - pos;
-            if (remainingTokens <= 0)
-                break;
+    std::unique_ptr<ApiSequence> start(std::unique_ptr<ApiRequest> completion) {
+        InferenceParams &params = completion->params;
+        std::unique_ptr<ApiSequence> sequence(new ApiSequence());
 
-            NnUint batchSize = remainingTokens < args->nBatches
-                ? remainingTokens
-                : args->nBatches;
+        std::vector<ChatItem> inputItems(params.messages.size());
+        for (size_t i = 0; i < inputItems.size(); i++) {
+            inputItems[i].role = params.messages[i].role;
+            inputItems[i].message = params.messages[i].content;
+        }
 
-            inference->setBatchSize(batchSize);
-            inference->setPosition(pos);
-            for (NnUint j = 0; j < batchSize; j++)
-                inference->setToken(j, promptTokens[i + j]);
+        GeneratedChat inputPrompt = templateGenerator->generate(inputItems.size(), inputItems.data(), true);
+
+        encodePrompt(inputPrompt.content, sequence->tokens);
+        int nPromptTokens = sequence->tokens.size();
+
+        NnUint nKeep = getKeptLength(inputItems.data(), inputItems.size());
+        // A prompt that does not fit loses its oldest messages until it takes at most the kept prefix
+        // and half of the rest of the context, the system prompt and the last message always stay
+        if (nPromptTokens >= (int)header->seqLen) {
+            NnUint nMaxPromptTokens = nKeep + (header->seqLen - nKeep) / 2;
+            size_t firstItem = !inputItems.empty() && inputItems[0].role == "system" ? 1 : 0;
+            size_t nDroppedItems = 0;
+            while (sequence->tokens.size() > nMaxPromptTokens && inputItems.size() > firstItem + 1) {
+                inputItems.erase(inputItems.begin() + firstItem);
+                nDroppedItems++;
+                inputPrompt = templateGenerator->generate(inputItems.size(), inputItems.data(), true);
+                encodePrompt(inputPrompt.content, sequence->tokens);
+            }
+            // Only the last message alone is too long, its oldest tokens are cut
+            if (sequence->tokens.size() > nMaxPromptTokens) {
+                NnUint nDiscard = sequence->tokens.size() - nMaxPromptTokens;
+                sequence->tokens.erase(sequence->tokens.begin() + nKeep, sequence->tokens.begin() + nKeep + nDiscard);
+            }
+            printf("✂️ Prompt truncated: %d -> %zu tokens, %zu messages dropped\n",
+                nPromptTokens, sequence->tokens.size(), nDroppedItems);
+            nPromptTokens = sequence->tokens.size();
+        }
 
-            inference->forward();
+        NnUint prefixLength;
+        ApiSlot *slot = acquireSlot(sequence->tokens, prefixLength);
+        // The last prompt token is always fed, its logits give the first generated token
+        if (nPromptTokens > 0 && prefixLength >= (NnUint)nPromptTokens)
+            prefixLength = nPromptTokens - 1;
+        if (prefixLength > 0)
+            printf("🐤 Found prefix cache for %u tokens in slot %u\n", prefixLength, slot->index);
+
+        sequence->completion = std::move(completion);
+        sequence->slot = slot;
+        sequence->nPromptTokens = nPromptTokens;
+        sequence->nCachedPromptTokens = prefixLength;
+        sequence->nFedPromptTokens = prefixLength;
+        sequence->nKeep = nKeep;
+        sequence->nDiscarded = 0;
+        sequence->nDraftTokens = 0;
+        sequence->nProposedTokens = 0;
+        sequence->nAcceptedTokens = 0;
+        if (draft != nullptr) {
+            sequence->draftTokens.resize(args->nDraftTokens);
+            draft->rewind(slot->index, prefixLength);
+        }
+        sequence->pos = prefixLength;
+        sequence->promptEndPos = nPromptTokens - 1;
+        // An explicit limit may go past the end of the context, the context is shifted then
+        sequence->maxPredPos = params.max_tokens > 0 ? (sequence->promptEndPos + params.max_tokens) : header->seqLen;
+        sequence->isFinished = nPromptTokens == 0;
+        sequence->hasFailed = false;
+        sequence->nSampledTokens = 0;
+        sequence->startTime = std::chrono::steady_clock::now();
+
+        slot->sampler.setTemp(params.temperature);
+        slot->sampler.setTopp(params.top_p);
+        slot->sampler.setTopk(params.top_k);
+        slot->sampler.setMinp(params.min_p);
+        if (sequence->completion->request.parsedJson.contains("seed"))
+            slot->sampler.setSeed(params.seed);
+        slot->eosDetector.reset();
+
+        printf("🔹 Slot %u: %d prompt tokens, pos=%u\n", slot->index, nPromptTokens, sequence->pos);
+        fflush(stdout);
 
-            i += batchSize;
-            pos += batchSize;
-            token = promptTokens[i + 1];
+        HttpRequest &request = sequence->completion->request;
+        try {
+            if (params.stream)
+                request.writeStreamStartChunk();
+            if (inputPrompt.publicPrompt != nullptr) {
+                if (params.stream)
+                    writeChatCompletionChunk(request, inputPrompt.publicPrompt, false);
+                sequence->buffer += inputPrompt.publicPrompt;
+            }
+        } catch (const NnTransferSocketException &e) {
+            sequence->isFinished = true;
+            sequence->hasFailed = true;
         }
+        return sequence;
+    }
 
-        inference->setBatchSize(1);
-        tokenizer->resetDecoder();
-        eosDetector->reset();
+    // By default the system prompt is kept, the first token at least
+    NnUint getKeptLength(ChatItem *items, size_t nItems) {
+        NnUint nKeep = args->ctxKeep;
+        if (nKeep == 0) {
+            nKeep = 1;
+            if (nItems > 0 && items[0].role == "system") {
+                GeneratedChat systemPrompt = templateGenerator->generate(1, items, false);
+                std::vector<int> systemTokens(systemPrompt.length + 2);
+                int nSystemTokens;
+                tokenizer->encode((char*)systemPrompt.content, systemTokens.data(), &nSystemTokens, true, true);
+                nKeep = std::max(nKeep, (NnUint)nSystemTokens);
+            }
+        }
+        return std::min(nKeep, header->seqLen / 2);
+    }
 
-        for (; pos < maxPredPos;) {
-            inference->setPosition(pos);
-            inference->setToken(0, token);
-            inference->forward();
+    // Drops the older half of the tokens after the kept prefix, the rest of the cache is moved back
+    void shiftContext(ApiSequence *sequence) {
+        assert(sequence->pos > sequence->nKeep);
+        NnUint nDiscard = (sequence->pos - sequence->nKeep) / 2;
+        inference->shiftKvCache(sequence->slot->index, sequence->nKeep, nDiscard, sequence->pos);
+        sequence->tokens.erase(
+            sequence->tokens.begin() + sequence->nKeep,
+            sequence->tokens.begin() + sequence->nKeep + nDiscard);
+        sequence->pos -= nDiscard;
+        sequence->nDiscarded += nDiscard;
+        if (draft != nullptr)
+            draft->rewind(sequence->slot->index, sequence->nKeep);
+        printf("✂️ Slot %u: context shifted by %u tokens\n", sequence->slot->index, nDiscard);
+        fflush(stdout);
+    }
 
-            token = sampler->sample(inference->logitsPipe);
+    void step() {
+        cancelDisconnected();
+
+        std::vector<ApiSequence *> rowSequences;
+        std::vector<NnUint> rowTokens;
+        std::vector<pos_t> rowPositions;
+        std::vector<ApiSequence *> sampleSequences;
+        std::vector<NnUint> sampleRows;
+
+        // Decoding sequences go first, each of them takes one row and its draft tokens
+        std::vector<ApiSequence *> decodingSequences;
+        for (auto &sequence : sequences) {
+            if (!sequence->isDecoding())
+                continue;
+            if (sequence->pos == header->seqLen)
+                shiftContext(sequence.get());
+            sequence->tokens.push_back(sequence->token);
+            sequence->nDraftTokens = 0;
+            decodingSequences.push_back(sequence.get());
+        }
+        if (draft != nullptr && !decodingSequences.empty())
+            proposeDraftTokens(decodingSequences);
+        for (ApiSequence *sequence : decodingSequences) {
+            sampleSequences.push_back(sequence);
+            sampleRows.push_back(rowTokens.size());
+            rowSequences.push_back(sequence);
+            rowTokens.push_back(sequence->token);
+            rowPositions.push_back(sequence->pos);
+            for (NnUint i = 0; i < sequence->nDraftTokens; i++) {
+                rowSequences.push_back(sequence);
+                rowTokens.push_back(sequence->draftTokens[i]);
+                rowPositions.push_back(sequence->pos + 1 + i);
+            }
+            sequence->pos++;
+        }
+        // Prompts fill the remaining rows
+        for (auto &sequence : sequences) {
+            if (sequence->isDecoding())
+                continue;
+            while (rowTokens.size() < args->nBatches && !sequence->isDecoding()) {
+                rowSequences.push_back(sequence.get());
+                rowTokens.push_back(sequence->tokens[sequence->nFedPromptTokens]);
+                rowPositions.push_back(sequence->pos);
+                sequence->nFedPromptTokens++;
+                sequence->pos++;
+            }
+            if (sequence->isDecoding()) {
+                sampleSequences.push_back(sequence.get());
+                sampleRows.push_back(rowTokens.size() - 1);
+            }
+        }
 
-            char *piece = tokenizer->decode(token);
-            EosDetectorType eosType = eosDetector->append(token, piece);
+        NnUint batchSize = rowTokens.size();
+        if (batchSize == 0)
+            return;
+        inference->setBatchSize(batchSize);
+        for (NnUint i = 0; i < batchSize; i++) {
+            inference->setRowPosition(i, rowPositions[i], rowSequences[i]->slot->index);
+            inference->setToken(i, rowTokens[i]);
+        }
+        inference->forward();
+        metrics->recordForward();
+
+        for (NnUint i = 0; i < sampleSequences.size(); i++)
+            verify(sampleSequences[i], sampleRows[i]);
+
+        for (auto it = sequences.begin(); it != sequences.end();) {
+            if ((*it)->isFinished) {
+                finish(it->get());
+                it = sequences.erase(it);
+            } else {
+                it++;
+            }
+        }
+        for (auto &sequence : sequences)
+            metrics->setSlotTokens(sequence->slot->index, sequence->pos);
+        metrics->setActiveSequences(sequences.size());
+    }
 
-            if (piece != nullptr) {
-                printf("%s", piece);
-                fflush(stdout);
+    // A sequence whose client has gone leaves the batch before the next forward pass. The slot keeps
+    // the KV cache up to the last fed position, so a retried request reuses the computed prefix
+    void cancelDisconnected() {
+        for (auto it = sequences.begin(); it != sequences.end();) {
+            ApiSequence *sequence = it->get();
+            if (sequence->completion->request.isClosed()) {
+                sequence->hasFailed = true;
+                finish(sequence);
+                it = sequences.erase(it);
+            } else {
+                it++;
             }
+        }
+    }
 
+    // Rows left after one row per decoding sequence are shared by the drafts, but half of them
+    // (at least one) stays reserved while a prompt is still prefilling
+    void proposeDraftTokens(std::vector<ApiSequence *> &decodingSequences) {
+        NnUint nSpareRows = args->nBatches - decodingSequences.size();
+        if (decodingSequences.size() < sequences.size() && nSpareRows > 0)
+            nSpareRows -= std::max(1u, nSpareRows / 2);
+        std::vector<LlmDraftRequest> requests;
+        std::vector<ApiSequence *> requestSequences;
+        for (ApiSequence *sequence : decodingSequences) {
+            // The last verified row must stay inside the context and the token limit
+            NnUint maxDraftTokens = std::min(args->nDraftTokens, nSpareRows);
+            maxDraftTokens = std::min(maxDraftTokens, header->seqLen - 1 - sequence->pos);
+            pos_t logicalPos = sequence->pos + sequence->nDiscarded;
+            maxDraftTokens = logicalPos + 1 < sequence->maxPredPos
+                ? std::min(maxDraftTokens, sequence->maxPredPos - logicalPos - 1)
+                : 0;
+            if (maxDraftTokens == 0)
+                continue;
+            nSpareRows -= maxDraftTokens;
+            requests.push_back(LlmDraftRequest{sequence->slot->index, sequence->tokens.data(), sequence->pos,
+                maxDraftTokens, 0, sequence->draftTokens.data()});
+            requestSequences.push_back(sequence);
+        }
+        if (requests.empty())
+            return;
+        draft->propose(requests.size(), requests.data());
+        for (NnUint i = 0; i < requests.size(); i++) {
+            requestSequences[i]->nDraftTokens = requests[i].nDraftTokens;
+            requestSequences[i]->nProposedTokens += requests[i].nDraftTokens;
+        }
+    }
+
+    // Samples the row of the fed token, every draft token equal to the sampled one is accepted
+    // and the row after it is sampled too. Accepted tokens keep the distribution of the main model.
+    void verify(ApiSequence *sequence, NnUint row) {
+        for (NnUint i = 0; ; i++) {
+            sample(sequence, &inference->logitsPipe[(row + i) * header->vocabSize]);
+            if (sequence->isFinished || i == sequence->nDraftTokens || sequence->token != sequence->draftTokens[i])
+                break;
+            sequence->tokens.push_back(sequence->token);
+            sequence->pos++;
+            sequence->nAcceptedTokens++;
+        }
+        sequence->nDraftTokens = 0;
+        if (draft != nullptr)
+            draft->rewind(sequence->slot->index, sequence->pos);
+    }
+
+    void sample(ApiSequence *sequence, float *logits) {
+        ApiSlot *slot = sequence->slot;
+        InferenceParams &params = sequence->completion->params;
+        int token = slot->sampler.sample(logits);
+
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (sequence->nSampledTokens == 0) {
+            metrics->recordFirstToken(secondsBetween(sequence->completion->receivedTime, now),
+                sequence->nPromptTokens - sequence->nCachedPromptTokens, secondsBetween(sequence->startTime, now));
+        } else {
+            metrics->recordNextToken(secondsBetween(sequence->lastTokenTime, now));
+        }
+        sequence->nSampledTokens++;
+        sequence->lastTokenTime = now;
+
+        tokenizer->setDecoderState(sequence->decoderState);
+        char *piece = tokenizer->decode(token);
+        sequence->decoderState = tokenizer->getDecoderState();
+        EosDetectorType eosType = slot->eosDetector.append(token, piece);
+
+        try {
             if (eosType == NOT_EOS || eosType == EOS) {
-                char *delta = eosDetector->getDelta();
+                char *delta = slot->eosDetector.getDelta();
                 if (delta != nullptr) {
                     std::string deltaStr(delta);
                     if (params.stream)
-                        writeChatCompletionChunk(request, deltaStr, false);
-                    buffer += deltaStr;
+                        writeChatCompletionChunk(sequence->completion->request, deltaStr, false);
+                    sequence->buffer += deltaStr;
                 }
-                eosDetector->reset();
+                slot->eosDetector.reset();
             }
-            pos++;
-            if (eosType == EOS) break;
+        } catch (const NnTransferSocketException &e) {
+            sequence->hasFailed = true;
         }
 
-        ChatMessage chatMessage("assistant", buffer);
-        if (pos == header->seqLen) {
-            naiveCache.clear();
-        } else {
-            naiveCache.push(NaiveCacheItem(pos, chatMessage));
+        sequence->token = token;
+        if (eosType == EOS || sequence->pos + sequence->nDiscarded >= sequence->maxPredPos || sequence->hasFailed)
+            sequence->isFinished = true;
+    }
+
+    void finish(ApiSequence *sequence) {
+        ApiSlot *slot = sequence->slot;
+        InferenceParams &params = sequence->completion->params;
+        HttpRequest &request = sequence->completion->request;
+
+        ChatMessage chatMessage("assistant", sequence->buffer);
+        // Everything fed to the model stays in the slot and can be reused by the next request
+        assert(sequence->tokens.size() >= sequence->pos);
+        prefixTree.insert(slot->index, sequence->tokens.data(), sequence->pos);
+
+        pos_t endPos = sequence->pos + sequence->nDiscarded;
+        int nCompletionTokens = sequence->nPromptTokens > 0 && endPos > sequence->promptEndPos
+            ? endPos - sequence->promptEndPos
+            : 0;
+        if (!sequence->hasFailed) {
+            try {
+                if (params.stream) {
+                    writeChatCompletionChunk(request, "", true);
+                } else {
+                    ChatUsage usage(sequence->nPromptTokens, nCompletionTokens, sequence->nPromptTokens + nCompletionTokens);
+                    Choice choice(chatMessage);
+                    ChatCompletion completion(choice, usage);
+                    std::string chatJson = ((json)completion).dump();
+                    request.writeJson(chatJson);
+                }
+            } catch (const NnTransferSocketException &e) {
+                sequence->hasFailed = true;
+            }
         }
 
-        if (params.stream) {
-            writeChatCompletionChunk(request, "", true);
-        } else {
-            int nCompletionTokens = pos - promptEndPos;
-            ChatUsage usage(nPromptTokens, nCompletionTokens, nPromptTokens + nCompletionTokens);
-            Choice choice(chatMessage);
-            ChatCompletion completion(choice, usage);
-            std::string chatJson = ((json)completion).dump();
-            request.writeJson(chatJson);
-        }
-        printf("🔶\n");
+        printf("🔶 Slot %u: %d generated tokens%s\n", slot->index, nCompletionTokens, sequence->hasFailed ? " (client disconnected)" : "");
+        if (sequence->nProposedTokens > 0)
+            printf("📝 Slot %u: %u/%u draft tokens accepted\n", slot->index, sequence->nAcceptedTokens, sequence->nProposedTokens);
         fflush(stdout);
+
+        metrics->recordFinish(sequence->hasFailed);
+        metrics->setSlotTokens(slot->index, sequence->pos);
+        slot->isBusy = false;
+        slot->lastUsed = ++nSequences;
+    }
+
+    static double secondsBetween(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to) {
+        return std::chrono::duration<double>(to - from).count();
     }
 
-private:
     InferenceParams parseRequest(HttpRequest& request) {
         InferenceParams params;
         params.temperature = args->temperature;
         params.top_p = args->topp;
+        params.top_k = args->topk;
+        params.min_p = args->minp;
         params.seed = args->seed;
         params.stream = false;
         params.messages = parseChatMessages(request.parsedJson["messages"]);
@@ -503,9 +1489,17 @@ private:
         if (request.parsedJson.contains("temperature")) {
             params.temperature = request.parsedJson["temperature"].template get<float>();
         }
+        if (request.parsedJson.contains("top_p")) {
+            params.top_p = request.parsedJson["top_p"].template get<float>();
+        }
+        if (request.parsedJson.contains("top_k")) {
+            params.top_k = request.parsedJson["top_k"].template get<int>();
+        }
+        if (request.parsedJson.contains("min_p")) {
+            params.min_p = request.parsedJson["min_p"].template get<float>();
+        }
         if (request.parsedJson.contains("seed")) {
             params.seed = request.parsedJson["seed"].template get<unsigned long long>();
-            sampler->setSeed(params.seed);
         }
         if (request.parsedJson.contains("max_tokens")) {
             params.max_tokens = request.parsedJson["max_tokens"].template get<int>();
@@ -521,7 +1515,19 @@ private:
 };
 
 void handleCompletionsRequest(HttpRequest& request, ApiServer *api) {
-    api->complete(request);
+    api->enqueue(request);
+}
+
+void handleSaveSlotRequest(HttpRequest& request, ApiServer *api) {
+    api->enqueueSlotCommand(request, REQUEST_SAVE_SLOT);
+}
+
+void handleRestoreSlotRequest(HttpRequest& request, ApiServer *api) {
+    api->enqueueSlotCommand(request, REQUEST_RESTORE_SLOT);
+}
+
+void handleMetricsRequest(HttpRequest& request, ApiServer *api) {
+    api->writeMetrics(request);
 }
 
 void handleModelsRequest(HttpRequest& request, const char* modelPath) {
@@ -535,17 +1541,153 @@ void handleModelsRequest(HttpRequest& request, const char* modelPath) {
     request.writeJson(response);
 }
 
+#define HTTP_IO_THREADS 2
+#define HTTP_POLL_INTERVAL_MS 10
+
+// Accepts clients and reads their requests on a pool of I/O threads, the inference thread only
+// takes parsed requests from the queue. Every I/O thread polls the listening socket and its own
+// connections, the wait is bounded so output left by other threads is picked up quickly. A
+// persistent connection serves its requests one by one and is closed after an idle timeout
+class HttpServer {
+private:
+    int serverSocket;
+    std::vector<Route> *routes;
+    std::atomic<bool> isRunning;
+    std::vector<std::thread> threads;
+
+public:
+    HttpServer(int serverSocket, std::vector<Route> *routes, NnUint nThreads) {
+        this->serverSocket = serverSocket;
+        this->routes = routes;
+        this->isRunning.store(true);
+        setNonBlocking(serverSocket, true);
+        for (NnUint i = 0; i < nThreads; i++)
+            threads.push_back(std::thread(&HttpServer::loop, this));
+    }
+
+    ~HttpServer() {
+        isRunning.store(false);
+        for (std::thread &thread : threads)
+            thread.join();
+    }
+
+private:
+    void loop() {
+        std::vector<std::shared_ptr<HttpConnection>> connections;
+        std::vector<struct pollfd> fds;
+        while (isRunning.load()) {
+            fds.clear();
+            fds.push_back({(SOCKET_FD)serverSocket, POLLIN, 0});
+            for (auto &connection : connections) {
+                short events = connection->isReadClosed ? 0 : POLLIN;
+                if (connection->hasOutput())
+                    events |= POLLOUT;
+                fds.push_back({(SOCKET_FD)connection->getFd(), events, 0});
+            }
+            if (poll(fds.data(), fds.size(), HTTP_POLL_INTERVAL_MS) < 0)
+                continue;
+
+            if (fds[0].revents & POLLIN)
+                accept(connections);
+            for (size_t i = 1; i < fds.size(); i++) {
+                HttpConnection *connection = connections[i - 1].get();
+                if (fds[i].revents & POLLOUT)
+                    connection->flush();
+                if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                    // Hang-up after EOF means the write side is gone too
+                    bool isHangUp = connection->isReadClosed && (fds[i].revents & (POLLHUP | POLLERR));
+                    if (isHangUp || !connection->read())
+                        connection->close();
+                }
+            }
+
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < connections.size();) {
+                std::shared_ptr<HttpConnection> &connection = connections[i];
+                while (!connection->isClosed.load()) {
+                    if (connection->hasRequest) {
+                        if (!connection->isDone())
+                            break;
+                        if (connection->keepAlive)
+                            connection->reset();
+                        else
+                            connection->close();
+                    } else if (connection->hasNewInput) {
+                        dispatch(connection);
+                    } else {
+                        // No request will come after EOF, buffered ones are served already
+                        if (connection->isReadClosed)
+                            connection->close();
+                        break;
+                    }
+                }
+                // The last copy of the request is gone without a complete response, a complete one
+                // stays in the poll set until it is flushed
+                bool isDropped = connection->hasRequest && connection.use_count() == 1 && !connection->hasCompleteResponse();
+                bool isIdle = !connection->hasRequest &&
+                    std::chrono::duration_cast<std::chrono::milliseconds>(now - connection->lastActivity).count() > HTTP_IDLE_TIMEOUT_MS;
+                if (connection->isClosed.load() || isDropped || isIdle) {
+                    connection->close();
+                    connections.erase(connections.begin() + i);
+                } else {
+                    i++;
+                }
+            }
+        }
+    }
+
+    void accept(std::vector<std::shared_ptr<HttpConnection>> &connections) {
+        for (;;) {
+            int clientSocket;
+            try {
+                clientSocket = tryAcceptSocket(serverSocket);
+            } catch (const std::exception& e) {
+                printf("Request error: %s\n", e.what());
+                return;
+            }
+            if (clientSocket < 0)
+                return;
+            connections.push_back(std::make_shared<HttpConnection>(clientSocket));
+        }
+    }
+
+    void dispatch(std::shared_ptr<HttpConnection> &connection) {
+        connection->hasNewInput = false;
+        try {
+            size_t headerSize;
+            std::string body;
+            size_t size = HttpRequest::frame(connection->input, headerSize, body);
+            if (size == 0)
+                return;
+            HttpRequest request = HttpRequest::parse(connection, connection->input.substr(0, headerSize), body);
+            connection->input.erase(0, size);
+            connection->hasRequest = true;
+            connection->keepAlive = request.keepAlive;
+            printf("🔷 %s %s\n", request.getMethod().c_str(), request.path.c_str());
+            Router::resolve(request, *routes);
+        } catch (const NnTransferSocketException& e) {
+            printf("Socket error: %d %s\n", e.code, e.what());
+            connection->close();
+        } catch (const std::exception& e) {
+            printf("Request error: %s\n", e.what());
+            connection->close();
+        }
+    }
+};
+
 static void server(AppInferenceContext *context) {
     NnSocket serverSocket(createServerSocket(context->args->host, context->args->port));
 
     TokenizerChatStops stops(context->tokenizer);
     ChatTemplateGenerator templateGenerator(context->args->chatTemplateType, context->tokenizer->chatTemplate, stops.stops[0]);
-    EosDetector eosDetector(stops.nStops, context->tokenizer->eosTokenIds.data(), stops.stops, stops.maxStopLength, stops.maxStopLength);
-    ApiServer api(context->inference, context->tokenizer, context->sampler, context->args, context->header, &eosDetector, &templateGenerator);
+    ApiMetrics metrics(context);
+    ApiServer api(context->inference, context->draft, context->tokenizer, context->args, context->header, &stops, &templateGenerator, &metrics);
 
     if (strcmp(context->args->host, "0.0.0.0") == 0 ||
         strcmp(context->args->host, "127.0.0.1") == 0)
         printf("Server URL: http://localhost:%d/v1/\n", context->args->port);
+    if (context->args->nSlots > 1)
+        printf("🎰 Slots: %u\n", context->args->nSlots);
 
     std::vector<Route> routes = {
         {
@@ -557,21 +1699,30 @@ static void server(AppInferenceContext *context) {
             "/v1/models",
             HttpMethod::METHOD_GET,
             std::bind(&handleModelsRequest, std::placeholders::_1, context->args->modelPath)
+        },
+        {
+            "/metrics",
+            HttpMethod::METHOD_GET,
+            std::bind(&handleMetricsRequest, std::placeholders::_1, &api)
         }
     };
-
-    while (true) {
-        try {
-            NnSocket clientSocket(acceptSocket(serverSocket.fd));
-            HttpRequest request = HttpRequest::read(clientSocket.fd);
-            printf("🔷 %s %s\n", request.getMethod().c_str(), request.path.c_str());
-            Router::resolve(request, routes);
-        } catch (const NnTransferSocketException& e) {
-            printf("Socket error: %d %s\n", e.code, e.what());
-        } catch (const NnExecutorException &e) {
-            throw;
-        }
+    if (context->args->kvCacheDir != nullptr) {
+        routes.push_back({
+            "/v1/slots/save",
+            HttpMethod::METHOD_POST,
+            std::bind(&handleSaveSlotRequest, std::placeholders::_1, &api)
+        });
+        routes.push_back({
+            "/v1/slots/restore",
+            HttpMethod::METHOD_POST,
+            std::bind(&handleRestoreSlotRequest, std::placeholders::_1, &api)
+        });
+        printf("💾 KV cache directory: %s\n", context->args->kvCacheDir);
     }
+
+    // Requests are accepted and parsed on the I/O threads, so new clients can join the running batch
+    HttpServer httpServer(serverSocket.fd, &routes, HTTP_IO_THREADS);
+    api.run();
 }
 
 #ifdef _WIN32
@@ -586,9 +1737,17 @@ void usage() {
     fprintf(stderr, "        [--weights-float-type {f32|f16|q40|q80}]\n");
     fprintf(stderr, "        [--max-seq-len <max>]\n");
     fprintf(stderr, "        [--nthreads <n>]\n");
+    fprintf(stderr, "        [--n-slots <n>]\n");
+    fprintf(stderr, "        [--ctx-keep <n>]\n");
+    fprintf(stderr, "        [--kv-cache-dir <dir>]\n");
+    fprintf(stderr, "        [--logits-topk <k>]\n");
+    fprintf(stderr, "        [--draft-model <path> | --lookup-ngram <n>] [--draft-tokens <n>]\n");
+    fprintf(stderr, "        [--trace <path>] [--trace-forwards <n>]\n");
     fprintf(stderr, "        [--workers <ip:port> ...]\n");
     fprintf(stderr, "        [--temperature <temp>]\n");
     fprintf(stderr, "        [--topp <t>]\n");
+    fprintf(stderr, "        [--topk <k>]\n");
+    fprintf(stderr, "        [--minp <p>]\n");
     fprintf(stderr, "        [--seed <s>]\n");
     fprintf(stderr, "Example:\n");
     fprintf(stderr, "  sudo nice -n -20 ./dllama-api --port 9990 --nthreads 4 \\\n");
@@ -609,6 +1768,8 @@ int main(int argc, char *argv[]) {
         usage();
         return EXIT_SUCCESS;
     }
+    // The executor measures the step times reported by /metrics
+    args.benchmark = true;
 
     initQuants();
     initSockets();
@@ -618,6 +1779,8 @@ int main(int argc, char *argv[]) {
             runInferenceApp(&args, server);
         } catch (const NnConnectionSocketException &e) {
             printf("🚨 Connection error: %s\n", e.what());
+        } catch (const NnTransferSocketException &e) {
+            printf("🚨 Network error: %s\n", e.what());
         } catch (const NnExecutorException &e) {
             printf("🚨 Inference error: %s\n", e.what());
         }
@@ -7,8 +7,10 @@
 #include "llm.hpp"
 #include "tokenizer.hpp"
 #include "app.hpp"
+#include <algorithm>
 #include <stdexcept>
 #include <cmath>
+#include <string>
 
 static void inference(AppInferenceContext *context) {
     if (context->args->prompt == nullptr)
@@ -51,7 +53,7 @@ static void inference(AppInferenceContext *context) {
         context->inference->forward();
 
         pos += batchSize;
-        token = inputTokens[pos + 1];
+        token = inputTokens[pos];
 
         if (context->network != nullptr)
             context->network->getStats(&sentBytes, &recvBytes);
@@ -73,6 +75,64 @@ static void inference(AppInferenceContext *context) {
     context->tokenizer->resetDecoder();
 
     const NnUint maxPos = std::min(context->header->seqLen, context->args->steps);
+    if (context->draft != nullptr) {
+        std::vector<int> tokens(inputTokens, inputTokens + pos);
+        std::vector<int> draftTokens(context->args->nDraftTokens);
+        NnUint nProposedTokens = 0;
+        NnUint nAcceptedTokens = 0;
+        while (pos < maxPos) {
+            tokens.resize(pos);
+            tokens.push_back(token);
+            LlmDraftRequest request{0, tokens.data(), pos,
+                std::min(context->args->nDraftTokens, maxPos - 1 - pos), 0, draftTokens.data()};
+            Timer draftTimer;
+            if (request.maxDraftTokens > 0)
+                context->draft->propose(1, &request);
+            NnUint draftTime = draftTimer.elapsedMicroseconds();
+
+            NnUint batchSize = 1 + request.nDraftTokens;
+            context->inference->setBatchSize(batchSize);
+            context->inference->setPosition(pos);
+            context->inference->setToken(0, token);
+            for (NnUint i = 0; i < request.nDraftTokens; i++)
+                context->inference->setToken(i + 1, draftTokens[i]);
+            context->inference->forward();
+
+            std::string pieces;
+            NnUint nTokens = 0;
+            for (;;) {
+                token = context->sampler->sample(&context->inference->logitsPipe[nTokens * context->header->vocabSize]);
+                char *piece = context->tokenizer->decode(token);
+                pieces += piece == nullptr ? "~" : piece;
+                pos++;
+                if (nTokens == request.nDraftTokens || token != draftTokens[nTokens])
+                    break;
+                tokens.push_back(token);
+                nTokens++;
+            }
+            nProposedTokens += request.nDraftTokens;
+            nAcceptedTokens += nTokens;
+            context->draft->rewind(0, pos);
+
+            if (context->network != nullptr)
+                context->network->getStats(&sentBytes, &recvBytes);
+
+            NnUint predTime = context->executor->getTotalTime(STEP_EXECUTE_OP);
+            NnUint syncTime = context->executor->getTotalTime(STEP_SYNC_NODES);
+            printf("🔶 Draft%5u ms Pred%5u ms Sync%5u ms | Sent%6zu kB Recv%6zu kB | %s (%u/%u draft tokens)\n",
+                draftTime / 1000,
+                predTime / 1000,
+                syncTime / 1000,
+                sentBytes / 1024,
+                recvBytes / 1024,
+                pieces.c_str(),
+                nTokens,
+                request.nDraftTokens);
+            fflush(stdout);
+            predTotalTime += draftTime + predTime + syncTime;
+        }
+        printf("📝 %u/%u draft tokens accepted\n", nAcceptedTokens, nProposedTokens);
+    }
     for (; pos < maxPos; pos++) {
         context->inference->setPosition(pos);
         context->inference->setToken(0, token);
@@ -132,6 +192,8 @@ static NnUint readStdin(const char *guide, char *buffer, NnUint size) {
 static void perplexity(AppInferenceContext *context) {
     if (context->args->prompt == nullptr)
         throw std::runtime_error("Prompt is required");
+    if (context->args->logitsTopk > 0)
+        throw std::runtime_error("Perplexity requires full logits, --logits-topk is not supported");
 
     std::vector<int> inputTokensVec(std::strlen(context->args->prompt) + 3);
     int *inputTokens = inputTokensVec.data();
@@ -171,6 +233,17 @@ static void perplexity(AppInferenceContext *context) {
     printf("   bitPerToken: %f\n", -avgLogProb / std::log(2.0));
 }
 
+// Discards the oldest tokens after the kept prefix, the remaining cache is moved back in place
+static NnUint shiftContext(AppInferenceContext *context, NnUint pos, NnUint nKeep, NnUint nRequired) {
+    if (pos <= nKeep)
+        return pos;
+    NnUint nDiscard = std::max((pos - nKeep) / 2, nRequired);
+    if (nDiscard > pos - nKeep)
+        nDiscard = pos - nKeep;
+    context->inference->shiftKvCache(0, nKeep, nDiscard, pos);
+    return pos - nDiscard;
+}
+
 static void chat(AppInferenceContext *context) {
     const NnUint seqLen = context->header->seqLen;
     char prompt[2048];
@@ -184,11 +257,24 @@ static void chat(AppInferenceContext *context) {
     if (sysPromptLength > 0)
         deltaItems.push_back(ChatItem{"system", prompt});
 
+    // The system prompt survives context shifts unless the kept prefix is set explicitly
+    NnUint nKeep = context->args->ctxKeep;
+    if (nKeep == 0) {
+        nKeep = 1;
+        if (sysPromptLength > 0) {
+            GeneratedChat sysPrompt = templateGenerator.generate(1, deltaItems.data(), false);
+            std::unique_ptr<int[]> sysTokensPtr(new int[sysPrompt.length + 2]);
+            int nSysTokens;
+            context->tokenizer->encode((char*)sysPrompt.content, sysTokensPtr.get(), &nSysTokens, true, true);
+            nKeep = std::max(nKeep, (NnUint)nSysTokens);
+        }
+    }
+
     NnUint pos = 0;
     NnUint userPromptLength;
     int token;
     int nInputTokens;
-    do {
+    for (;;) {
         do {
             userPromptLength = readStdin("\n👱 User\n> ", prompt, sizeof(prompt));
         } while (userPromptLength == 0);
@@ -202,6 +288,9 @@ static void chat(AppInferenceContext *context) {
         bool isStart = pos == 0;
         context->tokenizer->encode((char*)inputPrompt.content, inputTokens, &nInputTokens, isStart, true);
 
+        if (pos + nInputTokens > seqLen)
+            pos = shiftContext(context, pos, nKeep, pos + nInputTokens - seqLen);
+
         NnUint userPromptEndPos = (NnUint)std::min<unsigned int>(seqLen, pos + nInputTokens - 1);
         for (NnUint i = 0; ;) {
             int remainingTokens = userPromptEndPos - pos;
@@ -220,8 +309,8 @@ static void chat(AppInferenceContext *context) {
 
             i += batchSize;
             pos += batchSize;
-            token = inputTokens[i + 1];
         }
+        token = inputTokens[nInputTokens - 1];
 
         context->inference->setBatchSize(1);
         context->tokenizer->resetDecoder();
@@ -230,7 +319,14 @@ static void chat(AppInferenceContext *context) {
         if (inputPrompt.publicPrompt != nullptr)
             printf("%s", inputPrompt.publicPrompt);
 
-        while (pos < seqLen) {
+        for (;;) {
+            if (pos == seqLen) {
+                pos = shiftContext(context, pos, nKeep, 0);
+                if (pos == seqLen) {
+                    printf("(end of context)\n");
+                    return;
+                }
+            }
             context->inference->setPosition(pos);
             context->inference->setToken(0, token);
             context->inference->forward();
@@ -252,9 +348,7 @@ static void chat(AppInferenceContext *context) {
         }
 
         deltaItems.clear();
-    } while (pos < seqLen);
-
-    printf("(end of context)\n");
+    }
 }
 
 int main(int argc, char **argv) {
@@ -98,6 +98,12 @@ LlmHeader loadLlmHeader(const char *path, const NnUint maxSeqLen, NnFloatType sy
 
     if (header.weightType == F_UNK)
         throw std::runtime_error("Model does not specify weight type");
+    if (header.weightType != F_32 && header.weightType != F_16 && header.weightType != F_Q40 && header.weightType != F_Q80 &&
+        header.weightType != F_Q4K && header.weightType != F_Q6K)
+        throw std::runtime_error("Unsupported weight type: " + std::string(floatTypeToString(header.weightType)));
+    // Since version 1 F16 models store the token embedding in F16, older files keep it in F32
+    if (header.weightType == F_16 && header.version < 1)
+        throw std::runtime_error("This F16 model was written by an older converter with an F32 token embedding, please convert it again");
 
     header.origSeqLen = header.seqLen;
     if (maxSeqLen > 0 && header.seqLen > maxSeqLen)
@@ -148,7 +154,7 @@ void printLlmHeader(LlmHeader *header) {
     }
 }
 
-LlmNet buildLlmNet(LlmHeader *h, NnUint nNodes, NnUint nBatches) {
+LlmNet buildLlmNet(LlmHeader *h, NnUint nNodes, NnUint nBatches, NnUint nSlots, NnUint nLogitsTopk) {
     NnUint nExpertsOr1 = std::max(h->nExperts, 1u);
     NnUint nActiveExpertsOr1 = std::max(h->nActiveExperts, 1u);
     NnUint ffDim = h->hiddenDim;
@@ -157,12 +163,13 @@ LlmNet buildLlmNet(LlmHeader *h, NnUint nNodes, NnUint nBatches) {
         ffDim = h->moeHiddenDim;
 
     LlmNet n;
-    n.tokenEmbeddingSize = size2D(F_32, h->vocabSize, h->dim);
+    // F16 models keep the embedding table in F16, other models store it in F32
+    n.tokenEmbeddingSize = size2D(h->weightType == F_16 ? F_16 : F_32, h->vocabSize, h->dim);
     n.rmsNormSize = size1D(F_32, h->dim);
     n.qkRmsNormSize = size1D(F_32, h->headDim);
     n.moeGateSize = size2D(F_32, h->dim, h->nExperts);
 
-    NnKvCacheSlice kvCacheSlice = sliceKvCache(h->kvDim, h->seqLen, nNodes);
+    NnKvCacheSlice kvCacheSlice = sliceKvCache(h->kvDim, h->seqLen, nSlots, nNodes);
     NnMultiHeadAttSlice multiHeadAttSlice = sliceMultiHeadAtt(h->nHeads, h->seqLen, nNodes, nBatches);
 
     n.qSlice = sliceRowMatmul(h->weightType, nNodes, h->dim, h->qDim);
@@ -189,12 +196,20 @@ LlmNet buildLlmNet(LlmHeader *h, NnUint nNodes, NnUint nBatches) {
     NnNetConfigBuilder netBuilder(nNodes, nBatches);
 
     n.positionPipeIndex = netBuilder.addPipe("POS", size2D(F_32, nBatches, 1));
+    n.slotPipeIndex = netBuilder.addPipe("SLOT", size2D(F_32, nBatches, 1));
     n.tokenPipeIndex = netBuilder.addPipe("TOK", size2D(F_32, nBatches, 1));
     n.xPipeIndex = netBuilder.addPipe("X", size2D(F_32, nBatches, h->dim));
     n.logitsPipeIndex = netBuilder.addPipe("LG", size2D(F_32, nBatches, h->vocabSize));
+    n.nLogitsTopk = nLogitsTopk;
+    if (nLogitsTopk > 0) {
+        if (nLogitsTopk > h->vocabSize / nNodes)
+            throw std::invalid_argument("Logits top-k is greater than the vocabulary slice");
+        n.logitsTopkPipeIndex = netBuilder.addPipe("LGK", size2D(F_32, nBatches, nNodes * 2 * nLogitsTopk));
+    }
     const NnUint zqPipeIndex = netBuilder.addPipe("ZQ", size2D(h->syncType, nBatches, h->dim * nNodes));
 
     netBuilder.addPreSync(n.positionPipeIndex);
+    netBuilder.addPreSync(n.slotPipeIndex);
 
     n.header = h;
     n.netConfig = netBuilder.build();
@@ -301,23 +316,11 @@ LlmNet buildLlmNet(LlmHeader *h, NnUint nNodes, NnUint nBatches) {
                     NnCastOpCodeConfig{});
             }
             att.addOp(
-                OP_MATMUL, "block_matmul_q", layerIndex,
+                OP_MATMUL_QKV, "block_matmul_qkv", layerIndex,
                 pointerBatchConfig(SRC_BUFFER, yqBufferIndex),
                 pointerBatchConfig(SRC_BUFFER, qBufferIndex),
-                size2D(h->weightType, n.qSlice.n, n.qSlice.d0),
-                NnMatmulOpConfig{0, 0, moeExpertIndexesBufferIndex});
-            att.addOp(
-                OP_MATMUL, "block_matmul_k", layerIndex,
-                pointerBatchConfig(SRC_BUFFER, yqBufferIndex),
-                pointerBatchConfig(SRC_BUFFER, kTempBufferIndex),
-                size2D(h->weightType, n.kSlice.n, n.kSlice.d0),
-                NnMatmulOpConfig{0, 0, moeExpertIndexesBufferIndex});
-            att.addOp(
-                OP_MATMUL, "block_matmul_v", layerIndex,
-                pointerBatchConfig(SRC_BUFFER, yqBufferIndex),
-                pointerBatchConfig(SRC_BUFFER, vTempBufferIndex),
-                size2D(h->weightType, n.vSlice.n, n.vSlice.d0),
-                NnMatmulOpConfig{0, 0, moeExpertIndexesBufferIndex});
+                size2D(h->weightType, n.qSlice.n, n.qSlice.d0 + n.kSlice.d0 + n.vSlice.d0),
+                NnMatmulQkvOpConfig{n.qSlice.d0, n.kSlice.d0, kTempBufferIndex, vTempBufferIndex});
 
             if (h->archType == QWEN3 || h->archType == QWEN3_MOE) {
                 att.addOp(OP_INV_RMS, "block_norm_pre_q", layerIndex,
@@ -346,33 +349,14 @@ LlmNet buildLlmNet(LlmHeader *h, NnUint nNodes, NnUint nBatches) {
             }
 
             att.addOp(
-                OP_ROPE, "block_rope_q", layerIndex,
-                pointerBatchConfig(SRC_BUFFER, qBufferIndex),
-                pointerBatchConfig(SRC_BUFFER, qBufferIndex),
-                size0(),
-                NnRopeOpConfig{n.header->ropeType, 1, n.positionPipeIndex, ropeCacheBufferIndex, 
-                    h->ropeScalingFactor, h->ropeScalingLowFreqFactor, h->ropeScalingHighFreqFactory, h->ropeScalingOrigMaxSeqLen,
-                    ropeSlice});
-            att.addOp(
-                OP_ROPE, "block_rope_k", layerIndex,
-                pointerBatchConfig(SRC_BUFFER, kTempBufferIndex),
-                pointerBatchConfig(SRC_BUFFER, kTempBufferIndex),
-                size0(),
-                NnRopeOpConfig{n.header->ropeType, 0, n.positionPipeIndex, ropeCacheBufferIndex, 
-                    h->ropeScalingFactor, h->ropeScalingLowFreqFactor, h->ropeScalingHighFreqFactory, h->ropeScalingOrigMaxSeqLen,
-                    ropeSlice});
-            att.addOp(
-                OP_SHIFT, "block_shift_k", layerIndex,
+                OP_ROPE_KV, "block_rope_kv", layerIndex,
                 pointerBatchConfig(SRC_BUFFER, kTempBufferIndex),
                 pointerRawConfig(SRC_BUFFER, kBufferIndex),
                 size0(),
-                NnShiftOpCodeConfig{n.positionPipeIndex});
-            att.addOp(
-                OP_SHIFT, "block_shift_v", layerIndex,
-                pointerBatchConfig(SRC_BUFFER, vTempBufferIndex),
-                pointerRawConfig(SRC_BUFFER, vBufferIndex),
-                size0(),
-                NnShiftOpCodeConfig{n.positionPipeIndex});
+                NnRopeKvOpConfig{qBufferIndex, vTempBufferIndex, vBufferIndex, n.slotPipeIndex,
+                    NnRopeOpConfig{n.header->ropeType, 0, n.positionPipeIndex, ropeCacheBufferIndex,
+                        h->ropeScalingFactor, h->ropeScalingLowFreqFactor, h->ropeScalingHighFreqFactory, h->ropeScalingOrigMaxSeqLen,
+                        ropeSlice}});
             att.addOp(
                 OP_MULTIHEAD_ATT, "block_multihead_att", layerIndex,
                 pointerBatchedSliceConfig(SRC_BUFFER, zBufferIndex),
@@ -381,7 +365,7 @@ LlmNet buildLlmNet(LlmHeader *h, NnUint nNodes, NnUint nBatches) {
                 NnMultiHeadAttOpConfig{
                     multiHeadAttSlice.nHeads, multiHeadAttSlice.nHeads0,
                     h->nKvHeads, h->headDim, h->seqLen, n.qSlice.d0, kvCacheSlice.kvDim0,
-                    n.positionPipeIndex, qBufferIndex, kBufferIndex, vBufferIndex, attBufferIndex});
+                    n.positionPipeIndex, n.slotPipeIndex, qBufferIndex, kBufferIndex, vBufferIndex, attBufferIndex});
             att.addOp(
                 OP_CAST, "block_cast_y2", layerIndex,
                 pointerBatchedSliceConfig(SRC_BUFFER, zBufferIndex),
@@ -590,13 +574,24 @@ LlmNet buildLlmNet(LlmHeader *h, NnUint nNodes, NnUint nBatches) {
             pointerBatchConfig(SRC_BUFFER, logitsSliceBufferIndex),
             size2D(h->weightType, n.wclsSlice.n, n.wclsSlice.d0),
             NnMatmulOpConfig{});
-        end.addOp(
-            OP_CAST, "final_cast_logits", 0,
-            pointerBatchConfig(SRC_BUFFER, logitsSliceBufferIndex),
-            pointerBatchedSliceConfig(SRC_PIPE, n.logitsPipeIndex),
-            size0(),
-            NnCastOpCodeConfig{});
-        end.addSync(n.logitsPipeIndex, SYNC_NODE_SLICES_EXCEPT_ROOT);
+        if (nLogitsTopk > 0) {
+            // Only the best logits of each slice are sent, the root merges them
+            end.addOp(
+                OP_TOPK, "final_topk_logits", 0,
+                pointerBatchConfig(SRC_BUFFER, logitsSliceBufferIndex),
+                pointerBatchedSliceConfig(SRC_PIPE, n.logitsTopkPipeIndex),
+                size0(),
+                NnTopkOpCodeConfig{nLogitsTopk, nodeIndex * n.wclsSlice.d0});
+            end.addSync(n.logitsTopkPipeIndex, SYNC_NODE_SLICES_EXCEPT_ROOT);
+        } else {
+            end.addOp(
+                OP_CAST, "final_cast_logits", 0,
+                pointerBatchConfig(SRC_BUFFER, logitsSliceBufferIndex),
+                pointerBatchedSliceConfig(SRC_PIPE, n.logitsPipeIndex),
+                size0(),
+                NnCastOpCodeConfig{});
+            end.addSync(n.logitsPipeIndex, SYNC_NODE_SLICES_EXCEPT_ROOT);
+        }
 
         nodeBuilder.addSegment(end.build());
         n.nodeConfigs[nodeIndex] = nodeBuilder.build();
@@ -627,9 +622,13 @@ void loadLlmNetWeight(const char *path, LlmNet *net, NnRootWeightLoader *loader)
     b += loader->loadRoot("embedding", 0, net->tokenEmbeddingSize.nBytes, b);
 
     for (NnUint layerIndex = 0u; layerIndex < net->header->nLayers; layerIndex++) {
-        b += loader->loadRowMatmulSlices("block_matmul_q", layerIndex, 0u, &net->qSlice, b);
-        b += loader->loadRowMatmulSlices("block_matmul_k", layerIndex, 0u, &net->kSlice, b);
-        b += loader->loadRowMatmulSlices("block_matmul_v", layerIndex, 0u, &net->vSlice, b);
+        // q, k and v slices are concatenated into the weight of one fused matmul
+        NnSize qkvOffset = 0u;
+        b += loader->loadRowMatmulSlicesAt("block_matmul_qkv", layerIndex, qkvOffset, &net->qSlice, b);
+        qkvOffset += net->qSlice.sliceSize.nBytes;
+        b += loader->loadRowMatmulSlicesAt("block_matmul_qkv", layerIndex, qkvOffset, &net->kSlice, b);
+        qkvOffset += net->kSlice.sliceSize.nBytes;
+        b += loader->loadRowMatmulSlicesAt("block_matmul_qkv", layerIndex, qkvOffset, &net->vSlice, b);
         b += loader->loadColMatmulSlices("block_matmul_wo", layerIndex, 0u, &net->woSlice, b);
 
         if (net->header->nExperts > 0u) {
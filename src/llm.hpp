@@ -86,9 +86,12 @@ typedef struct {
     NnRowMatmulSlice w3Slice;
     NnRowMatmulSlice wclsSlice;
     NnUint positionPipeIndex;
+    NnUint slotPipeIndex;
     NnUint tokenPipeIndex;
     NnUint xPipeIndex;
     NnUint logitsPipeIndex;
+    NnUint logitsTopkPipeIndex;
+    NnUint nLogitsTopk; // 0 if nodes send whole logit slices
     NnSize3D tokenEmbeddingSize;
     NnSize3D rmsNormSize;
     NnSize3D qkRmsNormSize;
@@ -97,7 +100,7 @@ typedef struct {
 
 LlmHeader loadLlmHeader(const char* path, const unsigned int maxSeqLen, NnFloatType syncType);
 void printLlmHeader(LlmHeader *header);
-LlmNet buildLlmNet(LlmHeader *h, NnUint nNodes, NnUint nBatches);
+LlmNet buildLlmNet(LlmHeader *h, NnUint nNodes, NnUint nBatches, NnUint nSlots, NnUint nLogitsTopk);
 void releaseLlmNet(LlmNet *net);
 void loadLlmNetWeight(const char* path, LlmNet *net, NnRootWeightLoader *loader);
 
@@ -6,6 +6,7 @@
 #include <cstring>
 #include <cmath>
 #include <stdexcept>
+#include <vector>
 
 // utility functions
 
@@ -22,6 +23,14 @@ NnSize getBytes(NnFloatType floatType, NnSize n) {
         assert(n % Q80_BLOCK_SIZE == 0);
         return (n / Q80_BLOCK_SIZE) * sizeof(NnBlockQ80);
     }
+    if (floatType == F_Q4K) {
+        assert(n % Q4K_BLOCK_SIZE == 0);
+        return (n / Q4K_BLOCK_SIZE) * sizeof(NnBlockQ4K);
+    }
+    if (floatType == F_Q6K) {
+        assert(n % Q6K_BLOCK_SIZE == 0);
+        return (n / Q6K_BLOCK_SIZE) * sizeof(NnBlockQ6K);
+    }
     throw std::invalid_argument("Unsupported float type: " + std::to_string(floatType));
 }
 
@@ -34,6 +43,10 @@ NnSize getBlockSize(NnFloatType floatType) {
         return Q40_BLOCK_SIZE;
     if (floatType == F_Q80)
         return Q80_BLOCK_SIZE;
+    if (floatType == F_Q4K)
+        return Q4K_BLOCK_SIZE;
+    if (floatType == F_Q6K)
+        return Q6K_BLOCK_SIZE;
     throw std::invalid_argument("Unsupported float type");
 }
 
@@ -45,6 +58,8 @@ NnOpQuantType getOpQuantType(NnFloatType input, NnFloatType weight, NnFloatType
             return F32_F32_F32;
         if (weight == F_Q40)
             return F32_Q40_F32;
+        if (weight == F_16)
+            return F32_F16_F32;
     }
     if (input == F_32 && output == F_Q80) {
         if (weight == F_UNK || weight == F_32)
@@ -59,6 +74,12 @@ NnOpQuantType getOpQuantType(NnFloatType input, NnFloatType weight, NnFloatType
             return Q80_F32_F32;
         if (weight == F_Q40)
             return Q80_Q40_F32;
+        if (weight == F_16)
+            return Q80_F16_F32;
+        if (weight == F_Q4K)
+            return Q80_Q4K_F32;
+        if (weight == F_Q6K)
+            return Q80_Q6K_F32;
     }
     if (input == F_Q80 && output == F_Q80) {
         if (weight == F_UNK || weight == F_Q80)
@@ -88,6 +109,9 @@ const char *opCodeToString(NnOpCode code) {
     if (code == OP_SHIFT) return "SHIFT";
     if (code == OP_SOFTMAX) return "SOFTMAX";
     if (code == OP_MOE_GATE) return "MOE_GATE";
+    if (code == OP_MATMUL_QKV) return "MATMUL_QKV";
+    if (code == OP_ROPE_KV) return "ROPE_KV";
+    if (code == OP_TOPK) return "TOPK";
     throw std::invalid_argument("Unknown op code: " + std::to_string(code));
 }
 
@@ -100,6 +124,10 @@ const char *opQuantTypeToString(NnOpQuantType type) {
     if (type == Q80_Q80_F32) return "Q80_Q80_F32";
     if (type == Q80_Q40_F32) return "Q80_Q40_F32";
     if (type == Q80_F32_F32) return "Q80_F32_F32";
+    if (type == F32_F16_F32) return "F32_F16_F32";
+    if (type == Q80_F16_F32) return "Q80_F16_F32";
+    if (type == Q80_Q4K_F32) return "Q80_Q4K_F32";
+    if (type == Q80_Q6K_F32) return "Q80_Q6K_F32";
     throw std::invalid_argument("Unknown op quant type");
 }
 
@@ -208,12 +236,14 @@ NnUint Timer::elapsedMicroseconds() {
 
 // slicers
 
-NnKvCacheSlice sliceKvCache(NnUint kvDim, NnUint seqLen, NnUint nNodes) {
+NnKvCacheSlice sliceKvCache(NnUint kvDim, NnUint seqLen, NnUint nSlots, NnUint nNodes) {
     NnKvCacheSlice s;
     assert(kvDim % nNodes == 0);
+    assert(nSlots > 0);
     s.kvDim0 = kvDim / nNodes;
-    s.keySize = size2D(F_32, seqLen, s.kvDim0);
-    s.valueSize = size2D(F_32, seqLen, s.kvDim0);
+    // Every slot owns `seqLen` consecutive rows of the cache
+    s.keySize = size2D(F_32, nSlots * seqLen, s.kvDim0);
+    s.valueSize = size2D(F_32, nSlots * seqLen, s.kvDim0);
     return s;
 }
 
@@ -236,6 +266,9 @@ NnColMatmulSlice sliceColMatmul(NnFloatType type, NnUint nNodes, NnUint n, NnUin
     s.nNodes = nNodes;
     s.n = n;
     s.n0 = n / nNodes;
+    if (s.n0 % getBlockSize(type) != 0)
+        throw std::invalid_argument("Column slice width " + std::to_string(s.n0) + " is not a multiple of the " +
+            std::string(floatTypeToString(type)) + " block size, use fewer nodes");
     s.d = d;
     s.size = size2D(type, n, d);
     s.sliceSize = size2D(type, s.n0, d);
@@ -339,17 +372,24 @@ static inline float scaleFrequencyLlama3(const float freq, const NnRopeOpConfig
     return (1 - smooth) * freq / config->ropeScalingFactor + smooth * freq;
 }
 
+static inline float ropeLlamaFrequency(const NnRopeOpConfig *config, const NnUint i) {
+    const NnUint h = i % config->slice.headDim;
+    const float freq = 1.0f / powf(config->slice.ropeTheta, h / (float)config->slice.headDim);
+    if (config->ropeScalingFactor != 1.0f)
+        return scaleFrequencyLlama3(freq, config);
+    return freq;
+}
+
+static inline float ropeFalconFrequency(const NnRopeOpConfig *config, const NnUint j) {
+    return 1.0f / powf(config->slice.ropeTheta, 2.0f * (float)(j / (float)config->slice.headDim));
+}
+
 static inline void fullfillRopeLlamaCache(const NnRopeOpConfig *config, float *cache) {
     assert((config->slice.qDimEnd - config->slice.kvDimStart) % 2 == 0);
 
-    const bool applyScaling = config->ropeScalingFactor != 1.0f;
     for (NnUint pos = 0; pos < config->slice.seqLen; pos++) {
         for (NnUint i = config->slice.kvDimStart; i < config->slice.qDimEnd; i += 2) {
-            const NnUint h = i % config->slice.headDim;
-            float freq = 1.0f / powf(config->slice.ropeTheta, h / (float)config->slice.headDim);
-            if (applyScaling)
-                freq = scaleFrequencyLlama3(freq, config);
-            const float val = pos * freq;
+            const float val = pos * ropeLlamaFrequency(config, i);
             const float fcr = cosf(val);
             const float fci = sinf(val);
             cache[pos * config->slice.sliceDim + (i - config->slice.kvDimStart)] = fcr;
@@ -359,12 +399,9 @@ static inline void fullfillRopeLlamaCache(const NnRopeOpConfig *config, float *c
 }
 
 static inline void fullfillRopeFalconCache(const NnRopeOpConfig *config, float *cache) {
-    const float hs = (float)config->slice.headDim;
-
     for (NnUint pos = 0; pos < config->slice.seqLen; pos++) {
         for (NnUint j = 0; j < config->slice.headDim / 2; j++) {
-            const float freq = 1.0f / powf(config->slice.ropeTheta, 2.0f * (float)(j / hs));
-            const float val = pos * freq;
+            const float val = pos * ropeFalconFrequency(config, j);
             const float fcr = cosf(val);
             const float fci = sinf(val);
             cache[pos * config->slice.headDim + j] = fcr;
@@ -381,3 +418,51 @@ void fullfillRopeCache(const NnRopeOpConfig *config, float *cache) {
     else
         throw std::invalid_argument("Unsupported rope type");
 }
+
+void shiftRopeKeys(const NnRopeOpConfig *config, float *keys, NnUint nRows, NnUint delta) {
+    // A rotation by `-delta` composed with the stored one gives the rotation of the new position
+    const NnRopeSlice *slice = &config->slice;
+    if (config->type == ROPE_LLAMA || config->type == ROPE_LLAMA3_1) {
+        std::vector<float> rotation(slice->kvDim0);
+        for (NnUint i = 0; i < slice->kvDim0; i += 2) {
+            const float val = delta * ropeLlamaFrequency(config, slice->kvDimStart + i);
+            rotation[i] = cosf(val);
+            rotation[i + 1] = sinf(val);
+        }
+        for (NnUint row = 0; row < nRows; row++) {
+            float *k = &keys[row * slice->kvDim0];
+            for (NnUint i = 0; i < slice->kvDim0; i += 2) {
+                const float fcr = rotation[i];
+                const float fci = rotation[i + 1];
+                const float v0 = k[i];
+                const float v1 = k[i + 1];
+                k[i] = v0 * fcr + v1 * fci;
+                k[i + 1] = v1 * fcr - v0 * fci;
+            }
+        }
+    } else if (config->type == ROPE_FALCON) {
+        const NnUint half = slice->headDim / 2;
+        assert(slice->kvDim0 % slice->headDim == 0);
+        std::vector<float> rotation(slice->headDim);
+        for (NnUint j = 0; j < half; j++) {
+            const float val = delta * ropeFalconFrequency(config, j);
+            rotation[j] = cosf(val);
+            rotation[j + half] = sinf(val);
+        }
+        for (NnUint row = 0; row < nRows; row++) {
+            for (NnUint o = 0; o < slice->kvDim0; o += slice->headDim) {
+                float *k = &keys[row * slice->kvDim0 + o];
+                for (NnUint j = 0; j < half; j++) {
+                    const float fcr = rotation[j];
+                    const float fci = rotation[j + half];
+                    const float v0 = k[j];
+                    const float v1 = k[j + half];
+                    k[j] = v0 * fcr + v1 * fci;
+                    k[j + half] = v1 * fcr - v0 * fci;
+                }
+            }
+        }
+    } else {
+        throw std::invalid_argument("Unsupported rope type");
+    }
+}
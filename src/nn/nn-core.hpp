@@ -88,6 +88,9 @@ enum NnOpCode {
     OP_SHIFT,
     OP_SOFTMAX,
     OP_MOE_GATE,
+    OP_MATMUL_QKV,
+    OP_ROPE_KV,
+    OP_TOPK,
 };
 
 enum NnOpQuantType {
@@ -100,10 +103,14 @@ enum NnOpQuantType {
     Q80_Q80_F32,
     Q80_Q40_F32,
     Q80_F32_F32,
+    F32_F16_F32,
+    Q80_F16_F32,
+    Q80_Q4K_F32,
+    Q80_Q6K_F32,
 };
 
-#define N_OP_CODES (OP_SHIFT + 1)
-#define N_OP_QUANTS (Q80_F32_F32 + 1)
+#define N_OP_CODES (OP_TOPK + 1)
+#define N_OP_QUANTS (Q80_Q6K_F32 + 1)
 
 enum NnPointerSource {
     SRC_PIPE,
@@ -212,6 +219,13 @@ typedef struct {
     NnUint activeExpertIndexesBufferIndex;
 } NnMatmulOpConfig;
 
+typedef struct {
+    NnUint qDim0;
+    NnUint kvDim0;
+    NnUint kBufferIndex;
+    NnUint vBufferIndex;
+} NnMatmulQkvOpConfig;
+
 typedef struct {
     NnRopeType type;
     NnUint isQ; // Cannot use `bool` here due to GPU memory alignment
@@ -224,6 +238,14 @@ typedef struct {
     NnRopeSlice slice;
 } NnRopeOpConfig;
 
+typedef struct {
+    NnUint queryBufferIndex;
+    NnUint valueBufferIndex;
+    NnUint valueCacheBufferIndex;
+    NnUint slotPipeIndex;
+    NnRopeOpConfig rope; // Input is the key, output is the key cache
+} NnRopeKvOpConfig;
+
 typedef struct {
     NnUint nHeads;
     NnUint nHeads0;
@@ -233,6 +255,7 @@ typedef struct {
     NnUint qSliceD0;
     NnUint kvDim0;
     NnUint positionPipeIndex;
+    NnUint slotPipeIndex;
     NnUint queryBufferIndex;
     NnUint keyCacheBufferIndex;
     NnUint valueCacheBufferIndex;
@@ -269,6 +292,8 @@ typedef struct {
 
 typedef struct {
     NnUint indexPipeIndex;
+    NnUint slotPipeIndex;
+    NnUint slotLength; // Rows reserved for each slot, the output row is `slot * slotLength + index`
 } NnShiftOpCodeConfig;
 
 typedef struct {
@@ -281,6 +306,11 @@ typedef struct {
     NnUint indexesBufferIndex;
 } NnMoeGateOpCodeConfig;
 
+typedef struct {
+    NnUint k;
+    NnUint indexOffset; // Added to the output indexes, the position of the input slice in the whole row
+} NnTopkOpCodeConfig;
+
 // utility functions
 
 const char *opCodeToString(NnOpCode code);
@@ -315,7 +345,7 @@ public:
 
 // slicers
 
-NnKvCacheSlice sliceKvCache(NnUint kvDim, NnUint seqLen, NnUint nNodes);
+NnKvCacheSlice sliceKvCache(NnUint kvDim, NnUint seqLen, NnUint nSlots, NnUint nNodes);
 NnRowMatmulSlice sliceRowMatmul(NnFloatType type, NnUint nNodes, NnUint n, NnUint d);
 NnColMatmulSlice sliceColMatmul(NnFloatType type, NnUint nNodes, NnUint n, NnUint d);
 NnRopeSlice sliceRope(NnRopeType type, NnUint qDim, NnUint kvDim, NnUint nKvHeads, NnUint nNodes, NnUint seqLen, NnUint headDim, float ropeTheta, NnUint nodeIndex);
@@ -329,5 +359,7 @@ NnUint splitColMatmulWeight(NnColMatmulSlice *slice, NnUint nodeIndex, NnByte *w
 // rope
 
 void fullfillRopeCache(const NnRopeOpConfig *config, float *cache);
+// Moves `nRows` rotated key rows of the node's slice back by `delta` positions
+void shiftRopeKeys(const NnRopeOpConfig *config, float *keys, NnUint nRows, NnUint delta);
 
 #endif
@@ -276,6 +276,129 @@ void testMatmul_F32_Q40_F32(const NnUint m = 2) {
     compare_F32("matmul_Q80_Q40_F32", o.data(), oTemp.data(), d, 4.0f);
 }
 
+void testMatmul_Q80_Q80_F32(const NnUint m, const NnUint nThreads) {
+    const NnUint n = Q80_BLOCK_SIZE * m;
+    const NnUint d = 24;
+
+    std::vector<float> x(n);
+    std::vector<float> w(n * d);
+    std::vector<float> expected(d);
+    std::vector<float> o(d);
+    std::vector<NnBlockQ80> xQ80(n / Q80_BLOCK_SIZE);
+    std::vector<NnBlockQ80> wQ80((n * d) / Q80_BLOCK_SIZE);
+
+    for (NnUint i = 0; i < n; i++)
+        x[i] = sinf((float)i * 0.37f);
+    for (NnUint i = 0; i < n * d; i++)
+        w[i] = cosf((float)i * 0.11f) * 0.1f;
+    quantizeF32toQ80(x.data(), xQ80.data(), n, 1, 0);
+    quantizeF32toQ80(w.data(), wQ80.data(), n * d, 1, 0);
+    matmul_F32_F32_F32(expected.data(), x.data(), w.data(), n, d, 1, 0);
+
+    for (NnUint threadIndex = 0; threadIndex < nThreads; threadIndex++)
+        matmul_Q80_Q80_F32(o.data(), xQ80.data(), wQ80.data(), n, d, nThreads, threadIndex);
+    compare_F32("matmul_Q80_Q80_F32", o.data(), expected.data(), d, 0.05f);
+}
+
+template <typename TBlock>
+void testMatmul_Q80_K(const char *name, NnUint n, NnUint d,
+    void (*quantize)(const float *, TBlock *, const NnUint, const NnUint, const NnUint),
+    void (*dequantize)(const TBlock *, float *, const NnUint, const NnUint, const NnUint),
+    void (*matmul)(float *, const NnBlockQ80 *, const TBlock *, const NnUint, const NnUint, const NnUint, const NnUint),
+    const float quantEpsilon) {
+    std::vector<float> x(n);
+    std::vector<float> xDeq(n);
+    std::vector<float> w(n * d);
+    std::vector<float> wDeq(n * d);
+    std::vector<float> expected(d);
+    std::vector<float> o(d);
+    std::vector<NnBlockQ80> xQ80(n / Q80_BLOCK_SIZE);
+    std::vector<TBlock> wK((n * d) / 256);
+
+    for (NnUint i = 0; i < n; i++)
+        x[i] = sinf((float)i * 0.37f);
+    for (NnUint i = 0; i < n * d; i++)
+        w[i] = cosf((float)i * 0.11f) * 0.1f + sinf((float)i * 0.013f) * 0.02f;
+    quantizeF32toQ80(x.data(), xQ80.data(), n, 1, 0);
+    dequantizeQ80toF32(xQ80.data(), xDeq.data(), n, 1, 0);
+    quantize(w.data(), wK.data(), n * d, 1, 0);
+    dequantize(wK.data(), wDeq.data(), n * d, 1, 0);
+    compare_F32(name, wDeq.data(), w.data(), n * d, quantEpsilon);
+
+    matmul_F32_F32_F32(expected.data(), xDeq.data(), wDeq.data(), n, d, 1, 0);
+    for (NnUint threadIndex = 0; threadIndex < 3; threadIndex++)
+        matmul(o.data(), xQ80.data(), wK.data(), n, d, 3, threadIndex);
+    compare_F32(name, o.data(), expected.data(), d, 0.0005f);
+}
+
+void testMatmul_F16(const NnUint n, const NnUint d) {
+    std::vector<float> x(n);
+    std::vector<float> w(n * d);
+    std::vector<NnFp16> wF16(n * d);
+    std::vector<NnBlockQ80> xQ80(n / Q80_BLOCK_SIZE);
+    std::vector<float> expected(d);
+    std::vector<float> o(d);
+
+    for (NnUint i = 0; i < n; i++)
+        x[i] = sinf((float)i * 0.37f);
+    for (NnUint i = 0; i < n * d; i++) {
+        wF16[i] = CONVERT_F32_TO_F16(cosf((float)i * 0.11f) * 0.1f);
+        w[i] = CONVERT_F16_TO_F32(wF16[i]);
+    }
+    matmul_F32_F32_F32(expected.data(), x.data(), w.data(), n, d, 1, 0);
+
+    for (NnUint threadIndex = 0; threadIndex < 3; threadIndex++)
+        matmul_F32_F16_F32(o.data(), x.data(), wF16.data(), n, d, 3, threadIndex);
+    compare_F32("matmul_F32_F16_F32", o.data(), expected.data(), d, 0.0001f);
+
+    if (n % Q80_BLOCK_SIZE == 0) {
+        quantizeF32toQ80(x.data(), xQ80.data(), n, 1, 0);
+        for (NnUint threadIndex = 0; threadIndex < 3; threadIndex++)
+            matmul_Q80_F16_F32(o.data(), xQ80.data(), wF16.data(), n, d, 3, threadIndex);
+        compare_F32("matmul_Q80_F16_F32", o.data(), expected.data(), d, 0.05f);
+    }
+}
+
+void testEmbedding_F16() {
+    const NnUint vocabSize = 5;
+    const NnUint dim = 40;
+    const NnUint batchSize = 3;
+    const NnUint nThreads = 3;
+
+    std::vector<NnFp16> w(vocabSize * dim);
+    for (NnUint i = 0; i < vocabSize * dim; i++)
+        w[i] = CONVERT_F32_TO_F16(sinf((float)i * 0.23f));
+    float tokens[batchSize] = { 4.0f, 0.0f, 2.0f };
+    std::vector<float> o(batchSize * dim);
+    std::vector<float> expected(batchSize * dim);
+    for (NnUint y = 0; y < batchSize; y++) {
+        for (NnUint i = 0; i < dim; i++)
+            expected[y * dim + i] = CONVERT_F16_TO_F32(w[(NnUint)tokens[y] * dim + i]);
+    }
+
+    NnByte *input[batchSize];
+    NnByte *output[batchSize];
+    for (NnUint y = 0; y < batchSize; y++) {
+        input[y] = (NnByte *)&tokens[y];
+        output[y] = (NnByte *)&o[y * dim];
+    }
+    NnCpuOpContext context;
+    std::memset(&context, 0, sizeof(context));
+    context.name = "embedding";
+    context.nBatches = batchSize;
+    context.input = input;
+    context.inputSize = size2D(F_32, batchSize, 1);
+    context.output = output;
+    context.outputSize = size2D(F_32, batchSize, dim);
+    context.weight = (NnByte *)w.data();
+    context.weightSize = size2D(F_16, vocabSize, dim);
+
+    initEmbeddingForward(&context);
+    for (NnUint threadIndex = 0; threadIndex < nThreads; threadIndex++)
+        embeddingForward_F32_F16_F32(nThreads, threadIndex, batchSize, &context);
+    compare_F32("embedding_F32_F16_F32", o.data(), expected.data(), batchSize * dim, 0.0f);
+}
+
 void testLlamafileSgemm() {
     const NnUint batchSize = 8;
     const NnUint n = 256;
@@ -327,6 +450,373 @@ void testLlamafileSgemm() {
 #endif
 }
 
+void testMatmulQkv_F32_F32_F32(const NnUint batchSize, const NnUint nThreads) {
+    const NnUint n = 64;
+    const NnUint qDim0 = 48;
+    const NnUint kvDim0 = 16;
+    const NnUint d = qDim0 + 2 * kvDim0;
+
+    std::vector<float> x(n * batchSize);
+    std::vector<float> w(n * d);
+    std::vector<float> expected(d * batchSize);
+    std::vector<float> q(qDim0 * batchSize);
+    std::vector<float> k(kvDim0 * batchSize);
+    std::vector<float> v(kvDim0 * batchSize);
+
+    for (NnUint i = 0; i < n * batchSize; i++)
+        x[i] = sinf((float)i * 0.37f);
+    for (NnUint i = 0; i < n * d; i++)
+        w[i] = cosf((float)i * 0.11f) * 0.1f;
+    for (NnUint y = 0; y < batchSize; y++)
+        matmul_F32_F32_F32(&expected[y * d], &x[y * n], w.data(), n, d, 1, 0);
+
+    std::vector<NnByte *> input(batchSize);
+    std::vector<NnByte *> output(batchSize);
+    for (NnUint y = 0; y < batchSize; y++) {
+        input[y] = (NnByte *)&x[y * n];
+        output[y] = (NnByte *)&q[y * qDim0];
+    }
+    NnByte *buffers[] = { (NnByte *)k.data(), (NnByte *)v.data() };
+    NnBufferConfig bufferConfigs[] = {
+        { nullptr, size2D(F_32, batchSize, kvDim0) },
+        { nullptr, size2D(F_32, batchSize, kvDim0) }
+    };
+    NnMatmulQkvOpConfig config{qDim0, kvDim0, 0u, 1u};
+
+    NnCpuOpContext context;
+    std::memset(&context, 0, sizeof(context));
+    context.name = "matmul_qkv";
+    context.nBatches = batchSize;
+    context.buffers = buffers;
+    context.bufferConfigs = bufferConfigs;
+    context.opConfig = &config;
+    context.input = input.data();
+    context.inputSize = size2D(F_32, batchSize, n);
+    context.hasInputContinuousMemory = true;
+    context.output = output.data();
+    context.outputSize = size2D(F_32, batchSize, qDim0);
+    context.hasOutputContinuousMemory = true;
+    context.weight = (NnByte *)w.data();
+    context.weightSize = size2D(F_32, n, d);
+
+    initMatmulQkvForward(&context);
+    for (NnUint threadIndex = 0; threadIndex < nThreads; threadIndex++)
+        matmulQkvForward_F32_F32_F32(nThreads, threadIndex, batchSize, &context);
+
+    for (NnUint y = 0; y < batchSize; y++) {
+        compare_F32("matmulQkv_F32_F32_F32_q", &q[y * qDim0], &expected[y * d], qDim0, 0.0001f);
+        compare_F32("matmulQkv_F32_F32_F32_k", &k[y * kvDim0], &expected[y * d + qDim0], kvDim0, 0.0001f);
+        compare_F32("matmulQkv_F32_F32_F32_v", &v[y * kvDim0], &expected[y * d + qDim0 + kvDim0], kvDim0, 0.0001f);
+    }
+}
+
+void testMatmulQkv_Q80_Q40_F32(const NnUint batchSize, const NnUint nThreads) {
+    const NnUint n = 4 * Q40_BLOCK_SIZE;
+    const NnUint qDim0 = 48;
+    const NnUint kvDim0 = 16;
+    const NnUint nBlocks = n / Q40_BLOCK_SIZE;
+    const NnUint dims[] = { qDim0, kvDim0, kvDim0 };
+
+    std::vector<float> x(n * batchSize);
+    std::vector<NnBlockQ80> xQ80(nBlocks * batchSize);
+    std::vector<float> q(qDim0 * batchSize);
+    std::vector<float> k(kvDim0 * batchSize);
+    std::vector<float> v(kvDim0 * batchSize);
+    float *outputs[] = { q.data(), k.data(), v.data() };
+
+    for (NnUint i = 0; i < n * batchSize; i++)
+        x[i] = sinf((float)i * 0.37f);
+    quantizeF32toQ80(x.data(), xQ80.data(), n * batchSize, 1, 0);
+
+    // q, k and v are quantized as separate matrices and placed one after another, like the weight loader does
+    std::vector<NnBlockQ40> w(nBlocks * (qDim0 + 2 * kvDim0));
+    std::vector<float> expected[3];
+    NnUint offset = 0u;
+    for (NnUint p = 0; p < 3; p++) {
+        std::vector<float> wPart(n * dims[p]);
+        for (NnUint i = 0; i < n * dims[p]; i++)
+            wPart[i] = cosf((float)(i + p * 1000) * 0.11f) * 0.1f;
+        quantizeF32toQ40(wPart.data(), &w[offset * nBlocks], n * dims[p], 1, 0);
+        expected[p].resize(dims[p] * batchSize);
+        for (NnUint y = 0; y < batchSize; y++)
+            matmul_Q80_Q40_F32(&expected[p][y * dims[p]], &xQ80[y * nBlocks], &w[offset * nBlocks], n, dims[p], 1, 0);
+        offset += dims[p];
+    }
+
+    std::vector<NnByte *> input(batchSize);
+    std::vector<NnByte *> output(batchSize);
+    for (NnUint y = 0; y < batchSize; y++) {
+        input[y] = (NnByte *)&xQ80[y * nBlocks];
+        output[y] = (NnByte *)&q[y * qDim0];
+    }
+    NnByte *buffers[] = { (NnByte *)k.data(), (NnByte *)v.data() };
+    NnBufferConfig bufferConfigs[] = {
+        { nullptr, size2D(F_32, batchSize, kvDim0) },
+        { nullptr, size2D(F_32, batchSize, kvDim0) }
+    };
+    NnMatmulQkvOpConfig config{qDim0, kvDim0, 0u, 1u};
+
+    NnCpuOpContext context;
+    std::memset(&context, 0, sizeof(context));
+    context.name = "matmul_qkv";
+    context.nBatches = batchSize;
+    context.buffers = buffers;
+    context.bufferConfigs = bufferConfigs;
+    context.opConfig = &config;
+    context.input = input.data();
+    context.inputSize = size2D(F_Q80, batchSize, n);
+    context.hasInputContinuousMemory = true;
+    context.output = output.data();
+    context.outputSize = size2D(F_32, batchSize, qDim0);
+    context.hasOutputContinuousMemory = true;
+    context.weight = (NnByte *)w.data();
+    context.weightSize = size2D(F_Q40, n, qDim0 + 2 * kvDim0);
+
+    initMatmulQkvForward(&context);
+    for (NnUint threadIndex = 0; threadIndex < nThreads; threadIndex++)
+        matmulQkvForward_Q80_Q40_F32(nThreads, threadIndex, batchSize, &context);
+
+    const char *names[] = { "matmulQkv_Q80_Q40_F32_q", "matmulQkv_Q80_Q40_F32_k", "matmulQkv_Q80_Q40_F32_v" };
+    for (NnUint p = 0; p < 3; p++)
+        compare_F32(names[p], outputs[p], expected[p].data(), dims[p] * batchSize, 0.001f);
+}
+
+void testRopeKv_F32_F32(const NnRopeType type, const NnUint nThreads) {
+    const NnUint batchSize = 2;
+    const NnUint nSlots = 2;
+    const NnUint seqLen = 8;
+    const NnUint headDim = 16;
+    const NnRopeSlice slice = sliceRope(type, 64, 32, 2, 1, seqLen, headDim, 10000.0f, 0);
+    const NnUint qDim0 = slice.qDim0;
+    const NnUint kvDim0 = slice.kvDim0;
+
+    std::vector<float> ropeCache(slice.cacheSize.length);
+    std::vector<float> q(batchSize * qDim0);
+    std::vector<float> k(batchSize * kvDim0);
+    std::vector<float> v(batchSize * kvDim0);
+    std::vector<float> keyCache(nSlots * seqLen * kvDim0, 0.0f);
+    std::vector<float> valueCache(nSlots * seqLen * kvDim0, 0.0f);
+    float positions[] = { 3.0f, 3.0f };
+    float slots[] = { 1.0f, 0.0f };
+    for (NnUint i = 0; i < batchSize * qDim0; i++)
+        q[i] = sinf((float)i * 0.13f);
+    for (NnUint i = 0; i < batchSize * kvDim0; i++) {
+        k[i] = cosf((float)i * 0.17f);
+        v[i] = sinf((float)i * 0.19f);
+    }
+
+    // expected: rope in place and copy to the cache
+    NnRopeOpConfig ropeConfig{type, 0u, 0u, 0u, 1.0f, 1.0f, 1.0f, 0u, slice};
+    fullfillRopeCache(&ropeConfig, ropeCache.data());
+    std::vector<float> expectedQ(q);
+    std::vector<float> expectedK(k);
+    for (NnUint b = 0; b < batchSize; b++) {
+        const NnUint pos = (NnUint)positions[b];
+        if (type == ROPE_FALCON) {
+            ropeFalcon_F32(&expectedQ[b * qDim0], &expectedQ[b * qDim0], ropeCache.data(), true, pos, &slice, 1, 0);
+            ropeFalcon_F32(&expectedK[b * kvDim0], &expectedK[b * kvDim0], ropeCache.data(), false, pos, &slice, 1, 0);
+        } else {
+            ropeLlama_F32(&expectedQ[b * qDim0], &expectedQ[b * qDim0], ropeCache.data(), true, pos, &slice, 1, 0);
+            ropeLlama_F32(&expectedK[b * kvDim0], &expectedK[b * kvDim0], ropeCache.data(), false, pos, &slice, 1, 0);
+        }
+    }
+
+    NnByte flags[] = { 0, 0, 0, 0 };
+    NnByte *buffers[] = { (NnByte *)ropeCache.data(), (NnByte *)q.data(), (NnByte *)v.data(), (NnByte *)valueCache.data() };
+    NnBufferConfig bufferConfigs[] = {
+        { nullptr, slice.cacheSize },
+        { nullptr, size2D(F_32, batchSize, qDim0) },
+        { nullptr, size2D(F_32, batchSize, kvDim0) },
+        { nullptr, size2D(F_32, nSlots * seqLen, kvDim0) },
+    };
+    NnByte *pipes[] = { (NnByte *)positions, (NnByte *)slots };
+    NnPipeConfig pipeConfigs[] = {
+        { nullptr, size2D(F_32, batchSize, 1) },
+        { nullptr, size2D(F_32, batchSize, 1) },
+    };
+    std::vector<NnByte *> input(batchSize);
+    for (NnUint b = 0; b < batchSize; b++)
+        input[b] = (NnByte *)&k[b * kvDim0];
+    NnByte *output[] = { (NnByte *)keyCache.data() };
+    NnRopeKvOpConfig config{1u, 2u, 3u, 1u, ropeConfig};
+
+    NnCpuOpContext context;
+    std::memset(&context, 0, sizeof(context));
+    context.name = "rope_kv";
+    context.nBatches = batchSize;
+    context.bufferFlags = flags;
+    context.buffers = buffers;
+    context.bufferConfigs = bufferConfigs;
+    context.pipes = pipes;
+    context.pipeConfigs = pipeConfigs;
+    context.opConfig = &config;
+    context.input = input.data();
+    context.inputSize = size2D(F_32, batchSize, kvDim0);
+    context.hasInputContinuousMemory = true;
+    context.output = output;
+    context.outputSize = size1D(F_32, nSlots * seqLen * kvDim0);
+    context.hasOutputContinuousMemory = true;
+
+    initRopeKvForward_F32(&context);
+    for (NnUint threadIndex = 0; threadIndex < nThreads; threadIndex++)
+        ropeKvForward_F32_F32(nThreads, threadIndex, batchSize, &context);
+
+    compare_F32("ropeKv_F32_F32_q", q.data(), expectedQ.data(), batchSize * qDim0, 0.00001f);
+    for (NnUint b = 0; b < batchSize; b++) {
+        const NnUint row = (NnUint)slots[b] * seqLen + (NnUint)positions[b];
+        compare_F32("ropeKv_F32_F32_k", &keyCache[row * kvDim0], &expectedK[b * kvDim0], kvDim0, 0.00001f);
+        compare_F32("ropeKv_F32_F32_v", &valueCache[row * kvDim0], &v[b * kvDim0], kvDim0, 0.00001f);
+    }
+}
+
+void testShiftRopeKeys(const NnRopeType type) {
+    const NnUint seqLen = 16;
+    const NnUint headDim = 16;
+    const NnUint nRows = 3;
+    const NnUint delta = 5;
+    // The second node of two, so the slice starts in the middle of the key vector
+    const NnRopeSlice slice = sliceRope(type, 64, 64, 4, 2, seqLen, headDim, 10000.0f, 1);
+    const NnUint kvDim0 = slice.kvDim0;
+    NnRopeOpConfig ropeConfig{type, 0u, 0u, 0u, 8.0f, 1.0f, 4.0f, 8u, slice};
+    std::vector<float> ropeCache(slice.cacheSize.length);
+    fullfillRopeCache(&ropeConfig, ropeCache.data());
+
+    std::vector<float> keys(nRows * kvDim0);
+    std::vector<float> expectedKeys(nRows * kvDim0);
+    for (NnUint i = 0; i < nRows * kvDim0; i++)
+        keys[i] = cosf((float)i * 0.23f);
+    expectedKeys = keys;
+    for (NnUint row = 0; row < nRows; row++) {
+        const NnUint pos = 9 + row;
+        if (type == ROPE_FALCON) {
+            ropeFalcon_F32(&keys[row * kvDim0], &keys[row * kvDim0], ropeCache.data(), false, pos, &slice, 1, 0);
+            ropeFalcon_F32(&expectedKeys[row * kvDim0], &expectedKeys[row * kvDim0], ropeCache.data(), false, pos - delta, &slice, 1, 0);
+        } else {
+            ropeLlama_F32(&keys[row * kvDim0], &keys[row * kvDim0], ropeCache.data(), false, pos, &slice, 1, 0);
+            ropeLlama_F32(&expectedKeys[row * kvDim0], &expectedKeys[row * kvDim0], ropeCache.data(), false, pos - delta, &slice, 1, 0);
+        }
+    }
+
+    shiftRopeKeys(&ropeConfig, keys.data(), nRows, delta);
+
+    compare_F32("shiftRopeKeys", keys.data(), expectedKeys.data(), nRows * kvDim0, 0.0001f);
+}
+
+void testMultiHeadAtt_F32_F32(const NnUint nThreads) {
+    const NnUint batchSize = 3;
+    const NnUint nSlots = 3;
+    const NnUint seqLen = 8;
+    const NnUint nHeads = 4;
+    const NnUint nKvHeads = 2;
+    const NnUint headDim = 8;
+    const NnUint qDim0 = nHeads * headDim;
+    const NnUint kvDim0 = nKvHeads * headDim;
+    const NnUint slotSize = seqLen * kvDim0;
+
+    std::vector<float> q(batchSize * qDim0);
+    std::vector<float> keyCache(nSlots * slotSize);
+    std::vector<float> valueCache(nSlots * slotSize);
+    std::vector<float> att(batchSize * nHeads * seqLen);
+    std::vector<float> expectedAtt(nHeads * seqLen);
+    std::vector<float> y(batchSize * qDim0);
+    std::vector<float> expectedY(batchSize * qDim0);
+    for (NnUint i = 0; i < batchSize * qDim0; i++)
+        q[i] = sinf((float)i * 0.07f);
+    for (NnUint i = 0; i < nSlots * slotSize; i++) {
+        keyCache[i] = cosf((float)i * 0.11f);
+        valueCache[i] = sinf((float)i * 0.05f);
+    }
+
+    // rows of different sequences in one batch
+    float positions[] = { 5.0f, 2.0f, 7.0f };
+    float slots[] = { 2.0f, 0.0f, 1.0f };
+    for (NnUint b = 0; b < batchSize; b++) {
+        const NnUint slot = (NnUint)slots[b];
+        multiheadAtt_F32(&expectedY[b * qDim0], &q[b * qDim0], expectedAtt.data(),
+            &keyCache[slot * slotSize], &valueCache[slot * slotSize], (NnUint)positions[b],
+            nHeads, nHeads, nKvHeads, kvDim0, headDim, seqLen, 1, 0);
+    }
+
+    NnByte *buffers[] = { (NnByte *)q.data(), (NnByte *)keyCache.data(), (NnByte *)valueCache.data(), (NnByte *)att.data() };
+    NnBufferConfig bufferConfigs[] = {
+        { nullptr, size2D(F_32, batchSize, qDim0) },
+        { nullptr, size2D(F_32, nSlots * seqLen, kvDim0) },
+        { nullptr, size2D(F_32, nSlots * seqLen, kvDim0) },
+        { nullptr, size2D(F_32, batchSize, nHeads * seqLen) },
+    };
+    NnByte *pipes[] = { (NnByte *)positions, (NnByte *)slots };
+    NnPipeConfig pipeConfigs[] = {
+        { nullptr, size2D(F_32, batchSize, 1) },
+        { nullptr, size2D(F_32, batchSize, 1) },
+    };
+    std::vector<NnByte *> output(batchSize);
+    for (NnUint b = 0; b < batchSize; b++)
+        output[b] = (NnByte *)&y[b * qDim0];
+    NnMultiHeadAttOpConfig config{nHeads, nHeads, nKvHeads, headDim, seqLen, qDim0, kvDim0, 0u, 1u, 0u, 1u, 2u, 3u};
+
+    NnCpuOpContext context;
+    std::memset(&context, 0, sizeof(context));
+    context.name = "multihead_att";
+    context.nBatches = batchSize;
+    context.buffers = buffers;
+    context.bufferConfigs = bufferConfigs;
+    context.pipes = pipes;
+    context.pipeConfigs = pipeConfigs;
+    context.opConfig = &config;
+    context.output = output.data();
+    context.outputSize = size2D(F_32, batchSize, qDim0);
+
+    initMultiHeadAttForward(&context);
+    for (NnUint threadIndex = 0; threadIndex < nThreads; threadIndex++)
+        multiHeadAttForward_F32_F32(nThreads, threadIndex, batchSize, &context);
+
+    compare_F32("multiHeadAtt_F32_F32", y.data(), expectedY.data(), batchSize * qDim0, 0.00001f);
+}
+
+void testShift_F32_F32() {
+    const NnUint batchSize = 4;
+    const NnUint dim = 6;
+    const NnUint slotLength = 3;
+    const NnUint nSlots = 2;
+
+    std::vector<float> x(batchSize * dim);
+    std::vector<float> y(nSlots * slotLength * dim, 0.0f);
+    std::vector<float> expectedY(nSlots * slotLength * dim, 0.0f);
+    float indexes[] = { 0.0f, 2.0f, 1.0f, 2.0f };
+    float slots[] = { 0.0f, 0.0f, 1.0f, 1.0f };
+    for (NnUint b = 0; b < batchSize; b++) {
+        const NnUint row = (NnUint)slots[b] * slotLength + (NnUint)indexes[b];
+        for (NnUint i = 0; i < dim; i++) {
+            x[b * dim + i] = (float)(b * 100 + i);
+            expectedY[row * dim + i] = x[b * dim + i];
+        }
+    }
+
+    NnByte *pipes[] = { (NnByte *)indexes, (NnByte *)slots };
+    std::vector<NnByte *> input(batchSize);
+    for (NnUint b = 0; b < batchSize; b++)
+        input[b] = (NnByte *)&x[b * dim];
+    NnByte *output[] = { (NnByte *)y.data() };
+    NnShiftOpCodeConfig config{0u, 1u, slotLength};
+
+    NnCpuOpContext context;
+    std::memset(&context, 0, sizeof(context));
+    context.name = "shift";
+    context.nBatches = batchSize;
+    context.pipes = pipes;
+    context.opConfig = &config;
+    context.input = input.data();
+    context.inputSize = size2D(F_32, batchSize, dim);
+    context.hasInputContinuousMemory = true;
+    context.output = output;
+    context.outputSize = size1D(F_32, nSlots * slotLength * dim);
+    context.hasOutputContinuousMemory = true;
+
+    shiftForward_F32_F32(1, 0, batchSize, &context);
+
+    compare_F32("shift_F32_F32", y.data(), expectedY.data(), nSlots * slotLength * dim, 0.00001f);
+}
+
 void testScale() {
     float i[] = {1.0f, 2.0f, 3.0f, 4.0f};
     float o[4];
@@ -344,6 +834,41 @@ void testTopk() {
     printPassed("testTopk");
 }
 
+void testTopkForward() {
+    const NnUint batchSize = 2;
+    const NnUint dim = 6;
+    const NnUint k = 3;
+    float x[batchSize * dim] = {
+        0.1f, 0.9f, -0.3f, 0.5f, 0.7f, 0.0f,
+        -1.0f, -2.0f, 3.0f, 0.2f, -0.5f, 2.5f,
+    };
+    float y[batchSize * 2 * k];
+
+    NnByte *input[] = { (NnByte *)&x[0], (NnByte *)&x[dim] };
+    NnByte *output[] = { (NnByte *)&y[0], (NnByte *)&y[2 * k] };
+    NnTopkOpCodeConfig config{k, 100u};
+
+    NnCpuOpContext context;
+    std::memset(&context, 0, sizeof(context));
+    context.name = "topk";
+    context.nBatches = batchSize;
+    context.opConfig = &config;
+    context.input = input;
+    context.inputSize = size2D(F_32, batchSize, dim);
+    context.output = output;
+    context.outputSize = size2D(F_32, batchSize, 2 * k);
+
+    initTopkForward(&context);
+    topkForward_F32_F32(2, 0, batchSize, &context);
+    topkForward_F32_F32(2, 1, batchSize, &context);
+
+    const float expectedY[batchSize * 2 * k] = {
+        101.0f, 0.9f, 104.0f, 0.7f, 103.0f, 0.5f,
+        102.0f, 3.0f, 105.0f, 2.5f, 103.0f, 0.2f,
+    };
+    compare_F32("topkForward_F32_F32", y, expectedY, batchSize * 2 * k, 0.00001f);
+}
+
 int main() {
     initQuants();
 
@@ -367,8 +892,30 @@ int main() {
     testMatmul_F32_Q40_F32(32);
     testMatmul_F32_Q40_F32(2);
     testMatmul_F32_Q40_F32(1);
+    testMatmul_Q80_Q80_F32(1, 1);
+    testMatmul_Q80_Q80_F32(8, 3);
+    testMatmul_Q80_K<NnBlockQ4K>("matmul_Q80_Q4K_F32", 512, 12, quantizeF32toQ4K, dequantizeQ4KtoF32, matmul_Q80_Q4K_F32, 0.01f);
+    testMatmul_Q80_K<NnBlockQ6K>("matmul_Q80_Q6K_F32", 512, 12, quantizeF32toQ6K, dequantizeQ6KtoF32, matmul_Q80_Q6K_F32, 0.003f);
+    testMatmul_F16(72, 24);
+    testMatmul_F16(256, 16);
+    testEmbedding_F16();
     testLlamafileSgemm();
+    testMatmulQkv_F32_F32_F32(1, 1);
+    testMatmulQkv_F32_F32_F32(1, 3);
+    testMatmulQkv_F32_F32_F32(4, 2);
+    testMatmulQkv_Q80_Q40_F32(1, 3);
+    testMatmulQkv_Q80_Q40_F32(4, 2);
+    testRopeKv_F32_F32(ROPE_LLAMA, 1);
+    testRopeKv_F32_F32(ROPE_LLAMA, 3);
+    testRopeKv_F32_F32(ROPE_FALCON, 2);
+    testShiftRopeKeys(ROPE_LLAMA);
+    testShiftRopeKeys(ROPE_LLAMA3_1);
+    testShiftRopeKeys(ROPE_FALCON);
+    testMultiHeadAtt_F32_F32(1);
+    testMultiHeadAtt_F32_F32(3);
+    testShift_F32_F32();
     testScale();
     testTopk();
+    testTopkForward();
     return 0;
 }
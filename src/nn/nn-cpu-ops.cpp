@@ -65,9 +65,28 @@ static inline float32x4_t expf_neon(float32x4_t x) {
     float32x4_t two_k = vreinterpretq_f32_s32(pow2k);
     return vmulq_f32(p, two_k);
 }
+
+static inline int32x4_t dotS8_neon(const int32x4_t acc, const int8x16_t a, const int8x16_t b) {
+#if defined(__ARM_FEATURE_DOTPROD)
+    return vdotq_s32(acc, a, b);
+#else
+    const int32x4_t lo = vpaddlq_s16(vmull_s8(vget_low_s8(a), vget_low_s8(b)));
+    const int32x4_t hi = vpaddlq_s16(vmull_s8(vget_high_s8(a), vget_high_s8(b)));
+    return vaddq_s32(acc, vaddq_s32(lo, hi));
+#endif
+}
 #endif
 
 #if defined(__AVX2__)
+// Multiplies unsigned bytes of u by signed bytes of s, lane i holds the sum of bytes 4i..4i+3
+static inline __m256i dotU8S8_avx2(const __m256i u, const __m256i s) {
+#if defined(__AVX512VNNI__) && defined(__AVX512VL__)
+    return _mm256_dpbusd_epi32(_mm256_setzero_si256(), u, s);
+#else
+    return _mm256_madd_epi16(_mm256_maddubs_epi16(u, s), _mm256_set1_epi16(1));
+#endif
+}
+
 static inline float horizontalSum_avx2(const __m256 x) {
     __m128 res = _mm256_extractf128_ps(x, 1);
     res = _mm_add_ps(res, _mm256_castps256_ps128(x));
@@ -228,6 +247,300 @@ static void matmul_F32_F32_F32(float *output, const float *x, const float *w, co
 #endif
 }
 
+static void matmul_Q80_Q80_F32(float *output, const NnBlockQ80 *x, const NnBlockQ80 *w, const NnUint n, const NnUint d, const NnUint nThreads, const NnUint threadIndex) {
+    SPLIT_THREADS(start, end, d, nThreads, threadIndex);
+    assert(n % Q80_BLOCK_SIZE == 0);
+    const NnUint nBlocks = n / Q80_BLOCK_SIZE;
+
+#if defined(__ARM_NEON)
+    for (NnUint i = start; i < end; i++) {
+        float32x4_t sumv = vmovq_n_f32(0.0f);
+        for (NnUint j = 0; j < nBlocks; j++) {
+            const NnBlockQ80 *wb = &w[i * nBlocks + j];
+            const NnBlockQ80 *xb = &x[j];
+            const int8x16_t w0 = vld1q_s8(wb->qs);
+            const int8x16_t w1 = vld1q_s8(wb->qs + 16);
+            const int8x16_t x0 = vld1q_s8(xb->qs);
+            const int8x16_t x1 = vld1q_s8(xb->qs + 16);
+            const int32x4_t p = dotS8_neon(dotS8_neon(vdupq_n_s32(0), w0, x0), w1, x1);
+            sumv = vmlaq_n_f32(sumv, vcvtq_f32_s32(p), CONVERT_F16_TO_F32(wb->d) * CONVERT_F16_TO_F32(xb->d));
+        }
+        output[i] = vaddvq_f32(sumv);
+    }
+#elif defined(__AVX2__)
+    for (NnUint i = start; i < end; i++) {
+        __m256 acc = _mm256_setzero_ps();
+        for (NnUint j = 0; j < nBlocks; j++) {
+            const NnBlockQ80 *wb = &w[i * nBlocks + j];
+            const NnBlockQ80 *xb = &x[j];
+            const __m256i qw = _mm256_loadu_si256((const __m256i *)wb->qs);
+            const __m256i qx = _mm256_loadu_si256((const __m256i *)xb->qs);
+            // The unsigned x signed multiply needs |x| and w with the sign of x
+            const __m256i ax = _mm256_sign_epi8(qx, qx);
+            const __m256i sw = _mm256_sign_epi8(qw, qx);
+            const __m256i p = dotU8S8_avx2(ax, sw);
+            const float s = CONVERT_F16_TO_F32(wb->d) * CONVERT_F16_TO_F32(xb->d);
+            acc = _mm256_fmadd_ps(_mm256_cvtepi32_ps(p), _mm256_set1_ps(s), acc);
+        }
+        output[i] = horizontalSum_avx2(acc);
+    }
+#else
+    for (NnUint i = start; i < end; i++) {
+        float sum = 0.0f;
+        for (NnUint j = 0; j < nBlocks; j++) {
+            const NnBlockQ80 *wb = &w[i * nBlocks + j];
+            const NnBlockQ80 *xb = &x[j];
+            int p = 0;
+            for (NnUint k = 0; k < Q80_BLOCK_SIZE; k++)
+                p += wb->qs[k] * xb->qs[k];
+            sum += p * CONVERT_F16_TO_F32(wb->d) * CONVERT_F16_TO_F32(xb->d);
+        }
+        output[i] = sum;
+    }
+#endif
+}
+
+static void matmul_Q80_Q4K_F32(float *output, const NnBlockQ80 *x, const NnBlockQ4K *w, const NnUint n, const NnUint d, const NnUint nThreads, const NnUint threadIndex) {
+    SPLIT_THREADS(start, end, d, nThreads, threadIndex);
+    assert(n % Q4K_BLOCK_SIZE == 0);
+    const NnUint nBlocks = n / Q4K_BLOCK_SIZE;
+    const NnUint nSubBlocks = Q4K_BLOCK_SIZE / Q80_BLOCK_SIZE;
+
+    // Each sub-block matches one Q80 block: d * sc * sum(q * x) - dmin * m * sum(x)
+    for (NnUint i = start; i < end; i++) {
+#if defined(__ARM_NEON)
+        float32x4_t sumv = vmovq_n_f32(0.0f);
+        const uint8x16_t m4b = vdupq_n_u8(0x0F);
+#elif defined(__AVX2__)
+        __m256 acc = _mm256_setzero_ps();
+        const __m256i m4b = _mm256_set1_epi8(0x0F);
+        const __m256i ones = _mm256_set1_epi8(1);
+#else
+        float sum = 0.0f;
+#endif
+        for (NnUint j = 0; j < nBlocks; j++) {
+            const NnBlockQ4K *wb = &w[i * nBlocks + j];
+            const float wd = CONVERT_F16_TO_F32(wb->d);
+            const float wdmin = CONVERT_F16_TO_F32(wb->dmin);
+            for (NnUint b = 0; b < nSubBlocks; b++) {
+                const NnBlockQ80 *xb = &x[j * nSubBlocks + b];
+                const std::uint8_t *qs = &wb->qs[(b / 2) * 32];
+                const NnUint shift = 4 * (b % 2);
+                std::uint8_t sc, m;
+                getScaleMinQ4K(b, wb->scales, &sc, &m);
+                const float xd = CONVERT_F16_TO_F32(xb->d);
+#if defined(__ARM_NEON)
+                const uint8x16_t r0 = vld1q_u8(qs);
+                const uint8x16_t r1 = vld1q_u8(qs + 16);
+                const int8x16_t w0 = vreinterpretq_s8_u8(vandq_u8(shift ? vshrq_n_u8(r0, 4) : r0, m4b));
+                const int8x16_t w1 = vreinterpretq_s8_u8(vandq_u8(shift ? vshrq_n_u8(r1, 4) : r1, m4b));
+                const int8x16_t x0 = vld1q_s8(xb->qs);
+                const int8x16_t x1 = vld1q_s8(xb->qs + 16);
+                const int32x4_t p = dotS8_neon(dotS8_neon(vdupq_n_s32(0), w0, x0), w1, x1);
+                const int32x4_t sx = vaddq_s32(vpaddlq_s16(vpaddlq_s8(x0)), vpaddlq_s16(vpaddlq_s8(x1)));
+                sumv = vmlaq_n_f32(sumv, vcvtq_f32_s32(p), wd * sc * xd);
+                sumv = vmlsq_n_f32(sumv, vcvtq_f32_s32(sx), wdmin * m * xd);
+#elif defined(__AVX2__)
+                const __m256i r = _mm256_loadu_si256((const __m256i *)qs);
+                const __m256i qw = _mm256_and_si256(shift ? _mm256_srli_epi16(r, 4) : r, m4b);
+                const __m256i qx = _mm256_loadu_si256((const __m256i *)xb->qs);
+                const __m256i p = dotU8S8_avx2(qw, qx);
+                const __m256i sx = dotU8S8_avx2(ones, qx);
+                acc = _mm256_fmadd_ps(_mm256_cvtepi32_ps(p), _mm256_set1_ps(wd * sc * xd), acc);
+                acc = _mm256_fnmadd_ps(_mm256_cvtepi32_ps(sx), _mm256_set1_ps(wdmin * m * xd), acc);
+#else
+                int p = 0;
+                int sx = 0;
+                for (NnUint k = 0; k < Q80_BLOCK_SIZE; k++) {
+                    p += ((qs[k] >> shift) & 0xF) * xb->qs[k];
+                    sx += xb->qs[k];
+                }
+                sum += (wd * sc * p - wdmin * m * sx) * xd;
+#endif
+            }
+        }
+#if defined(__ARM_NEON)
+        output[i] = vaddvq_f32(sumv);
+#elif defined(__AVX2__)
+        output[i] = horizontalSum_avx2(acc);
+#else
+        output[i] = sum;
+#endif
+    }
+}
+
+static void matmul_Q80_Q6K_F32(float *output, const NnBlockQ80 *x, const NnBlockQ6K *w, const NnUint n, const NnUint d, const NnUint nThreads, const NnUint threadIndex) {
+    SPLIT_THREADS(start, end, d, nThreads, threadIndex);
+    assert(n % Q6K_BLOCK_SIZE == 0);
+    const NnUint nBlocks = n / Q6K_BLOCK_SIZE;
+    const NnUint nSubBlocks = Q6K_BLOCK_SIZE / Q80_BLOCK_SIZE;
+
+    // Each Q80 block covers two 16-value scales of the super-block
+    for (NnUint i = start; i < end; i++) {
+#if defined(__ARM_NEON)
+        float sum = 0.0f;
+        const uint8x16_t m4b = vdupq_n_u8(0x0F);
+        const uint8x16_t m2b = vdupq_n_u8(0x03);
+        const int8x16_t s32b = vdupq_n_s8(32);
+#elif defined(__AVX2__)
+        __m256 acc = _mm256_setzero_ps();
+        const __m256i m4b = _mm256_set1_epi8(0x0F);
+        const __m256i m2b = _mm256_set1_epi8(0x03);
+        const __m256i ones = _mm256_set1_epi8(1);
+#else
+        float sum = 0.0f;
+#endif
+        for (NnUint j = 0; j < nBlocks; j++) {
+            const NnBlockQ6K *wb = &w[i * nBlocks + j];
+            const float wd = CONVERT_F16_TO_F32(wb->d);
+            for (NnUint b = 0; b < nSubBlocks; b++) {
+                const NnBlockQ80 *xb = &x[j * nSubBlocks + b];
+                const std::uint8_t *ql = &wb->ql[(b % 4) * 32];
+                const std::uint8_t *qh = &wb->qh[(b % 2) * 32];
+                const NnUint lowShift = 4 * (b / 4);
+                const NnUint highShift = 2 * (b / 2);
+                const float s0 = wb->scales[2 * b];
+                const float s1 = wb->scales[2 * b + 1];
+                const float xd = CONVERT_F16_TO_F32(xb->d);
+#if defined(__ARM_NEON)
+                const int8x16_t hs = vdupq_n_s8(-(int8_t)highShift);
+                const uint8x16_t l0 = vld1q_u8(ql);
+                const uint8x16_t l1 = vld1q_u8(ql + 16);
+                const uint8x16_t h0 = vandq_u8(vshlq_u8(vld1q_u8(qh), hs), m2b);
+                const uint8x16_t h1 = vandq_u8(vshlq_u8(vld1q_u8(qh + 16), hs), m2b);
+                const uint8x16_t q0 = vorrq_u8(vandq_u8(lowShift ? vshrq_n_u8(l0, 4) : l0, m4b), vshlq_n_u8(h0, 4));
+                const uint8x16_t q1 = vorrq_u8(vandq_u8(lowShift ? vshrq_n_u8(l1, 4) : l1, m4b), vshlq_n_u8(h1, 4));
+                const int8x16_t w0 = vsubq_s8(vreinterpretq_s8_u8(q0), s32b);
+                const int8x16_t w1 = vsubq_s8(vreinterpretq_s8_u8(q1), s32b);
+                const int32_t p0 = vaddvq_s32(dotS8_neon(vdupq_n_s32(0), w0, vld1q_s8(xb->qs)));
+                const int32_t p1 = vaddvq_s32(dotS8_neon(vdupq_n_s32(0), w1, vld1q_s8(xb->qs + 16)));
+                sum += (s0 * p0 + s1 * p1) * wd * xd;
+#elif defined(__AVX2__)
+                const __m256i l = _mm256_loadu_si256((const __m256i *)ql);
+                const __m256i h = _mm256_loadu_si256((const __m256i *)qh);
+                const __m256i lowBits = _mm256_and_si256(lowShift ? _mm256_srli_epi16(l, 4) : l, m4b);
+                const __m256i highBits = _mm256_and_si256(_mm256_srl_epi16(h, _mm_cvtsi32_si128(highShift)), m2b);
+                const __m256i qw = _mm256_or_si256(lowBits, _mm256_slli_epi16(highBits, 4));
+                const __m256i qx = _mm256_loadu_si256((const __m256i *)xb->qs);
+                // sum((q - 32) * x) = sum(q * x) - 32 * sum(x)
+                const __m256i p = _mm256_sub_epi32(dotU8S8_avx2(qw, qx), _mm256_slli_epi32(dotU8S8_avx2(ones, qx), 5));
+                const __m256 scales = _mm256_setr_ps(s0, s0, s0, s0, s1, s1, s1, s1);
+                acc = _mm256_fmadd_ps(_mm256_cvtepi32_ps(p), _mm256_mul_ps(scales, _mm256_set1_ps(wd * xd)), acc);
+#else
+                int p0 = 0;
+                int p1 = 0;
+                for (NnUint k = 0; k < Q80_BLOCK_SIZE; k++) {
+                    const int q = (((ql[k] >> lowShift) & 0xF) | (((qh[k] >> highShift) & 3) << 4)) - 32;
+                    if (k < 16) p0 += q * xb->qs[k];
+                    else p1 += q * xb->qs[k];
+                }
+                sum += (s0 * p0 + s1 * p1) * wd * xd;
+#endif
+            }
+        }
+#if defined(__ARM_NEON)
+        output[i] = sum;
+#elif defined(__AVX2__)
+        output[i] = horizontalSum_avx2(acc);
+#else
+        output[i] = sum;
+#endif
+    }
+}
+
+static void matmul_F32_F16_F32(float *output, const float *x, const NnFp16 *w, const NnUint n, const NnUint d, const NnUint nThreads, const NnUint threadIndex) {
+    SPLIT_THREADS(start, end, d, nThreads, threadIndex);
+    unsigned int i, j;
+    for (i = start; i < end; i++) {
+        const NnFp16 *r = &w[i * n];
+        float val = 0.0f;
+        j = 0;
+#if defined(__ARM_NEON) && defined(__ARM_FP16_FORMAT_IEEE)
+        float32x4_t z = vmovq_n_f32(0);
+        for (; j + 4 <= n; j += 4)
+            z = vfmaq_f32(z, vld1q_f32(&x[j]), vcvt_f32_f16(vld1_f16((const float16_t *)&r[j])));
+        val = vaddvq_f32(z);
+#elif defined(__AVX512F__)
+        __m512 u = _mm512_setzero_ps();
+        for (; j + 16 <= n; j += 16)
+            u = _mm512_fmadd_ps(_mm512_loadu_ps(&x[j]), _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *)&r[j])), u);
+        val = _mm512_reduce_add_ps(u);
+#elif defined(__AVX2__) && defined(__F16C__)
+        __m256 u = _mm256_setzero_ps();
+        for (; j + 8 <= n; j += 8)
+            u = _mm256_fmadd_ps(_mm256_loadu_ps(&x[j]), _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)&r[j])), u);
+        val = horizontalSum_avx2(u);
+#endif
+        for (; j < n; j++)
+            val += CONVERT_F16_TO_F32(r[j]) * x[j];
+        output[i] = val;
+    }
+}
+
+static void matmul_Q80_F16_F32(float *output, const NnBlockQ80 *x, const NnFp16 *w, const NnUint n, const NnUint d, const NnUint nThreads, const NnUint threadIndex) {
+    SPLIT_THREADS(start, end, d, nThreads, threadIndex);
+    assert(n % Q80_BLOCK_SIZE == 0);
+    const NnUint nBlocks = n / Q80_BLOCK_SIZE;
+
+    // Activations stay quantized, each block is widened to floats and scaled once after the dot product
+    for (NnUint i = start; i < end; i++) {
+        const NnFp16 *r = &w[i * n];
+#if defined(__ARM_NEON) && defined(__ARM_FP16_FORMAT_IEEE)
+        float32x4_t sumv = vmovq_n_f32(0.0f);
+        for (NnUint j = 0; j < nBlocks; j++) {
+            const NnBlockQ80 *b = &x[j];
+            const NnFp16 *rb = &r[j * Q80_BLOCK_SIZE];
+            float32x4_t p = vmovq_n_f32(0.0f);
+            for (NnUint k = 0; k < Q80_BLOCK_SIZE; k += 8) {
+                const int16x8_t q = vmovl_s8(vld1_s8(&b->qs[k]));
+                p = vfmaq_f32(p, vcvtq_f32_s32(vmovl_s16(vget_low_s16(q))), vcvt_f32_f16(vld1_f16((const float16_t *)&rb[k])));
+                p = vfmaq_f32(p, vcvtq_f32_s32(vmovl_s16(vget_high_s16(q))), vcvt_f32_f16(vld1_f16((const float16_t *)&rb[k + 4])));
+            }
+            sumv = vmlaq_n_f32(sumv, p, CONVERT_F16_TO_F32(b->d));
+        }
+        output[i] = vaddvq_f32(sumv);
+#elif defined(__AVX512F__)
+        __m512 acc = _mm512_setzero_ps();
+        for (NnUint j = 0; j < nBlocks; j++) {
+            const NnBlockQ80 *b = &x[j];
+            const NnFp16 *rb = &r[j * Q80_BLOCK_SIZE];
+            const __m512 x0 = _mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(_mm_loadu_si128((const __m128i *)b->qs)));
+            const __m512 x1 = _mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(_mm_loadu_si128((const __m128i *)(b->qs + 16))));
+            const __m512 w0 = _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *)rb));
+            const __m512 w1 = _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *)(rb + 16)));
+            const __m512 p = _mm512_fmadd_ps(x1, w1, _mm512_mul_ps(x0, w0));
+            acc = _mm512_fmadd_ps(p, _mm512_set1_ps(CONVERT_F16_TO_F32(b->d)), acc);
+        }
+        output[i] = _mm512_reduce_add_ps(acc);
+#elif defined(__AVX2__) && defined(__F16C__)
+        __m256 acc = _mm256_setzero_ps();
+        for (NnUint j = 0; j < nBlocks; j++) {
+            const NnBlockQ80 *b = &x[j];
+            const NnFp16 *rb = &r[j * Q80_BLOCK_SIZE];
+            __m256 p = _mm256_setzero_ps();
+            for (NnUint k = 0; k < Q80_BLOCK_SIZE; k += 8) {
+                const __m256 xk = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i *)&b->qs[k])));
+                const __m256 wk = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)&rb[k]));
+                p = _mm256_fmadd_ps(xk, wk, p);
+            }
+            acc = _mm256_fmadd_ps(p, _mm256_set1_ps(CONVERT_F16_TO_F32(b->d)), acc);
+        }
+        output[i] = horizontalSum_avx2(acc);
+#else
+        float val = 0.0f;
+        for (NnUint j = 0; j < nBlocks; j++) {
+            const NnBlockQ80 *b = &x[j];
+            const NnFp16 *rb = &r[j * Q80_BLOCK_SIZE];
+            float p = 0.0f;
+            for (NnUint k = 0; k < Q80_BLOCK_SIZE; k++)
+                p += CONVERT_F16_TO_F32(rb[k]) * (float)b->qs[k];
+            val += p * CONVERT_F16_TO_F32(b->d);
+        }
+        output[i] = val;
+#endif
+    }
+}
+
 static void matmul_Q80_Q40_F32(float *output, const NnBlockQ80 *x, const NnBlockQ40 *w, const NnUint n, const NnUint d, const NnUint nThreads, const NnUint threadIndex) {
     SPLIT_THREADS(start, end, d, nThreads, threadIndex);
     assert(n % Q40_BLOCK_SIZE == 0);
@@ -593,8 +906,12 @@ static void add_Q80_F32(float *y, const NnBlockQ80 *x, const NnUint n, const NnU
 }
 
 void softmax_F32(float *x, const NnUint size) {
+    softmaxScaled_F32(x, size, 1.0f);
+}
+
+float softmaxScaled_F32(float *x, const NnUint size, const float scale) {
     if (size == 0)
-        return;
+        return 0.0f;
 
 #if defined(__ARM_NEON)
     NnUint j;
@@ -616,11 +933,12 @@ void softmax_F32(float *x, const NnUint size) {
         maxVal = fmaxf(maxVal, x[j]);
 
     const float32x4_t maxVal_vec = vdupq_n_f32(maxVal);
+    const float32x4_t scale_vec = vdupq_n_f32(scale);
     float32x4_t sumv = vdupq_n_f32(0.0f);
     NnUint i = 0;
     for (; i + 4 <= size; i += 4) {
         float32x4_t val = vld1q_f32(x + i);
-        val = vsubq_f32(val, maxVal_vec);
+        val = vmulq_f32(vsubq_f32(val, maxVal_vec), scale_vec);
         val = expf_neon(val);
         vst1q_f32(x + i, val);
         sumv = vaddq_f32(sumv, val);
@@ -630,7 +948,7 @@ void softmax_F32(float *x, const NnUint size) {
     float sum = vget_lane_f32(sum_lo, 0) + vget_lane_f32(sum_lo, 1);
 
     for (; i < size; i++) {
-        x[i] = expf(x[i] - maxVal);
+        x[i] = expf((x[i] - maxVal) * scale);
         sum += x[i];
     }
 
@@ -671,19 +989,20 @@ void softmax_F32(float *x, const NnUint size) {
     }
 
     __m256 max_val_vec = _mm256_set1_ps(maxVal);
+    __m256 scale_vec = _mm256_set1_ps(scale);
     __m256 sum_vec = _mm256_setzero_ps();
     float sum = 0.0f;
     i = 0;
     for (; i < avxEnd; i += 8) {
         __m256 vec = _mm256_loadu_ps(&x[i]);
-        vec = _mm256_sub_ps(vec, max_val_vec);
+        vec = _mm256_mul_ps(_mm256_sub_ps(vec, max_val_vec), scale_vec);
         vec = expf_avx2(vec);
         _mm256_storeu_ps(&x[i], vec);
         sum_vec = _mm256_add_ps(sum_vec, vec);
     }
     sum = horizontalSum_avx2(sum_vec);
     for (; i < size; ++i) {
-        x[i] = expf(x[i] - maxVal);
+        x[i] = expf((x[i] - maxVal) * scale);
         sum += x[i];
     }
 
@@ -709,7 +1028,7 @@ void softmax_F32(float *x, const NnUint size) {
     }
     float sum = 0.0f;
     for (NnUint i = 0; i < size; i++) {
-        x[i] = expf(x[i] - maxVal);
+        x[i] = expf((x[i] - maxVal) * scale);
         sum += x[i];
     }
     if (sum == 0.0)
@@ -717,6 +1036,7 @@ void softmax_F32(float *x, const NnUint size) {
     for (NnUint i = 0; i < size; i++)
         x[i] /= sum;
 #endif
+    return sum;
 }
 
 static float dotProduct_F32(const float *a, const float *b, const unsigned int size) {
@@ -840,7 +1160,7 @@ static void copy_UNK(NnByte *output, const NnByte *x, NnSize size, const NnUint
 }
 
 
-static void ropeLlama_F32(float* x, const float *cache, bool isQ, const NnUint pos, const NnRopeSlice *slice, const NnUint nThreads, const NnUint threadIndex) {
+static void ropeLlama_F32(float *y, const float *x, const float *cache, bool isQ, const NnUint pos, const NnRopeSlice *slice, const NnUint nThreads, const NnUint threadIndex) {
     const NnUint dim0Half = (isQ ? slice->qDim0 : slice->kvDim0) / 2;
     const NnUint shift = isQ ? slice->qShift : 0;
     SPLIT_THREADS(s, e, dim0Half, nThreads, threadIndex);
@@ -857,12 +1177,12 @@ static void ropeLlama_F32(float* x, const float *cache, bool isQ, const NnUint p
 
         float x0 = v0 * fcr - v1 * fci;
         float x1 = v0 * fci + v1 * fcr;
-        x[i] = x0;
-        x[i + 1] = x1;
+        y[i] = x0;
+        y[i + 1] = x1;
     }
 }
 
-static void ropeFalcon_F32(float* x, const float *cache, bool isQ, const NnUint pos, const NnRopeSlice *slice, const NnUint nThreads, const NnUint threadIndex) {
+static void ropeFalcon_F32(float *y, const float *x, const float *cache, bool isQ, const NnUint pos, const NnRopeSlice *slice, const NnUint nThreads, const NnUint threadIndex) {
     unsigned int dim0 =  isQ ? slice->qDim0 : slice->kvDim0;
     assert(dim0 % slice->headDim == 0);
     unsigned int nHeads0 = dim0 / slice->headDim;
@@ -878,8 +1198,8 @@ static void ropeFalcon_F32(float* x, const float *cache, bool isQ, const NnUint
 
             float q0 = x[o + j];
             float q1 = x[o + j + slice->headDim / 2];
-            x[o + j] = q0 * fcr0 - q1 * fci0;
-            x[o + j + slice->headDim / 2] = q0 * fci0 + q1 * fcr0;
+            y[o + j] = q0 * fcr0 - q1 * fci0;
+            y[o + j + slice->headDim / 2] = q0 * fci0 + q1 * fcr0;
         }
     }
 }
@@ -905,7 +1225,7 @@ static void topk_F32(const float *x, NnUint *y, NnSize size, NnUint k) {
     for (NnSize i = 0u; i < size; i++)
         items[i] = i;
 
-    std::sort(items.begin(), items.end(),
+    std::partial_sort(items.begin(), items.begin() + k, items.end(),
         [&x](int a, int b) {
             return x[a] > x[b];
         }
@@ -1007,6 +1327,19 @@ static void embeddingForward_F32_F32_Q80(NnUint nThreads, NnUint threadIndex, Nn
     }
 }
 
+static void embeddingForward_F32_F16_F32(NnUint nThreads, NnUint threadIndex, NnUint batchSize, NnCpuOpContext *context) {
+    const NnUint dim = context->outputSize.x;
+    SPLIT_THREADS(start, end, dim, nThreads, threadIndex);
+
+    for (NnUint batchIndex = 0; batchIndex < batchSize; batchIndex++) {
+        NnUint token = (NnUint)*((float *)context->input[batchIndex]);
+        const NnFp16 *row = &((NnFp16 *)context->weight)[token * dim];
+        float *output = (float *)context->output[batchIndex];
+        for (NnUint i = start; i < end; i++)
+            output[i] = CONVERT_F16_TO_F32(row[i]);
+    }
+}
+
 static void initInvRmsForward(NnCpuOpContext *context) {
     NnRmsNormOpConfig *config = (NnRmsNormOpConfig *)context->opConfig;
     assert(context->outputSize.x >= config->nColumns);
@@ -1191,6 +1524,382 @@ static void matmulForward_Q80_Q40_F32(NnUint nThreads, NnUint threadIndex, NnUin
     }
 }
 
+static void matmulForward_Q80_Q80_F32(NnUint nThreads, NnUint threadIndex, NnUint batchSize, NnCpuOpContext *context) {
+    if (matmulForward_llamafile(nThreads, threadIndex, batchSize, context))
+        return;
+
+    const NnMatmulOpConfig *config = (NnMatmulOpConfig *)context->opConfig;
+    const NnUint nActiveExpertsOr1 = std::max(config->nActiveExperts, 1u);
+    const float *activeExpertIndexes = (const float *)context->buffers[config->activeExpertIndexesBufferIndex];
+
+    for (NnUint y = 0; y < batchSize; y++) {
+        for (NnUint e = 0; e < nActiveExpertsOr1; e++) {
+            const NnUint activeExpertIndex = config->nActiveExperts == 0u
+                ? 0u
+                : (NnUint)activeExpertIndexes[y * config->nActiveExperts + e];
+
+            float *output = (float *)context->output[e * context->outputSize.y + y];
+            matmul_Q80_Q80_F32(
+                output,
+                (NnBlockQ80 *)context->input[e * context->inputSize.y + y],
+                (NnBlockQ80 *)&context->weight[activeExpertIndex * context->weightSize.nBytesXY],
+                context->weightSize.y,
+                context->weightSize.x,
+                nThreads,
+                threadIndex);
+            DEBUG_VECTOR(context, "output", output);
+        }
+    }
+}
+
+static void matmulForward_Q80_Q4K_F32(NnUint nThreads, NnUint threadIndex, NnUint batchSize, NnCpuOpContext *context) {
+    if (matmulForward_llamafile(nThreads, threadIndex, batchSize, context))
+        return;
+
+    const NnMatmulOpConfig *config = (NnMatmulOpConfig *)context->opConfig;
+    const NnUint nActiveExpertsOr1 = std::max(config->nActiveExperts, 1u);
+    const float *activeExpertIndexes = (const float *)context->buffers[config->activeExpertIndexesBufferIndex];
+
+    for (NnUint y = 0; y < batchSize; y++) {
+        for (NnUint e = 0; e < nActiveExpertsOr1; e++) {
+            const NnUint activeExpertIndex = config->nActiveExperts == 0u
+                ? 0u
+                : (NnUint)activeExpertIndexes[y * config->nActiveExperts + e];
+
+            float *output = (float *)context->output[e * context->outputSize.y + y];
+            matmul_Q80_Q4K_F32(
+                output,
+                (NnBlockQ80 *)context->input[e * context->inputSize.y + y],
+                (NnBlockQ4K *)&context->weight[activeExpertIndex * context->weightSize.nBytesXY],
+                context->weightSize.y,
+                context->weightSize.x,
+                nThreads,
+                threadIndex);
+            DEBUG_VECTOR(context, "output", output);
+        }
+    }
+}
+
+static void matmulForward_Q80_Q6K_F32(NnUint nThreads, NnUint threadIndex, NnUint batchSize, NnCpuOpContext *context) {
+    if (matmulForward_llamafile(nThreads, threadIndex, batchSize, context))
+        return;
+
+    const NnMatmulOpConfig *config = (NnMatmulOpConfig *)context->opConfig;
+    const NnUint nActiveExpertsOr1 = std::max(config->nActiveExperts, 1u);
+    const float *activeExpertIndexes = (const float *)context->buffers[config->activeExpertIndexesBufferIndex];
+
+    for (NnUint y = 0; y < batchSize; y++) {
+        for (NnUint e = 0; e < nActiveExpertsOr1; e++) {
+            const NnUint activeExpertIndex = config->nActiveExperts == 0u
+                ? 0u
+                : (NnUint)activeExpertIndexes[y * config->nActiveExperts + e];
+
+            float *output = (float *)context->output[e * context->outputSize.y + y];
+            matmul_Q80_Q6K_F32(
+                output,
+                (NnBlockQ80 *)context->input[e * context->inputSize.y + y],
+                (NnBlockQ6K *)&context->weight[activeExpertIndex * context->weightSize.nBytesXY],
+                context->weightSize.y,
+                context->weightSize.x,
+                nThreads,
+                threadIndex);
+            DEBUG_VECTOR(context, "output", output);
+        }
+    }
+}
+
+static void matmulForward_F32_F16_F32(NnUint nThreads, NnUint threadIndex, NnUint batchSize, NnCpuOpContext *context) {
+    if (matmulForward_llamafile(nThreads, threadIndex, batchSize, context))
+        return;
+
+    const NnMatmulOpConfig *config = (NnMatmulOpConfig *)context->opConfig;
+    const NnUint nActiveExpertsOr1 = std::max(config->nActiveExperts, 1u);
+    const float *activeExpertIndexes = (const float *)context->buffers[config->activeExpertIndexesBufferIndex];
+
+    for (NnUint y = 0; y < batchSize; y++) {
+        for (NnUint e = 0; e < nActiveExpertsOr1; e++) {
+            const NnUint activeExpertIndex = config->nActiveExperts == 0u
+                ? 0u
+                : (NnUint)activeExpertIndexes[y * config->nActiveExperts + e];
+
+            float *output = (float *)context->output[e * context->outputSize.y + y];
+            matmul_F32_F16_F32(
+                output,
+                (float *)context->input[e * context->inputSize.y + y],
+                (NnFp16 *)&context->weight[activeExpertIndex * context->weightSize.nBytesXY],
+                context->weightSize.y,
+                context->weightSize.x,
+                nThreads,
+                threadIndex);
+            DEBUG_VECTOR(context, "output", output);
+        }
+    }
+}
+
+static void matmulForward_Q80_F16_F32(NnUint nThreads, NnUint threadIndex, NnUint batchSize, NnCpuOpContext *context) {
+    if (matmulForward_llamafile(nThreads, threadIndex, batchSize, context))
+        return;
+
+    const NnMatmulOpConfig *config = (NnMatmulOpConfig *)context->opConfig;
+    const NnUint nActiveExpertsOr1 = std::max(config->nActiveExperts, 1u);
+    const float *activeExpertIndexes = (const float *)context->buffers[config->activeExpertIndexesBufferIndex];
+
+    for (NnUint y = 0; y < batchSize; y++) {
+        for (NnUint e = 0; e < nActiveExpertsOr1; e++) {
+            const NnUint activeExpertIndex = config->nActiveExperts == 0u
+                ? 0u
+                : (NnUint)activeExpertIndexes[y * config->nActiveExperts + e];
+
+            float *output = (float *)context->output[e * context->outputSize.y + y];
+            matmul_Q80_F16_F32(
+                output,
+                (NnBlockQ80 *)context->input[e * context->inputSize.y + y],
+                (NnFp16 *)&context->weight[activeExpertIndex * context->weightSize.nBytesXY],
+                context->weightSize.y,
+                context->weightSize.x,
+                nThreads,
+                threadIndex);
+            DEBUG_VECTOR(context, "output", output);
+        }
+    }
+}
+
+static void initMatmulQkvForward(NnCpuOpContext *context) {
+    const NnMatmulQkvOpConfig *config = (NnMatmulQkvOpConfig *)context->opConfig;
+    ASSERT_EQ(context->inputSize.y, context->nBatches);
+    ASSERT_EQ(context->inputSize.z, 1u);
+    ASSERT_EQ(context->inputSize.x, context->weightSize.y);
+    ASSERT_EQ(context->outputSize.y, context->nBatches);
+    ASSERT_EQ(context->outputSize.x, config->qDim0);
+    ASSERT_EQ(context->weightSize.x, config->qDim0 + 2u * config->kvDim0);
+    ASSERT_EQ(context->bufferConfigs[config->kBufferIndex].size.x, config->kvDim0);
+    ASSERT_EQ(context->bufferConfigs[config->vBufferIndex].size.x, config->kvDim0);
+
+    if (!context->hasInputContinuousMemory)
+        printf("🚧 Op %s does not have contiguous memory for input\n", context->name);
+    if (!context->hasOutputContinuousMemory)
+        printf("🚧 Op %s does not have contiguous memory for output\n", context->name);
+}
+
+static void resolveMatmulQkvOutputs(NnCpuOpContext *context, NnUint batchIndex, float **outputs, NnUint *dims) {
+    const NnMatmulQkvOpConfig *config = (NnMatmulQkvOpConfig *)context->opConfig;
+    outputs[0] = (float *)context->output[batchIndex];
+    outputs[1] = &((float *)context->buffers[config->kBufferIndex])[batchIndex * config->kvDim0];
+    outputs[2] = &((float *)context->buffers[config->vBufferIndex])[batchIndex * config->kvDim0];
+    dims[0] = config->qDim0;
+    dims[1] = config->kvDim0;
+    dims[2] = config->kvDim0;
+}
+
+static bool matmulQkvForward_llamafile(NnUint nThreads, NnUint threadIndex, NnUint batchSize, NnCpuOpContext *context) {
+    if (batchSize == 1u || !context->hasInputContinuousMemory || !context->hasOutputContinuousMemory)
+        return false;
+
+    const NnUint n = context->weightSize.y / getBlockSize(context->inputSize.floatType);
+    const NnSize rowBytes = getBytes(context->weightSize.floatType, context->weightSize.y);
+    float *outputs[3];
+    NnUint dims[3];
+    resolveMatmulQkvOutputs(context, 0u, outputs, dims);
+
+    // The support of llamafile_sgemm does not depend on the number of rows, so all parts go the same path
+    NnUint offset = 0u;
+    for (NnUint p = 0u; p < 3u; p++) {
+        if (!llamafile_sgemm(
+            dims[p], batchSize, n,
+            &context->weight[offset * rowBytes], n,
+            context->input[0], n,
+            outputs[p], dims[p],
+            threadIndex, nThreads, 0,
+            context->weightSize.floatType,
+            context->inputSize.floatType,
+            F_32
+        ))
+            return false;
+        offset += dims[p];
+    }
+    return true;
+}
+
+static void matmulQkvForward_F32_F32_F32(NnUint nThreads, NnUint threadIndex, NnUint batchSize, NnCpuOpContext *context) {
+    if (matmulQkvForward_llamafile(nThreads, threadIndex, batchSize, context))
+        return;
+
+    // Rows of q, k and v are split across threads as one range, so small k/v parts do not leave threads idle
+    const NnUint n = context->weightSize.y;
+    const float *weight = (float *)context->weight;
+    SPLIT_THREADS(start, end, context->weightSize.x, nThreads, threadIndex);
+
+    float *outputs[3];
+    NnUint dims[3];
+    for (NnUint y = 0; y < batchSize; y++) {
+        const float *input = (float *)context->input[y];
+        resolveMatmulQkvOutputs(context, y, outputs, dims);
+
+        NnUint offset = 0u;
+        for (NnUint p = 0u; p < 3u; p++) {
+            const NnUint s = std::max(start, offset);
+            const NnUint e = std::min(end, offset + dims[p]);
+            if (s < e)
+                matmul_F32_F32_F32(&outputs[p][s - offset], input, &weight[s * n], n, e - s, 1u, 0u);
+            offset += dims[p];
+        }
+    }
+}
+
+static void matmulQkvForward_Q80_Q40_F32(NnUint nThreads, NnUint threadIndex, NnUint batchSize, NnCpuOpContext *context) {
+    if (matmulQkvForward_llamafile(nThreads, threadIndex, batchSize, context))
+        return;
+
+    const NnUint n = context->weightSize.y;
+    const NnUint nBlocks = n / Q40_BLOCK_SIZE;
+    const NnBlockQ40 *weight = (NnBlockQ40 *)context->weight;
+    SPLIT_THREADS(start, end, context->weightSize.x, nThreads, threadIndex);
+
+    float *outputs[3];
+    NnUint dims[3];
+    for (NnUint y = 0; y < batchSize; y++) {
+        const NnBlockQ80 *input = (NnBlockQ80 *)context->input[y];
+        resolveMatmulQkvOutputs(context, y, outputs, dims);
+
+        NnUint offset = 0u;
+        for (NnUint p = 0u; p < 3u; p++) {
+            const NnUint s = std::max(start, offset);
+            const NnUint e = std::min(end, offset + dims[p]);
+            if (s < e)
+                matmul_Q80_Q40_F32(&outputs[p][s - offset], input, &weight[s * nBlocks], n, e - s, 1u, 0u);
+            offset += dims[p];
+        }
+    }
+}
+
+static void matmulQkvForward_Q80_Q80_F32(NnUint nThreads, NnUint threadIndex, NnUint batchSize, NnCpuOpContext *context) {
+    if (matmulQkvForward_llamafile(nThreads, threadIndex, batchSize, context))
+        return;
+
+    const NnUint n = context->weightSize.y;
+    const NnUint nBlocks = n / Q80_BLOCK_SIZE;
+    const NnBlockQ80 *weight = (NnBlockQ80 *)context->weight;
+    SPLIT_THREADS(start, end, context->weightSize.x, nThreads, threadIndex);
+
+    float *outputs[3];
+    NnUint dims[3];
+    for (NnUint y = 0; y < batchSize; y++) {
+        const NnBlockQ80 *input = (NnBlockQ80 *)context->input[y];
+        resolveMatmulQkvOutputs(context, y, outputs, dims);
+
+        NnUint offset = 0u;
+        for (NnUint p = 0u; p < 3u; p++) {
+            const NnUint s = std::max(start, offset);
+            const NnUint e = std::min(end, offset + dims[p]);
+            if (s < e)
+                matmul_Q80_Q80_F32(&outputs[p][s - offset], input, &weight[s * nBlocks], n, e - s, 1u, 0u);
+            offset += dims[p];
+        }
+    }
+}
+
+static void matmulQkvForward_Q80_Q4K_F32(NnUint nThreads, NnUint threadIndex, NnUint batchSize, NnCpuOpContext *context) {
+    if (matmulQkvForward_llamafile(nThreads, threadIndex, batchSize, context))
+        return;
+
+    const NnUint n = context->weightSize.y;
+    const NnUint nBlocks = n / Q4K_BLOCK_SIZE;
+    const NnBlockQ4K *weight = (NnBlockQ4K *)context->weight;
+    SPLIT_THREADS(start, end, context->weightSize.x, nThreads, threadIndex);
+
+    float *outputs[3];
+    NnUint dims[3];
+    for (NnUint y = 0; y < batchSize; y++) {
+        const NnBlockQ80 *input = (NnBlockQ80 *)context->input[y];
+        resolveMatmulQkvOutputs(context, y, outputs, dims);
+
+        NnUint offset = 0u;
+        for (NnUint p = 0u; p < 3u; p++) {
+            const NnUint s = std::max(start, offset);
+            const NnUint e = std::min(end, offset + dims[p]);
+            if (s < e)
+                matmul_Q80_Q4K_F32(&outputs[p][s - offset], input, &weight[s * nBlocks], n, e - s, 1u, 0u);
+            offset += dims[p];
+        }
+    }
+}
+
+static void matmulQkvForward_Q80_Q6K_F32(NnUint nThreads, NnUint threadIndex, NnUint batchSize, NnCpuOpContext *context) {
+    if (matmulQkvForward_llamafile(nThreads, threadIndex, batchSize, context))
+        return;
+
+    const NnUint n = context->weightSize.y;
+    const NnUint nBlocks = n / Q6K_BLOCK_SIZE;
+    const NnBlockQ6K *weight = (NnBlockQ6K *)context->weight;
+    SPLIT_THREADS(start, end, context->weightSize.x, nThreads, threadIndex);
+
+    float *outputs[3];
+    NnUint dims[3];
+    for (NnUint y = 0; y < batchSize; y++) {
+        const NnBlockQ80 *input = (NnBlockQ80 *)context->input[y];
+        resolveMatmulQkvOutputs(context, y, outputs, dims);
+
+        NnUint offset = 0u;
+        for (NnUint p = 0u; p < 3u; p++) {
+            const NnUint s = std::max(start, offset);
+            const NnUint e = std::min(end, offset + dims[p]);
+            if (s < e)
+                matmul_Q80_Q6K_F32(&outputs[p][s - offset], input, &weight[s * nBlocks], n, e - s, 1u, 0u);
+            offset += dims[p];
+        }
+    }
+}
+
+static void matmulQkvForward_F32_F16_F32(NnUint nThreads, NnUint threadIndex, NnUint batchSize, NnCpuOpContext *context) {
+    if (matmulQkvForward_llamafile(nThreads, threadIndex, batchSize, context))
+        return;
+
+    const NnUint n = context->weightSize.y;
+    const NnFp16 *weight = (NnFp16 *)context->weight;
+    SPLIT_THREADS(start, end, context->weightSize.x, nThreads, threadIndex);
+
+    float *outputs[3];
+    NnUint dims[3];
+    for (NnUint y = 0; y < batchSize; y++) {
+        const float *input = (float *)context->input[y];
+        resolveMatmulQkvOutputs(context, y, outputs, dims);
+
+        NnUint offset = 0u;
+        for (NnUint p = 0u; p < 3u; p++) {
+            const NnUint s = std::max(start, offset);
+            const NnUint e = std::min(end, offset + dims[p]);
+            if (s < e)
+                matmul_F32_F16_F32(&outputs[p][s - offset], input, &weight[s * n], n, e - s, 1u, 0u);
+            offset += dims[p];
+        }
+    }
+}
+
+static void matmulQkvForward_Q80_F16_F32(NnUint nThreads, NnUint threadIndex, NnUint batchSize, NnCpuOpContext *context) {
+    if (matmulQkvForward_llamafile(nThreads, threadIndex, batchSize, context))
+        return;
+
+    const NnUint n = context->weightSize.y;
+    const NnFp16 *weight = (NnFp16 *)context->weight;
+    SPLIT_THREADS(start, end, context->weightSize.x, nThreads, threadIndex);
+
+    float *outputs[3];
+    NnUint dims[3];
+    for (NnUint y = 0; y < batchSize; y++) {
+        const NnBlockQ80 *input = (NnBlockQ80 *)context->input[y];
+        resolveMatmulQkvOutputs(context, y, outputs, dims);
+
+        NnUint offset = 0u;
+        for (NnUint p = 0u; p < 3u; p++) {
+            const NnUint s = std::max(start, offset);
+            const NnUint e = std::min(end, offset + dims[p]);
+            if (s < e)
+                matmul_Q80_F16_F32(&outputs[p][s - offset], input, &weight[s * n], n, e - s, 1u, 0u);
+            offset += dims[p];
+        }
+    }
+}
+
 static void siluForward_F32_F32(NnUint nThreads, NnUint threadIndex, NnUint batchSize, NnCpuOpContext *context) {
     assert(context->weightSize.nBytes == 0);
     ASSERT_EQ(context->inputSize.x, context->outputSize.x);
@@ -1236,14 +1945,78 @@ static void ropeForward_F32_F32(NnUint nThreads, NnUint threadIndex, NnUint batc
         float *x = (float *)context->input[batchIndex];
         const NnUint pos = (NnUint)positions[batchIndex];
         if (config->type == ROPE_LLAMA || config->type == ROPE_LLAMA3_1)
-            ropeLlama_F32(x, cache, isQ, pos, slice, nThreads, threadIndex);
+            ropeLlama_F32(x, x, cache, isQ, pos, slice, nThreads, threadIndex);
         else if (config->type == ROPE_FALCON)
-            ropeFalcon_F32(x, cache, isQ, pos, slice, nThreads, threadIndex);
+            ropeFalcon_F32(x, x, cache, isQ, pos, slice, nThreads, threadIndex);
         else
             throw std::runtime_error("Unsupported rope type");
     }
 }
 
+static void initRopeKvForward_F32(NnCpuOpContext *context) {
+    const NnRopeKvOpConfig *config = (NnRopeKvOpConfig *)context->opConfig;
+    const NnRopeSlice *slice = &config->rope.slice;
+    ASSERT_EQ(context->hasInputContinuousMemory, true);
+    ASSERT_EQ(context->hasOutputContinuousMemory, true);
+    ASSERT_EQ(context->inputSize.x, slice->kvDim0);
+    ASSERT_EQ(context->outputSize.x % (slice->seqLen * slice->kvDim0), 0);
+    const NnUint nSlots = context->outputSize.x / (slice->seqLen * slice->kvDim0);
+    ASSERT_EQ(context->bufferConfigs[config->queryBufferIndex].size.x, slice->qDim0);
+    ASSERT_EQ(context->bufferConfigs[config->valueBufferIndex].size.x, slice->kvDim0);
+    ASSERT_EQ(context->bufferConfigs[config->valueCacheBufferIndex].size.y, nSlots * slice->seqLen);
+    ASSERT_EQ(context->bufferConfigs[config->valueCacheBufferIndex].size.x, slice->kvDim0);
+    ASSERT_EQ(context->pipeConfigs[config->slotPipeIndex].size.y, context->nBatches);
+
+    if (context->bufferFlags[config->rope.ropeCacheBufferIndex] == 1)
+        return;
+    context->bufferFlags[config->rope.ropeCacheBufferIndex] = 1;
+
+    float *cache = (float *)context->buffers[config->rope.ropeCacheBufferIndex];
+    fullfillRopeCache(&config->rope, cache);
+}
+
+static void ropeKvForward_F32_F32(NnUint nThreads, NnUint threadIndex, NnUint batchSize, NnCpuOpContext *context) {
+    const NnRopeKvOpConfig *config = (NnRopeKvOpConfig *)context->opConfig;
+    const NnRopeSlice *slice = &config->rope.slice;
+    const float *positions = (float *)context->pipes[config->rope.positionPipeIndex];
+    const float *slots = (float *)context->pipes[config->slotPipeIndex];
+    const float *cache = (float *)context->buffers[config->rope.ropeCacheBufferIndex];
+    float *query = (float *)context->buffers[config->queryBufferIndex];
+    const float *value = (float *)context->buffers[config->valueBufferIndex];
+    float *keyCache = (float *)context->output[0];
+    float *valueCache = (float *)context->buffers[config->valueCacheBufferIndex];
+    const NnSize kvDimBytes = getBytes(F_32, slice->kvDim0);
+
+    for (NnUint batchIndex = 0; batchIndex < batchSize; batchIndex++) {
+        const NnUint pos = (NnUint)positions[batchIndex];
+        const NnUint slot = (NnUint)slots[batchIndex];
+        assert(pos < slice->seqLen);
+        assert((slot + 1) * slice->seqLen * slice->kvDim0 <= context->outputSize.x);
+        // Each row may belong to a different sequence, the slot selects its region of the cache
+        const NnUint row = slot * slice->seqLen + pos;
+        float *q = &query[batchIndex * slice->qDim0];
+        const float *k = (float *)context->input[batchIndex];
+        float *kSlot = &keyCache[row * slice->kvDim0];
+
+        // The rotated key goes straight to the cache slot, the value is copied next to it
+        if (config->rope.type == ROPE_LLAMA || config->rope.type == ROPE_LLAMA3_1) {
+            ropeLlama_F32(q, q, cache, true, pos, slice, nThreads, threadIndex);
+            ropeLlama_F32(kSlot, k, cache, false, pos, slice, nThreads, threadIndex);
+        } else if (config->rope.type == ROPE_FALCON) {
+            ropeFalcon_F32(q, q, cache, true, pos, slice, nThreads, threadIndex);
+            ropeFalcon_F32(kSlot, k, cache, false, pos, slice, nThreads, threadIndex);
+        } else {
+            throw std::runtime_error("Unsupported rope type");
+        }
+        copy_UNK(
+            (NnByte *)&valueCache[row * slice->kvDim0],
+            (const NnByte *)&value[batchIndex * slice->kvDim0],
+            kvDimBytes,
+            nThreads,
+            threadIndex);
+    }
+}
+
 static void initMultiHeadAttForward(NnCpuOpContext *context) {
     const NnMultiHeadAttOpConfig *config = (NnMultiHeadAttOpConfig *)context->opConfig;
 
@@ -1255,6 +2028,12 @@ static void initMultiHeadAttForward(NnCpuOpContext *context) {
     NnSize3D *posSize = &context->pipeConfigs[config->positionPipeIndex].size;
     ASSERT_EQ(posSize->x, 1);
     ASSERT_EQ(posSize->y, context->nBatches);
+    NnSize3D *slotSize = &context->pipeConfigs[config->slotPipeIndex].size;
+    ASSERT_EQ(slotSize->x, 1);
+    ASSERT_EQ(slotSize->y, context->nBatches);
+    NnSize3D *keyCacheSize = &context->bufferConfigs[config->keyCacheBufferIndex].size;
+    ASSERT_EQ(keyCacheSize->x, config->kvDim0);
+    ASSERT_EQ(keyCacheSize->y % config->seqLen, 0);
 }
 
 static void multiHeadAttForward_F32_F32(NnUint nThreads, NnUint threadIndex, NnUint batchSize, NnCpuOpContext *context) {
@@ -1265,19 +2044,23 @@ static void multiHeadAttForward_F32_F32(NnUint nThreads, NnUint threadIndex, NnU
     float *valueCache = (float *)context->buffers[config->valueCacheBufferIndex];
     float *att = (float *)context->buffers[config->attBufferIndex];
     const float *positions = (float *)context->pipes[config->positionPipeIndex];
+    const float *slots = (float *)context->pipes[config->slotPipeIndex];
+    const NnSize slotSize = config->seqLen * config->kvDim0;
 
     for (NnUint batchIndex = 0; batchIndex < batchSize; batchIndex++) {
         float *y = (float *)context->output[batchIndex];
         float *q = &query[batchIndex * config->qSliceD0];
         NnUint pos = (NnUint)positions[batchIndex];
+        NnUint slot = (NnUint)slots[batchIndex];
         assert(pos < config->seqLen);
+        assert(slot * config->seqLen < context->bufferConfigs[config->keyCacheBufferIndex].size.y);
 
         DEBUG_VECTOR(context, "input", y);
         DEBUG_VECTOR(context, "q", q);
 
         multiheadAtt_F32(y, q, 
             &att[batchIndex * config->nHeads0 * config->seqLen],
-            keyCache, valueCache, pos,
+            &keyCache[slot * slotSize], &valueCache[slot * slotSize], pos,
             config->nHeads, config->nHeads0,
             config->nKvHeads, config->kvDim0, config->headDim, config->seqLen, nThreads, threadIndex);
 
@@ -1425,14 +2208,18 @@ static void shiftForward_F32_F32(NnUint nThreads, NnUint threadIndex, NnUint bat
 
     const NnShiftOpCodeConfig *config = (NnShiftOpCodeConfig *)context->opConfig;
     const float *indexes = (float *)context->pipes[config->indexPipeIndex];
+    const float *slots = (float *)context->pipes[config->slotPipeIndex];
     const NnSize dimBytes = getBytes(F_32, context->inputSize.x);
     NnByte *output = context->output[0];
 
     for (NnUint batchIndex = 0; batchIndex < batchSize; batchIndex++) {
         const NnSize index = (NnSize)indexes[batchIndex];
-        assert((index + 1) * context->inputSize.x <= context->outputSize.x);
+        const NnSize slot = (NnSize)slots[batchIndex];
+        assert(index < config->slotLength);
+        const NnSize row = slot * config->slotLength + index;
+        assert((row + 1) * context->inputSize.x <= context->outputSize.x);
         copy_UNK(
-            &output[index * dimBytes],
+            &output[row * dimBytes],
             context->input[batchIndex],
             dimBytes,
             nThreads,
@@ -1491,6 +2278,32 @@ static void moeGateForward_F32_F32(NnUint nThreads, NnUint threadIndex, NnUint b
     }
 }
 
+static void initTopkForward(NnCpuOpContext *context) {
+    const NnTopkOpCodeConfig *config = (NnTopkOpCodeConfig *)context->opConfig;
+    ASSERT_EQ(context->inputSize.floatType, F_32);
+    ASSERT_EQ(context->outputSize.floatType, F_32);
+    assert(config->k <= context->inputSize.x);
+    ASSERT_EQ(context->outputSize.x, 2u * config->k);
+}
+
+static void topkForward_F32_F32(NnUint nThreads, NnUint threadIndex, NnUint batchSize, NnCpuOpContext *context) {
+    const NnTopkOpCodeConfig *config = (NnTopkOpCodeConfig *)context->opConfig;
+
+    std::vector<NnUint> pos(config->k);
+    for (NnUint y = threadIndex; y < batchSize; y += nThreads) {
+        const float *input = (float *)context->input[y];
+        float *output = (float *)context->output[y];
+
+        topk_F32(input, pos.data(), context->inputSize.x, config->k);
+
+        // (index, value) pairs, indexes are exact as floats up to 2^24
+        for (NnUint i = 0u; i < config->k; i++) {
+            output[i * 2u] = (float)(config->indexOffset + pos[i]);
+            output[i * 2u + 1u] = input[pos[i]];
+        }
+    }
+}
+
 // device
 
 void printCpuInstructionSet() {
@@ -1509,6 +2322,12 @@ void printCpuInstructionSet() {
 #endif
 #if defined(__AVX512F__)
     printf(" avx512f");
+#endif
+#if defined(__AVX512VNNI__)
+    printf(" avx512vnni");
+#endif
+#if defined(__F16C__)
+    printf(" f16c");
 #endif
     printf("\n");
 }
@@ -1534,6 +2353,12 @@ NnCpuOpForwardInit getCpuOpForwardInit(NnOpCode code, NnOpQuantType quantType) {
         return initRepeatZForward;
     if (code == OP_MOE_GATE)
         return initMoeGateForward;
+    if (code == OP_MATMUL_QKV)
+        return initMatmulQkvForward;
+    if (code == OP_ROPE_KV)
+        return initRopeKvForward_F32;
+    if (code == OP_TOPK)
+        return initTopkForward;
     return nullptr;
 }
 
@@ -1547,6 +2372,7 @@ NnCpuOpForward getCpuOpForward(NnOpCode code, NnOpQuantType quantType) {
     }
     if (code == OP_EMBEDDING) {
         if (quantType == F32_F32_F32) return embeddingForward_F32_F32_F32;
+        if (quantType == F32_F16_F32) return embeddingForward_F32_F16_F32;
         if (quantType == F32_F32_Q80) return embeddingForward_F32_F32_Q80;
     }
     if (code == OP_INV_RMS) {
@@ -1559,6 +2385,11 @@ NnCpuOpForward getCpuOpForward(NnOpCode code, NnOpQuantType quantType) {
     if (code == OP_MATMUL) {
         if (quantType == F32_F32_F32) return matmulForward_F32_F32_F32;
         if (quantType == Q80_Q40_F32) return matmulForward_Q80_Q40_F32;
+        if (quantType == Q80_Q80_F32) return matmulForward_Q80_Q80_F32;
+        if (quantType == Q80_Q4K_F32) return matmulForward_Q80_Q4K_F32;
+        if (quantType == Q80_Q6K_F32) return matmulForward_Q80_Q6K_F32;
+        if (quantType == F32_F16_F32) return matmulForward_F32_F16_F32;
+        if (quantType == Q80_F16_F32) return matmulForward_Q80_F16_F32;
     }
     if (code == OP_ROPE) {
         if (quantType == F32_F32_F32) return ropeForward_F32_F32;
@@ -1596,5 +2427,20 @@ NnCpuOpForward getCpuOpForward(NnOpCode code, NnOpQuantType quantType) {
     if (code == OP_MOE_GATE) {
         if (quantType == F32_F32_F32) return moeGateForward_F32_F32;
     }
+    if (code == OP_MATMUL_QKV) {
+        if (quantType == F32_F32_F32) return matmulQkvForward_F32_F32_F32;
+        if (quantType == Q80_Q40_F32) return matmulQkvForward_Q80_Q40_F32;
+        if (quantType == Q80_Q80_F32) return matmulQkvForward_Q80_Q80_F32;
+        if (quantType == Q80_Q4K_F32) return matmulQkvForward_Q80_Q4K_F32;
+        if (quantType == Q80_Q6K_F32) return matmulQkvForward_Q80_Q6K_F32;
+        if (quantType == F32_F16_F32) return matmulQkvForward_F32_F16_F32;
+        if (quantType == Q80_F16_F32) return matmulQkvForward_Q80_F16_F32;
+    }
+    if (code == OP_ROPE_KV) {
+        if (quantType == F32_F32_F32) return ropeKvForward_F32_F32;
+    }
+    if (code == OP_TOPK) {
+        if (quantType == F32_F32_F32) return topkForward_F32_F32;
+    }
     return nullptr;
 }
@@ -39,5 +39,8 @@ NnCpuOpForwardInit getCpuOpForwardInit(NnOpCode code, NnOpQuantType quantType);
 NnCpuOpForward getCpuOpForward(NnOpCode code, NnOpQuantType quantType);
 
 void softmax_F32(float *x, const NnUint size);
+// Softmax of `x * scale`, the scale is applied after the max is subtracted.
+// Returns the sum of exponents before the normalization.
+float softmaxScaled_F32(float *x, const NnUint size, const float scale);
 
 #endif
\ No newline at end of file
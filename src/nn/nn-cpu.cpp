@@ -161,6 +161,16 @@ NnCpuDeviceSegment::~NnCpuDeviceSegment() {
     delete[] opContexts;
 }
 
+void NnCpuDevice::readBuffer(NnUint bufferIndex, NnSize offset, NnSize nBytes, NnByte *data) {
+    assert(bufferIndex < nBuffers);
+    std::memcpy(data, &buffers[bufferIndex][offset], nBytes);
+}
+
+void NnCpuDevice::writeBuffer(NnUint bufferIndex, NnSize offset, NnSize nBytes, const NnByte *data) {
+    assert(bufferIndex < nBuffers);
+    std::memcpy(&buffers[bufferIndex][offset], data, nBytes);
+}
+
 std::vector<NnByte *> NnCpuDevice::resolvePointer(NnSize3D *pntrSize, NnPointerConfig *pointerConfig) {
     NnByte *source;
     NnSize3D *sourceSize;
@@ -21,6 +21,8 @@ public:
     ~NnCpuDevice() override;
     NnUint maxNThreads() override;
     NnDeviceSegment *createSegment(NnUint segmentIndex) override;
+    void readBuffer(NnUint bufferIndex, NnSize offset, NnSize nBytes, NnByte *data) override;
+    void writeBuffer(NnUint bufferIndex, NnSize offset, NnSize nBytes, const NnByte *data) override;
     std::vector<NnByte *> resolvePointer(NnSize3D *pntrSize, NnPointerConfig *pointerConfig);
 };
 
@@ -1,4 +1,5 @@
 #include <cassert>
+#include <cstdio>
 #include <cstring>
 #include "nn-executor.hpp"
 
@@ -38,12 +39,22 @@ NnExecutorDevice::NnExecutorDevice(NnDevice *device, int segmentFrom, int segmen
     this->segmentTo = segmentTo;
 }
 
+NnProfiler::NnProfiler(NnUint nThreads)
+    : events(nThreads)
+{
+    epoch = std::chrono::steady_clock::now();
+}
+
+long long NnProfiler::now() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
 NnExecutorException::NnExecutorException(const std::string message)
     : std::runtime_error(message) 
 {}
 
 NnExecutor::NnExecutor(NnNetConfig *netConfig, NnNodeConfig *nodeConfig, std::vector<NnExecutorDevice> *devices, NnNetExecution *netExecution, NnNodeSynchronizer *synchronizer, bool benchmark)
-    : segments(nodeConfig->nSegments), steps()
+    : segments(nodeConfig->nSegments), segmentDevices(nodeConfig->nSegments), steps()
 {
     NnUint maxNThreads = 0;
     for (NnExecutorDevice &d : *devices) {
@@ -70,6 +81,7 @@ NnExecutor::NnExecutor(NnNetConfig *netConfig, NnNodeConfig *nodeConfig, std::ve
         }
         if (device == nullptr)
             throw std::invalid_argument("Cannot locate device for segment " + std::to_string(segmentIndex));
+        segmentDevices[segmentIndex] = device;
 
         NnSegmentConfig *segmentConfig = &nodeConfig->segments[segmentIndex];
         if (segmentConfig->nOps > 0) {
@@ -93,6 +105,7 @@ NnExecutor::NnExecutor(NnNetConfig *netConfig, NnNodeConfig *nodeConfig, std::ve
         context.timer = new Timer();
     else
         context.timer = nullptr;
+    context.profiler = nullptr;
 
     threads = new NnExecutorThread[netExecution->nThreads];
     for (NnUint threadIndex = 0; threadIndex < netExecution->nThreads; threadIndex++) {
@@ -124,6 +137,21 @@ void NnExecutor::loadWeight(const char *name, NnUint opIndex, NnSize offset, NnS
     throw std::invalid_argument("Cannot locate op by name: " + std::string(name));
 }
 
+// Buffers are allocated by every device, only the device executing the segment holds the current content
+void NnExecutor::readBuffer(NnUint segmentIndex, NnUint bufferIndex, NnSize offset, NnSize nBytes, NnByte *data) {
+    assert(segmentIndex < nodeConfig->nSegments);
+    assert(bufferIndex < nodeConfig->nBuffers);
+    assert(offset + nBytes <= nodeConfig->buffers[bufferIndex].size.nBytes);
+    segmentDevices[segmentIndex]->readBuffer(bufferIndex, offset, nBytes, data);
+}
+
+void NnExecutor::writeBuffer(NnUint segmentIndex, NnUint bufferIndex, NnSize offset, NnSize nBytes, const NnByte *data) {
+    assert(segmentIndex < nodeConfig->nSegments);
+    assert(bufferIndex < nodeConfig->nBuffers);
+    assert(offset + nBytes <= nodeConfig->buffers[bufferIndex].size.nBytes);
+    segmentDevices[segmentIndex]->writeBuffer(bufferIndex, offset, nBytes, data);
+}
+
 inline void executeStep(NnExecutorStep *step, NnUint nThreads, NnExecutorThread *thread, NnExecutorContext *context) {
     if (step->type == STEP_EXECUTE_OP) {
         step->segment->forward(step->arg0, nThreads, thread->threadIndex, context->batchSize);
@@ -146,6 +174,7 @@ static inline void *executorThreadHandler(void *arg) {
             break;
 
         NnExecutorStep *step = &context->steps[currentStepIndex];
+        const long long startUs = context->profiler != nullptr ? context->profiler->now() : 0;
         try {
             executeStep(step, nThreads, thread, context);
         } catch (const std::runtime_error &e) {
@@ -153,6 +182,7 @@ static inline void *executorThreadHandler(void *arg) {
             printf("🚨 Execution error: %s\n", e.what());
             break;
         }
+        const long long endUs = context->profiler != nullptr ? context->profiler->now() : 0;
 
         NnUint currentCount = context->doneThreadCount.fetch_add(1);
         if (currentCount == doneCount) {
@@ -170,6 +200,10 @@ static inline void *executorThreadHandler(void *arg) {
                 context->isAlive.load()
             );
         }
+        if (context->profiler != nullptr) {
+            context->profiler->events[thread->threadIndex].push_back(
+                NnProfilerEvent{ currentStepIndex, thread->threadIndex, startUs, endUs, context->profiler->now() });
+        }
     }
     return nullptr;
 }
@@ -187,6 +221,7 @@ void NnExecutor::forward() {
         std::memset(context.totalTime, 0, sizeof(context.totalTime));
         context.timer->reset();
     }
+    const long long startUs = context.profiler != nullptr ? context.profiler->now() : 0;
 
     NnUint threadIndex;
     for (threadIndex = 1; threadIndex < nThreads; threadIndex++) {
@@ -197,6 +232,11 @@ void NnExecutor::forward() {
     for (threadIndex = 1; threadIndex < nThreads; threadIndex++)
         pthread_join(threads[threadIndex].handler, NULL);
 
+    if (context.profiler != nullptr) {
+        const long long endUs = context.profiler->now();
+        context.profiler->events[0].push_back(NnProfilerEvent{ NN_PROFILER_FORWARD_STEP, 0, startUs, endUs, endUs });
+    }
+
     if (!context.isAlive.load())
         throw NnExecutorException("Execution failed in one of the threads");
 }
@@ -205,3 +245,59 @@ NnUint NnExecutor::getTotalTime(NnExecutorStepType type) {
     assert((NnUint)type < N_STEP_TYPES);
     return context.totalTime[type];
 }
+
+void NnExecutor::enableProfiler() {
+    profiler.reset(new NnProfiler(netExecution->nThreads));
+    context.profiler = profiler.get();
+}
+
+void NnExecutor::disableProfiler() {
+    context.profiler = nullptr;
+    profiler.reset();
+}
+
+NnProfiler *NnExecutor::getProfiler() {
+    return profiler.get();
+}
+
+static void appendTraceEvent(std::string &out, const char *name, const char *category, NnUint nodeIndex, NnUint threadIndex,
+    long long startUs, long long durationUs, const char *args) {
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer),
+        "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":%u,\"tid\":%u,\"ts\":%lld,\"dur\":%lld,\"args\":{%s}}",
+        out.empty() ? "" : ",\n", name, category, nodeIndex, threadIndex, startUs, durationUs, args);
+    out += buffer;
+}
+
+// Returns Chrome trace events of the recorded forward passes, separated by commas. The offset moves
+// the timestamps to the timeline of another node
+std::string NnExecutor::getTraceEvents(NnUint nodeIndex, long long offsetUs) {
+    std::string out;
+    if (profiler == nullptr)
+        return out;
+    char args[128];
+    snprintf(args, sizeof(args), "\"name\":\"%s\"", nodeIndex == 0 ? "root" : ("worker " + std::to_string(nodeIndex)).c_str());
+    out += "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" + std::to_string(nodeIndex) + ",\"args\":{" + args + "}}";
+
+    for (std::vector<NnProfilerEvent> &threadEvents : profiler->events) {
+        for (NnProfilerEvent &event : threadEvents) {
+            const long long startUs = event.startUs - offsetUs;
+            if (event.stepIndex == NN_PROFILER_FORWARD_STEP) {
+                appendTraceEvent(out, "forward", "forward", nodeIndex, event.threadIndex, startUs, event.endUs - event.startUs, "");
+                continue;
+            }
+            NnExecutorStep *step = &steps[event.stepIndex];
+            if (step->type == STEP_EXECUTE_OP) {
+                snprintf(args, sizeof(args), "\"layer\":%u,\"step\":%u", step->opConfig->index, event.stepIndex);
+                appendTraceEvent(out, step->opConfig->name, "op", nodeIndex, event.threadIndex, startUs, event.endUs - event.startUs, args);
+            } else {
+                snprintf(args, sizeof(args), "\"segment\":%u,\"step\":%u", step->arg0, event.stepIndex);
+                appendTraceEvent(out, "sync", "sync", nodeIndex, event.threadIndex, startUs, event.endUs - event.startUs, args);
+            }
+            // The thread waits at the barrier until the slowest thread finishes the step
+            if (netExecution->nThreads > 1 && event.leaveUs > event.endUs)
+                appendTraceEvent(out, "wait", "barrier", nodeIndex, event.threadIndex, event.endUs - offsetUs, event.leaveUs - event.endUs, "");
+        }
+    }
+    return out;
+}
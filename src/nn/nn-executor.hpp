@@ -3,6 +3,9 @@
 
 #include "nn-core.hpp"
 #include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
 #include <vector>
 #include <stdexcept>
 #include "pthread.h"
@@ -19,6 +22,8 @@ public:
     virtual NnUint maxNThreads() = 0;
     virtual ~NnDevice() {}
     virtual NnDeviceSegment *createSegment(NnUint segmentIndex) = 0;
+    virtual void readBuffer(NnUint bufferIndex, NnSize offset, NnSize nBytes, NnByte *data) = 0;
+    virtual void writeBuffer(NnUint bufferIndex, NnSize offset, NnSize nBytes, const NnByte *data) = 0;
 };
 
 class NnNodeSynchronizer {
@@ -52,6 +57,26 @@ enum NnExecutorStepType {
 
 #define N_STEP_TYPES STEP_SYNC_NODES + 1
 
+#define NN_PROFILER_FORWARD_STEP 0xFFFFFFFF
+
+typedef struct {
+    NnUint stepIndex; // NN_PROFILER_FORWARD_STEP marks a whole forward pass
+    NnUint threadIndex;
+    long long startUs;
+    long long endUs; // The thread has finished its part of the step
+    long long leaveUs; // All threads have finished the step
+} NnProfilerEvent;
+
+// Timestamps are microseconds since the profiler was created, every thread appends only to its own list
+class NnProfiler {
+private:
+    std::chrono::steady_clock::time_point epoch;
+public:
+    std::vector<std::vector<NnProfilerEvent>> events;
+    NnProfiler(NnUint nThreads);
+    long long now();
+};
+
 class NnExecutorDevice {
 public:
     std::unique_ptr<NnDevice> device;
@@ -78,6 +103,7 @@ typedef struct {
     NnUint batchSize;
     Timer *timer;
     NnUint totalTime[N_STEP_TYPES];
+    NnProfiler *profiler;
 } NnExecutorContext;
 
 typedef struct {
@@ -96,15 +122,23 @@ private:
     NnNetExecution *netExecution;
     NnNodeConfig *nodeConfig;
     std::vector<std::unique_ptr<NnDeviceSegment>> segments;
+    std::vector<NnDevice *> segmentDevices;
     std::vector<NnExecutorStep> steps;
     NnExecutorThread *threads;
     NnExecutorContext context;
+    std::unique_ptr<NnProfiler> profiler;
 public:
     NnExecutor(NnNetConfig *netConfig, NnNodeConfig *nodeConfig, std::vector<NnExecutorDevice> *device, NnNetExecution *netExecution, NnNodeSynchronizer *synchronizer, bool benchmark);
     ~NnExecutor();
     void loadWeight(const char *name, NnUint opIndex, NnSize offset, NnSize nBytes, NnByte *weight);
     void forward();
+    void readBuffer(NnUint segmentIndex, NnUint bufferIndex, NnSize offset, NnSize nBytes, NnByte *data);
+    void writeBuffer(NnUint segmentIndex, NnUint bufferIndex, NnSize offset, NnSize nBytes, const NnByte *data);
     NnUint getTotalTime(NnExecutorStepType type);
+    void enableProfiler();
+    void disableProfiler();
+    NnProfiler *getProfiler(); // Returns nullptr if the profiler is disabled
+    std::string getTraceEvents(NnUint nodeIndex, long long offsetUs);
 };
 
 #endif
\ No newline at end of file
@@ -23,7 +23,7 @@ typedef SSIZE_T ssize_t;
 #define ACK 23571114
 #define MAX_CHUNK_SIZE 4096
 
-static inline bool isEagainError() {
+bool isEagainError() {
     #ifdef _WIN32
     return WSAGetLastError() == WSAEWOULDBLOCK;
     #else
@@ -31,7 +31,7 @@ static inline bool isEagainError() {
     #endif
 }
 
-static inline void setNonBlocking(int socket, bool enabled) {
+void setNonBlocking(int socket, bool enabled) {
 #ifdef _WIN32
     u_long mode = enabled ? 1 : 0;
     if (ioctlsocket(socket, FIONBIO, &mode) != 0) {
@@ -243,6 +243,20 @@ int acceptSocket(int serverSocket) {
     return clientSocket;
 }
 
+int tryAcceptSocket(int serverSocket) {
+    struct sockaddr_in clientAddr;
+    socklen_t clientAddrSize = sizeof(clientAddr);
+    int clientSocket = ::accept(serverSocket, (struct sockaddr*)&clientAddr, &clientAddrSize);
+    if (clientSocket < 0) {
+        if (isEagainError())
+            return -1;
+        throw std::runtime_error("Error accepting connection");
+    }
+    setNoDelay(clientSocket);
+    setQuickAck(clientSocket);
+    return clientSocket;
+}
+
 void initSockets() {
 #ifdef _WIN32
     WSADATA wsaData;
@@ -531,6 +545,14 @@ void NnNetwork::getStats(NnSize *sentBytes, NnSize *recvBytes) {
     resetStats();
 }
 
+void NnNetwork::getSocketStats(NnUint socketIndex, NnSize *sentBytes, NnSize *recvBytes) {
+    assert(socketIndex < nSockets);
+    *sentBytes = this->sentBytes[socketIndex];
+    *recvBytes = this->recvBytes[socketIndex];
+    this->sentBytes[socketIndex] = 0;
+    this->recvBytes[socketIndex] = 0;
+}
+
 void NnNetwork::resetStats() {
     for (NnUint i = 0; i < nSockets; i++) {
         sentBytes[i] = 0;
@@ -854,7 +876,10 @@ NnSize NnRootWeightLoader::loadAll(const char *opName, NnUint opIndex, NnSize nB
 }
 
 NnSize NnRootWeightLoader::loadRowMatmulSlices(const char *opName, const NnUint opIndex, const NnUint expertIndex, NnRowMatmulSlice *slice, NnByte *weight) {
-    const NnUint offset = expertIndex * slice->sliceSize.nBytes;
+    return loadRowMatmulSlicesAt(opName, opIndex, expertIndex * slice->sliceSize.nBytes, slice, weight);
+}
+
+NnSize NnRootWeightLoader::loadRowMatmulSlicesAt(const char *opName, const NnUint opIndex, const NnSize offset, NnRowMatmulSlice *slice, NnByte *weight) {
     if (nNodes == 1u) {
         executor->loadWeight(opName, opIndex, offset, slice->sliceSize.nBytes, weight);
     } else {
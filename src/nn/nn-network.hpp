@@ -8,6 +8,9 @@
 void initSockets();
 void cleanupSockets();
 int acceptSocket(int serverSocket);
+int tryAcceptSocket(int serverSocket); // Returns -1 if a non-blocking socket has no pending connection
+bool isEagainError();
+void setNonBlocking(int socket, bool enabled);
 void setReuseAddr(int socket);
 void writeSocket(int socket, const void* data, NnSize size);
 void readSocket(int socket, void* data, NnSize size);
@@ -66,6 +69,7 @@ public:
     void writeAll(void *data, NnSize size);
     void readMany(NnUint n, NnSocketIo *ios);
     void getStats(NnSize *sentBytes, NnSize *recvBytes);
+    void getSocketStats(NnUint socketIndex, NnSize *sentBytes, NnSize *recvBytes); // Resets the counters of the socket
     void resetStats();
 };
 
@@ -114,6 +118,7 @@ public:
     NnSize loadRoot(const char *opName, NnUint opIndex, NnSize nBytes, NnByte *weight);
     NnSize loadAll(const char *opName, NnUint opIndex, NnSize nBytes, NnByte *weight);
     NnSize loadRowMatmulSlices(const char *opName, const NnUint opIndex, const NnUint expertIndex, NnRowMatmulSlice *slice, NnByte *weight);
+    NnSize loadRowMatmulSlicesAt(const char *opName, const NnUint opIndex, const NnSize offset, NnRowMatmulSlice *slice, NnByte *weight);
     NnSize loadColMatmulSlices(const char *opName, const NnUint opIndex, const NnUint expertIndex, NnColMatmulSlice *slice, NnByte *weight);
     void finish();
 private:
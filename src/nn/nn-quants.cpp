@@ -4,6 +4,7 @@
 #include <cmath>
 #include <stdexcept>
 #include <cstdio>
+#include <algorithm>
 
 #if defined(CONVERT_F16_TO_F32_LOOKUP)
 float f16ToF32Lookup[65536];
@@ -245,11 +246,155 @@ void dequantizeQ40toF32(const NnBlockQ40 *x, float *output, const NnUint n, cons
     }
 }
 
+void quantizeF32toQ4K(const float *x, NnBlockQ4K *output, const NnUint n, const NnUint nThreads, const NnUint threadIndex) {
+    assert(n % Q4K_BLOCK_SIZE == 0);
+    const NnUint nBlocks = n / Q4K_BLOCK_SIZE;
+    const NnUint nSubBlocks = Q4K_BLOCK_SIZE / 32;
+    SPLIT_THREADS(start, end, nBlocks, nThreads, threadIndex);
+
+    for (NnUint i = start; i < end; i++) {
+        const float *xb = &x[i * Q4K_BLOCK_SIZE];
+        NnBlockQ4K *o = &output[i];
+
+        float scales[nSubBlocks];
+        float mins[nSubBlocks];
+        float maxScale = 0.0f;
+        float maxMin = 0.0f;
+        for (NnUint j = 0; j < nSubBlocks; j++) {
+            float min = 0.0f;
+            float max = xb[j * 32];
+            for (NnUint k = 0; k < 32; k++) {
+                const float v = xb[j * 32 + k];
+                if (v < min) min = v;
+                if (v > max) max = v;
+            }
+            scales[j] = (max - min) / 15.0f;
+            mins[j] = -min;
+            if (scales[j] > maxScale) maxScale = scales[j];
+            if (mins[j] > maxMin) maxMin = mins[j];
+        }
+
+        o->d = CONVERT_F32_TO_F16(maxScale / 63.0f);
+        o->dmin = CONVERT_F32_TO_F16(maxMin / 63.0f);
+        const float d = CONVERT_F16_TO_F32(o->d);
+        const float dmin = CONVERT_F16_TO_F32(o->dmin);
+        const float id = d ? 1.0f / d : 0.0f;
+        const float idmin = dmin ? 1.0f / dmin : 0.0f;
+
+        std::uint8_t ls[nSubBlocks];
+        std::uint8_t lm[nSubBlocks];
+        for (NnUint j = 0; j < nSubBlocks; j++) {
+            ls[j] = (std::uint8_t)std::min(63.0f, roundf(scales[j] * id));
+            lm[j] = (std::uint8_t)std::min(63.0f, roundf(mins[j] * idmin));
+        }
+        for (NnUint j = 0; j < 4; j++) {
+            o->scales[j] = ls[j] | ((ls[j + 4] >> 4) << 6);
+            o->scales[j + 4] = lm[j] | ((lm[j + 4] >> 4) << 6);
+            o->scales[j + 8] = (ls[j + 4] & 0xF) | ((lm[j + 4] & 0xF) << 4);
+        }
+
+        std::memset(o->qs, 0, sizeof(o->qs));
+        for (NnUint j = 0; j < nSubBlocks; j++) {
+            const float sd = d * ls[j];
+            const float sm = dmin * lm[j];
+            const float isd = sd ? 1.0f / sd : 0.0f;
+            for (NnUint k = 0; k < 32; k++) {
+                const float q = roundf((xb[j * 32 + k] + sm) * isd);
+                const std::uint8_t qi = (std::uint8_t)std::max(0.0f, std::min(15.0f, q));
+                o->qs[(j / 2) * 32 + k] |= qi << (4 * (j % 2));
+            }
+        }
+    }
+}
+
+void dequantizeQ4KtoF32(const NnBlockQ4K *x, float *output, const NnUint n, const NnUint nThreads, const NnUint threadIndex) {
+    assert(n % Q4K_BLOCK_SIZE == 0);
+    const NnUint nBlocks = n / Q4K_BLOCK_SIZE;
+    SPLIT_THREADS(start, end, nBlocks, nThreads, threadIndex);
+
+    for (NnUint i = start; i < end; i++) {
+        const NnBlockQ4K *b = &x[i];
+        const float d = CONVERT_F16_TO_F32(b->d);
+        const float dmin = CONVERT_F16_TO_F32(b->dmin);
+        float *y = &output[i * Q4K_BLOCK_SIZE];
+        for (NnUint j = 0; j < Q4K_BLOCK_SIZE / 32; j++) {
+            std::uint8_t sc, m;
+            getScaleMinQ4K(j, b->scales, &sc, &m);
+            for (NnUint k = 0; k < 32; k++) {
+                const int q = (b->qs[(j / 2) * 32 + k] >> (4 * (j % 2))) & 0xF;
+                y[j * 32 + k] = d * sc * q - dmin * m;
+            }
+        }
+    }
+}
+
+void quantizeF32toQ6K(const float *x, NnBlockQ6K *output, const NnUint n, const NnUint nThreads, const NnUint threadIndex) {
+    assert(n % Q6K_BLOCK_SIZE == 0);
+    const NnUint nBlocks = n / Q6K_BLOCK_SIZE;
+    const NnUint nSubBlocks = Q6K_BLOCK_SIZE / 16;
+    SPLIT_THREADS(start, end, nBlocks, nThreads, threadIndex);
+
+    for (NnUint i = start; i < end; i++) {
+        const float *xb = &x[i * Q6K_BLOCK_SIZE];
+        NnBlockQ6K *o = &output[i];
+
+        float scales[nSubBlocks];
+        float maxScale = 0.0f;
+        for (NnUint j = 0; j < nSubBlocks; j++) {
+            float amax = 0.0f;
+            for (NnUint k = 0; k < 16; k++) {
+                const float v = fabsf(xb[j * 16 + k]);
+                if (v > amax) amax = v;
+            }
+            scales[j] = amax / 31.0f;
+            if (scales[j] > maxScale) maxScale = scales[j];
+        }
+
+        o->d = CONVERT_F32_TO_F16(maxScale / 127.0f);
+        const float d = CONVERT_F16_TO_F32(o->d);
+        const float id = d ? 1.0f / d : 0.0f;
+
+        std::uint8_t q[Q6K_BLOCK_SIZE];
+        for (NnUint j = 0; j < nSubBlocks; j++) {
+            o->scales[j] = (std::int8_t)std::min(127.0f, roundf(scales[j] * id));
+            const float sd = d * o->scales[j];
+            const float isd = sd ? 1.0f / sd : 0.0f;
+            for (NnUint k = 0; k < 16; k++) {
+                const float v = roundf(xb[j * 16 + k] * isd);
+                q[j * 16 + k] = (std::uint8_t)(std::max(-32.0f, std::min(31.0f, v)) + 32.0f);
+            }
+        }
+        for (NnUint k = 0; k < Q6K_BLOCK_SIZE / 2; k++)
+            o->ql[k] = (q[k] & 0xF) | ((q[k + 128] & 0xF) << 4);
+        for (NnUint k = 0; k < Q6K_BLOCK_SIZE / 4; k++)
+            o->qh[k] = (q[k] >> 4) | ((q[k + 64] >> 4) << 2) | ((q[k + 128] >> 4) << 4) | ((q[k + 192] >> 4) << 6);
+    }
+}
+
+void dequantizeQ6KtoF32(const NnBlockQ6K *x, float *output, const NnUint n, const NnUint nThreads, const NnUint threadIndex) {
+    assert(n % Q6K_BLOCK_SIZE == 0);
+    const NnUint nBlocks = n / Q6K_BLOCK_SIZE;
+    SPLIT_THREADS(start, end, nBlocks, nThreads, threadIndex);
+
+    for (NnUint i = start; i < end; i++) {
+        const NnBlockQ6K *b = &x[i];
+        const float d = CONVERT_F16_TO_F32(b->d);
+        float *y = &output[i * Q6K_BLOCK_SIZE];
+        for (NnUint k = 0; k < Q6K_BLOCK_SIZE; k++) {
+            const int low = (b->ql[k % 128] >> (4 * (k / 128))) & 0xF;
+            const int high = (b->qh[k % 64] >> (2 * (k / 64))) & 3;
+            y[k] = d * b->scales[k / 16] * ((low | (high << 4)) - 32);
+        }
+    }
+}
+
 const char *floatTypeToString(NnFloatType type) {
     if (type == F_UNK) return "F_UNK";
     if (type == F_32) return "F_32";
     if (type == F_16) return "F_16";
     if (type == F_Q40) return "F_Q40";
     if (type == F_Q80) return "F_Q80";
+    if (type == F_Q4K) return "F_Q4K";
+    if (type == F_Q6K) return "F_Q6K";
     throw std::invalid_argument("Unknown float type");
 }
@@ -52,6 +52,9 @@ NnFp16 convertF32ToF16Impl(const float x);
 
 #define Q40_BLOCK_SIZE 32
 #define Q80_BLOCK_SIZE 32
+// Super-block formats, each super-block is split into sub-blocks with quantized scales
+#define Q4K_BLOCK_SIZE 256
+#define Q6K_BLOCK_SIZE 256
 
 enum NnFloatType {
     F_UNK = -1,
@@ -59,6 +62,8 @@ enum NnFloatType {
     F_16 = 1,
     F_Q40 = 2,
     F_Q80 = 3,
+    F_Q4K = 4,
+    F_Q6K = 5,
 };
 
 typedef struct {
@@ -71,11 +76,39 @@ typedef struct {
     std::int8_t qs[Q80_BLOCK_SIZE];
 } NnBlockQ80;
 
+typedef struct {
+    std::uint16_t d;
+    std::uint16_t dmin;
+    std::uint8_t scales[12]; // 6-bit scales and mins of 8 sub-blocks of 32 values
+    std::uint8_t qs[Q4K_BLOCK_SIZE / 2]; // sub-block 2i in low nibbles, sub-block 2i+1 in high nibbles
+} NnBlockQ4K;
+
+typedef struct {
+    std::uint8_t ql[Q6K_BLOCK_SIZE / 2]; // low 4 bits, values i and i+128
+    std::uint8_t qh[Q6K_BLOCK_SIZE / 4]; // high 2 bits, values i, i+64, i+128 and i+192
+    std::int8_t scales[Q6K_BLOCK_SIZE / 16]; // scales of 16 sub-blocks of 16 values
+    std::uint16_t d;
+} NnBlockQ6K;
+
+inline void getScaleMinQ4K(const NnUint j, const std::uint8_t *q, std::uint8_t *d, std::uint8_t *m) {
+    if (j < 4) {
+        *d = q[j] & 63;
+        *m = q[j + 4] & 63;
+    } else {
+        *d = (q[j + 4] & 0xF) | ((q[j - 4] >> 6) << 4);
+        *m = (q[j + 4] >> 4) | ((q[j] >> 6) << 4);
+    }
+}
+
 void initQuants();
 void quantizeF32toQ80(const float *input, NnBlockQ80 *output, const NnUint k, const NnUint nThreads, const NnUint threadIndex);
 void dequantizeQ80toF32(const NnBlockQ80 *input, float* output, const NnUint k, const NnUint nThreads, const NnUint threadIndex);
 void quantizeF32toQ40(const float *x, NnBlockQ40 *output, const NnUint n, const NnUint nThreads, const NnUint threadIndex);
 void dequantizeQ40toF32(const NnBlockQ40 *x, float *output, const NnUint n, const NnUint nThreads, const NnUint threadIndex);
+void quantizeF32toQ4K(const float *x, NnBlockQ4K *output, const NnUint n, const NnUint nThreads, const NnUint threadIndex);
+void dequantizeQ4KtoF32(const NnBlockQ4K *x, float *output, const NnUint n, const NnUint nThreads, const NnUint threadIndex);
+void quantizeF32toQ6K(const float *x, NnBlockQ6K *output, const NnUint n, const NnUint nThreads, const NnUint threadIndex);
+void dequantizeQ6KtoF32(const NnBlockQ6K *x, float *output, const NnUint n, const NnUint nThreads, const NnUint threadIndex);
 
 const char *floatTypeToString(NnFloatType type);
 
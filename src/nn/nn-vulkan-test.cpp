@@ -381,12 +381,13 @@ void testShift_F32_F32() {
             NnUint posPipeIndex = netBuilder->addPipe("POS", size2D(F_32, N_BATCHES, 1));
             NnUint xPipeIndex = netBuilder->addPipe("X", size2D(F_32, N_BATCHES, dim));
             NnUint yPipeIndex = netBuilder->addPipe("Y", size2D(F_32, 1, N_BATCHES * dim));
+            NnUint slotPipeIndex = netBuilder->addPipe("SLOT", size2D(F_32, N_BATCHES, 1));
             segmentBuilder->addOp(
                 OP_SHIFT, "shift", 0,
                 pointerBatchConfig(SRC_PIPE, xPipeIndex),
                 pointerRawConfig(SRC_PIPE, yPipeIndex),
                 size0(),
-                NnShiftOpCodeConfig{posPipeIndex});
+                NnShiftOpCodeConfig{posPipeIndex, slotPipeIndex, N_BATCHES / 2});
         },
         [](NnExecutor *executor, NnNetExecution *execution, NnVulkanDevice *device) {
             // arrange
@@ -394,22 +395,27 @@ void testShift_F32_F32() {
             float *xPipe = (float *)execution->pipes[1];
             float *yPipe = (float *)execution->pipes[2];
 
+            // even rows go to the first slot, odd rows to the second one
             float pos[N_BATCHES];
+            float slots[N_BATCHES];
             for (NnUint b = 0; b < N_BATCHES; b++) {
-                pos[b] = (float)b;
+                pos[b] = (float)(b / 2);
+                slots[b] = (float)(b % 2);
                 for (NnUint i = 0; i < dim; i++)
                     xPipe[b * dim + i] = (float)(b * 100 + i);
             }
 
             device->data.pipes[0].get()->write((NnByte *)pos);
+            device->data.pipes[3].get()->write((NnByte *)slots);
 
             // act
             executor->forward();
 
             // assert
             for (NnUint b = 0; b < N_BATCHES; b++) {
+                const NnUint row = (b % 2) * (N_BATCHES / 2) + b / 2;
                 for (NnUint i = 0; i < dim; i++) {
-                    NnUint j = b * dim + i;
+                    NnUint j = row * dim + i;
                     assertFloat(j, yPipe[j], (float)(b * 100 + i), 0.00001f);
                 }
             }
@@ -752,11 +758,12 @@ void testMultiheadAtt_F32_F32() {
             const NnUint seqLen = 4096;
             const NnUint qSliceD0 = 2048;
             const NnUint kvDim0 = 512;
-            const NnKvCacheSlice kvCacheSlice = sliceKvCache(kvDim0, seqLen, 1);
+            const NnKvCacheSlice kvCacheSlice = sliceKvCache(kvDim0, seqLen, 1, 1);
             const NnMultiHeadAttSlice multiHeadAttSlice = sliceMultiHeadAtt(nHeads, seqLen, 1, N_BATCHES);
 
             NnUint xPipeIndex = netBuilder->addPipe("X", size2D(F_32, N_BATCHES, MULTIHEAD_ATT_DIM));
             NnUint posPipeIndex = netBuilder->addPipe("POS", size2D(F_32, N_BATCHES, 1));
+            NnUint slotPipeIndex = netBuilder->addPipe("SLOT", size2D(F_32, N_BATCHES, 1));
             NnUint qBufferIndex = nodeBuilder->addBuffer("POS", size2D(F_32, N_BATCHES, qSliceD0));
             NnUint kCacheBufferIndex = nodeBuilder->addBuffer("kCache", kvCacheSlice.keySize);
             NnUint vCacheBufferIndex = nodeBuilder->addBuffer("vCache", kvCacheSlice.valueSize);
@@ -768,7 +775,7 @@ void testMultiheadAtt_F32_F32() {
                 pointerBatchConfig(SRC_PIPE, xPipeIndex),
                 size0(),
                 NnMultiHeadAttOpConfig{nHeads, nHeads, nKvHeads, headDim, seqLen, qSliceD0, kvDim0,
-                    posPipeIndex, qBufferIndex, kCacheBufferIndex, vCacheBufferIndex, attCacheBufferIndex});
+                    posPipeIndex, slotPipeIndex, qBufferIndex, kCacheBufferIndex, vCacheBufferIndex, attCacheBufferIndex});
         },
         [](NnExecutor *executor, NnNetExecution *execution, NnVulkanDevice *device) {
             // TODO: for now this is a smoke test
@@ -329,7 +329,7 @@ void NnVulkanBuffer::read(NnByte *data, const NnSize offset, const NnSize size)
 
     if (isHostVisible && hostPointer != nullptr) {
         context->device.invalidateMappedMemoryRanges({ {deviceMemory, offset, (vk::DeviceSize)size} });
-        std::memcpy(data, hostPointer, size);
+        std::memcpy(data, &hostPointer[offset], size);
 
         VULKAN_TRACE("Read %zu bytes from host visible buffer", size);
     } else {
@@ -395,6 +395,11 @@ NnVulkanDeviceData::NnVulkanDeviceData(NnVulkanBufferFactory *bufferFactory, NnN
     }
 
     NnRopeOpConfig *ropeLlamaOpConfig = (NnRopeOpConfig *)findFirstOpConfig(nodeConfig, OP_ROPE);
+    if (ropeLlamaOpConfig == nullptr) {
+        NnRopeKvOpConfig *ropeKvOpConfig = (NnRopeKvOpConfig *)findFirstOpConfig(nodeConfig, OP_ROPE_KV);
+        if (ropeKvOpConfig != nullptr)
+            ropeLlamaOpConfig = &ropeKvOpConfig->rope;
+    }
     if (ropeLlamaOpConfig != nullptr) {
         assert(ropeLlamaOpConfig->ropeCacheBufferIndex < nodeConfig->nBuffers);
         NnVulkanBuffer *buffer = buffers[ropeLlamaOpConfig->ropeCacheBufferIndex].get();
@@ -495,6 +500,14 @@ NnDeviceSegment *NnVulkanDevice::createSegment(NnUint segmentIndex) {
     return new NnVulkanDeviceSegment(&context, &copier, &bufferFactory, &data, netConfig, segmentIndex, segmentConfig, netExecution);
 };
 
+void NnVulkanDevice::readBuffer(NnUint bufferIndex, NnSize offset, NnSize nBytes, NnByte *output) {
+    data.resolveBufferByIndex(bufferIndex)->read(output, offset, nBytes);
+}
+
+void NnVulkanDevice::writeBuffer(NnUint bufferIndex, NnSize offset, NnSize nBytes, const NnByte *input) {
+    data.resolveBufferByIndex(bufferIndex)->write(input, offset, nBytes);
+}
+
 static const char *getShaderFileName(const NnOpCode opCode, const NnOpQuantType quantType) {
     if (opCode == OP_MERGE_ADD) {
         if (quantType == F32_F32_F32) return "merge-add-forward-f32-f32.spv";
@@ -547,6 +560,13 @@ static const char *getShaderFileName(const NnOpCode opCode, const NnOpQuantType
     if (opCode == OP_MOE_GATE) {
         if (quantType == F32_F32_F32) return "moe-gate-forward-f32-f32.spv";
     }
+    if (opCode == OP_MATMUL_QKV) {
+        if (quantType == F32_F32_F32) return "matmul-qkv-forward-f32-f32-f32.spv";
+        if (quantType == Q80_Q40_F32) return "matmul-qkv-forward-q80-q40-f32.spv";
+    }
+    if (opCode == OP_ROPE_KV) {
+        if (quantType == F32_F32_F32) return "rope-kv-forward-f32-f32.spv";
+    }
     throw std::invalid_argument(std::string("Unsupported shader: ") + opCodeToString(opCode) + "/" + opQuantTypeToString(quantType));
 }
 
@@ -577,6 +597,11 @@ static void buildShaderLayout(std::vector<NnOpBufferAccess> &a, NnVulkanDeviceDa
             const NnMatmulOpConfig *config = (NnMatmulOpConfig *)opConfig->config;
             a.push_back({ACCESS_READONLY, data->resolveBufferByIndex(config->activeExpertIndexesBufferIndex)});
         } break;
+        case OP_MATMUL_QKV: {
+            const NnMatmulQkvOpConfig *config = (NnMatmulQkvOpConfig *)opConfig->config;
+            a.push_back({ACCESS_READ_WRITE, data->resolveBufferByIndex(config->kBufferIndex)});
+            a.push_back({ACCESS_READ_WRITE, data->resolveBufferByIndex(config->vBufferIndex)});
+        } break;
         case OP_SCALE: {
             const NnScaleOpCodeConfig *config = (NnScaleOpCodeConfig *)opConfig->config;
             a.push_back({ACCESS_READONLY, data->resolveBufferByIndex(config->scaleBufferIndex)});
@@ -584,15 +609,26 @@ static void buildShaderLayout(std::vector<NnOpBufferAccess> &a, NnVulkanDeviceDa
         case OP_SHIFT: {
             const NnShiftOpCodeConfig *config = (NnShiftOpCodeConfig *)opConfig->config;
             a.push_back({ACCESS_READONLY, data->resolvePipeByIndex(config->indexPipeIndex)});
+            a.push_back({ACCESS_READONLY, data->resolvePipeByIndex(config->slotPipeIndex)});
         } break;
         case OP_ROPE: {
             const NnRopeOpConfig *config = (NnRopeOpConfig *)opConfig->config;
             a.push_back({ACCESS_READONLY, data->resolvePipeByIndex(config->positionPipeIndex)});
             a.push_back({ACCESS_IMMUTABLE, data->resolveBufferByIndex(config->ropeCacheBufferIndex)});
         } break;
+        case OP_ROPE_KV: {
+            const NnRopeKvOpConfig *config = (NnRopeKvOpConfig *)opConfig->config;
+            a.push_back({ACCESS_READONLY, data->resolvePipeByIndex(config->rope.positionPipeIndex)});
+            a.push_back({ACCESS_READONLY, data->resolvePipeByIndex(config->slotPipeIndex)});
+            a.push_back({ACCESS_IMMUTABLE, data->resolveBufferByIndex(config->rope.ropeCacheBufferIndex)});
+            a.push_back({ACCESS_READ_WRITE, data->resolveBufferByIndex(config->queryBufferIndex)});
+            a.push_back({ACCESS_READONLY, data->resolveBufferByIndex(config->valueBufferIndex)});
+            a.push_back({ACCESS_READ_WRITE, data->resolveBufferByIndex(config->valueCacheBufferIndex)});
+        } break;
         case OP_MULTIHEAD_ATT: {
             const NnMultiHeadAttOpConfig *config = (NnMultiHeadAttOpConfig *)opConfig->config;
             a.push_back({ACCESS_READONLY, data->resolvePipeByIndex(config->positionPipeIndex)});
+            a.push_back({ACCESS_READONLY, data->resolvePipeByIndex(config->slotPipeIndex)});
             a.push_back({ACCESS_READONLY, data->resolveBufferByIndex(config->queryBufferIndex)});
             a.push_back({ACCESS_READONLY, data->resolveBufferByIndex(config->keyCacheBufferIndex)});
             a.push_back({ACCESS_READONLY, data->resolveBufferByIndex(config->valueCacheBufferIndex)});
@@ -669,6 +705,7 @@ static std::vector<NnUint> resolveShaderConstants(const NnOpConfig *opConfig, co
     if (
         opConfig->code == OP_CAST ||
         opConfig->code == OP_MATMUL ||
+        opConfig->code == OP_MATMUL_QKV ||
         opConfig->code == OP_MERGE_SUM ||
         opConfig->code == OP_MUL ||
         opConfig->code == OP_REPEAT_Z ||
@@ -679,7 +716,7 @@ static std::vector<NnUint> resolveShaderConstants(const NnOpConfig *opConfig, co
         const NnUint nZ = resolveNumberOfBatchInfoZ(inputSize, outputSize);
         consts.push_back(nZ);
     }
-    if (opConfig->code == OP_MATMUL) {
+    if (opConfig->code == OP_MATMUL || opConfig->code == OP_MATMUL_QKV) {
         if (opConfig->weightSize.floatType == F_Q40) {
             constexpr NnUint tileSizeX = 2; // Shader constant
             assert(inputSize.x % (Q40_BLOCK_SIZE * tileSizeX) == 0);
@@ -713,7 +750,7 @@ static NnUint resolveShaderNumberOfWorkGroupsX(const NnOpConfig *opConfig, const
             return 32u;
         }
     }
-    if (opConfig->code == OP_MATMUL) {
+    if (opConfig->code == OP_MATMUL || opConfig->code == OP_MATMUL_QKV) {
         if (opConfig->weightSize.floatType == F_Q40) {
             constexpr NnUint tileSizeD = 8u; // Shader constant
             assert(opConfig->weightSize.x % tileSizeD == 0u);
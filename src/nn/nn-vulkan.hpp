@@ -115,6 +115,8 @@ public:
     ~NnVulkanDevice() override;
     NnUint maxNThreads() override;
     NnDeviceSegment *createSegment(NnUint segmentIndex) override;
+    void readBuffer(NnUint bufferIndex, NnSize offset, NnSize nBytes, NnByte *data) override;
+    void writeBuffer(NnUint bufferIndex, NnSize offset, NnSize nBytes, const NnByte *data) override;
 };
 
 class NnVulkanDeviceSegmentData {
@@ -0,0 +1,216 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "tokenizer.hpp"
+
+// Usage: tokenizer-bench [--tokenizer <path>] [--corpus <path>] [--nthreads <n>] [--repeats <n>]
+// Prints one JSON object per line. The sampler is measured always, the encoder and the decoder
+// only when a tokenizer is given.
+
+#define ENCODE_SIZES_N 3
+static const size_t encodeSizes[ENCODE_SIZES_N] = {1024, 64 * 1024, 1024 * 1024};
+
+static const char *words[] = {
+    "the", "of", "and", "to", "in", "is", "that", "for", "it", "as", "was", "with", "be", "by",
+    "on", "not", "he", "this", "are", "or", "his", "from", "at", "which", "but", "have", "an",
+    "model", "token", "network", "distributed", "inference", "worker", "root", "node", "cluster",
+    "2025", "3.14", "(x)", "[0]", "=>", "::", "é", "ü", "日本", "🙂"
+};
+
+typedef struct {
+    const char *tokenizerPath;
+    const char *corpusPath;
+    unsigned int nThreads;
+    unsigned int nRepeats;
+} BenchArgs;
+
+static unsigned long long nextRandom(unsigned long long *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static double elapsedMs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static std::string buildWordCorpus(size_t size) {
+    std::string text;
+    unsigned long long state = 88172645463325252ull;
+    const size_t nWords = sizeof(words) / sizeof(words[0]);
+    while (text.size() < size) {
+        const unsigned long long r = nextRandom(&state);
+        text += words[(r >> 8) % nWords];
+        text += (r & 31) == 0 ? ".\n" : ((r & 15) == 1 ? ", " : " ");
+    }
+    text.resize(size);
+    return text;
+}
+
+static bool isCompleteUtf8(const char *piece) {
+    const unsigned char *c = (const unsigned char *)piece;
+    while (*c != '\0') {
+        const int length = *c < 0x80 ? 1 : (*c >> 5) == 0x6 ? 2 : (*c >> 4) == 0xE ? 3 : (*c >> 3) == 0x1E ? 4 : 0;
+        if (length == 0)
+            return false;
+        for (int i = 1; i < length; i++) {
+            if ((c[i] & 0xC0) != 0x80)
+                return false;
+        }
+        c += length;
+    }
+    return true;
+}
+
+static std::string buildVocabCorpus(Tokenizer *tokenizer, size_t size) {
+    // Random regular tokens glued together, it covers the whole vocabulary unlike plain words. Tokens
+    // with a part of a multi-byte sequence are skipped, so the decoder sees valid text
+    std::vector<const char *> pieces;
+    const unsigned int nRegularTokens = tokenizer->bosId > 0 ? tokenizer->bosId : tokenizer->vocabSize;
+    for (unsigned int i = 0; i < nRegularTokens; i++) {
+        if (tokenizer->vocab[i][0] != '\0' && isCompleteUtf8(tokenizer->vocab[i]))
+            pieces.push_back(tokenizer->vocab[i]);
+    }
+    if (pieces.empty())
+        throw std::runtime_error("The tokenizer has no complete UTF-8 token");
+    std::string text;
+    unsigned long long state = 2463534242ull;
+    while (text.size() < size)
+        text += pieces[(nextRandom(&state) >> 8) % pieces.size()];
+    text.resize(size);
+    return text;
+}
+
+static std::string readCorpus(const char *path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        throw std::runtime_error("Cannot open corpus file");
+    std::stringstream stream;
+    stream << file.rdbuf();
+    return stream.str();
+}
+
+static void benchEncode(Tokenizer *tokenizer, const char *corpus, std::string text, BenchArgs *args) {
+    // A multi-byte sequence cut by the corpus size may not be a token of a SentencePiece vocabulary
+    size_t last = text.size();
+    while (last > 0 && text.size() - last < 3 && (text[last - 1] & 0xC0) == 0x80)
+        last--;
+    if (last > 0 && !isCompleteUtf8(text.c_str() + last - 1))
+        text.resize(last - 1);
+    std::vector<int> tokens(text.size() + 3);
+    int nTokens = 0;
+    double bestMs = 1e30;
+    for (unsigned int r = 0; r < args->nRepeats; r++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        tokenizer->encode((char *)text.c_str(), tokens.data(), &nTokens, true, true);
+        bestMs = std::min(bestMs, elapsedMs(start));
+    }
+    printf("{\"bench\":\"encode\",\"corpus\":\"%s\",\"bytes\":%zu,\"threads\":%u,\"tokens\":%d,\"ms\":%.3f,\"mb_per_s\":%.2f}\n",
+        corpus, text.size(), args->nThreads, nTokens, bestMs, text.size() / (bestMs * 1000.0));
+
+    double bestDecodeMs = 1e30;
+    size_t nBytes = 0;
+    for (unsigned int r = 0; r < args->nRepeats; r++) {
+        nBytes = 0;
+        tokenizer->resetDecoder();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (int i = 0; i < nTokens; i++) {
+            char *piece = tokenizer->decode(tokens[i]);
+            if (piece != nullptr)
+                nBytes += std::strlen(piece);
+        }
+        bestDecodeMs = std::min(bestDecodeMs, elapsedMs(start));
+    }
+    printf("{\"bench\":\"decode\",\"corpus\":\"%s\",\"tokens\":%d,\"bytes\":%zu,\"ms\":%.3f,\"tokens_per_s\":%.0f,\"mb_per_s\":%.2f}\n",
+        corpus, nTokens, nBytes, bestDecodeMs, nTokens / (bestDecodeMs / 1000.0), nBytes / (bestDecodeMs * 1000.0));
+}
+
+static void benchSampler(const char *name, int vocabSize, float temperature, float topp, int topk, float minp, BenchArgs *args) {
+    std::vector<float> logits(vocabSize);
+    unsigned long long state = 88172645463325252ull;
+    for (int i = 0; i < vocabSize; i++) {
+        // Normal distribution with a deviation of 3, close to the logits of a trained model
+        const float u0 = ((nextRandom(&state) >> 40) + 1.0f) / (float)(1 << 24);
+        const float u1 = (nextRandom(&state) >> 40) / (float)(1 << 24);
+        logits[i] = 3.0f * sqrtf(-2.0f * logf(u0)) * cosf(6.2831853f * u1);
+    }
+    std::vector<float> x(vocabSize);
+
+    Sampler sampler(vocabSize, temperature, topp, topk, minp, 12345, args->nThreads);
+    const unsigned int nSamples = 20 * args->nRepeats;
+    double totalMs = 0.0;
+    double bestMs = 1e30;
+    for (unsigned int i = 0; i < nSamples; i++) {
+        x = logits;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        sampler.sample(x.data());
+        const double ms = elapsedMs(start);
+        totalMs += ms;
+        bestMs = std::min(bestMs, ms);
+    }
+    printf("{\"bench\":\"sample\",\"setting\":\"%s\",\"vocab\":%d,\"threads\":%u,\"mean_us\":%.1f,\"min_us\":%.1f}\n",
+        name, vocabSize, args->nThreads, totalMs * 1000.0 / nSamples, bestMs * 1000.0);
+}
+
+static BenchArgs parseArgs(int argc, char **argv) {
+    BenchArgs args;
+    args.tokenizerPath = nullptr;
+    args.corpusPath = nullptr;
+    args.nThreads = 1;
+    args.nRepeats = 5;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        const char *name = argv[i];
+        const char *value = argv[i + 1];
+        if (std::strcmp(name, "--tokenizer") == 0) args.tokenizerPath = value;
+        else if (std::strcmp(name, "--corpus") == 0) args.corpusPath = value;
+        else if (std::strcmp(name, "--nthreads") == 0) args.nThreads = atoi(value);
+        else if (std::strcmp(name, "--repeats") == 0) args.nRepeats = atoi(value);
+        else throw std::runtime_error(std::string("Unknown option: ") + name);
+    }
+    if (argc % 2 == 0)
+        throw std::runtime_error("Every option requires a value");
+    if (args.nThreads < 1 || args.nRepeats < 1)
+        throw std::runtime_error("Invalid --nthreads or --repeats");
+    return args;
+}
+
+int main(int argc, char **argv) {
+    try {
+        BenchArgs args = parseArgs(argc, argv);
+
+        if (args.tokenizerPath != nullptr) {
+            Tokenizer tokenizer(args.tokenizerPath, args.nThreads);
+            for (int i = 0; i < ENCODE_SIZES_N; i++) {
+                const size_t size = encodeSizes[i];
+                benchEncode(&tokenizer, "words", buildWordCorpus(size), &args);
+                benchEncode(&tokenizer, "vocab", buildVocabCorpus(&tokenizer, size), &args);
+            }
+            if (args.corpusPath != nullptr)
+                benchEncode(&tokenizer, "file", readCorpus(args.corpusPath), &args);
+        }
+
+        const int vocabSizes[] = {32000, 128256, 151936};
+        for (int i = 0; i < 3; i++) {
+            const int vocabSize = vocabSizes[i];
+            benchSampler("greedy", vocabSize, 0.0f, 0.0f, 0, 0.0f, &args);
+            benchSampler("temp", vocabSize, 0.8f, 0.0f, 0, 0.0f, &args);
+            benchSampler("topp", vocabSize, 0.8f, 0.9f, 0, 0.0f, &args);
+            benchSampler("topk", vocabSize, 0.8f, 0.0f, 40, 0.0f, &args);
+            benchSampler("minp", vocabSize, 0.8f, 0.0f, 0, 0.05f, &args);
+            benchSampler("topk_topp_minp", vocabSize, 0.8f, 0.9f, 40, 0.05f, &args);
+        }
+    } catch (const std::exception &e) {
+        fprintf(stderr, "🚨 Critical error: %s\n", e.what());
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
@@ -1,4 +1,5 @@
 #include <cassert>
+#include <cmath>
 #include <cstring>
 #include "tokenizer.hpp"
 
@@ -302,9 +303,189 @@ void testEosDetectorWithoutPadding() {
     printOk("eosDetectorWithLongPadding");
 }
 
+void testSamplerTopkMinp() {
+    const int vocabSize = 8;
+    const float logits[vocabSize] = {0.1f, 2.0f, -1.0f, 1.5f, 0.0f, 3.0f, -0.5f, 1.9f};
+    float x[vocabSize];
+
+    // top-k keeps the k largest logits only: 5, 1, 7
+    Sampler topk(vocabSize, 1.0f, 0.0f, 3, 0.0f, 12345, 1);
+    for (int i = 0; i < 1000; i++) {
+        std::memcpy(x, logits, sizeof(x));
+        int token = topk.sample(x);
+        assert(token == 5 || token == 1 || token == 7);
+    }
+    Sampler top1(vocabSize, 1.0f, 0.0f, 1, 0.0f, 12345, 1);
+    std::memcpy(x, logits, sizeof(x));
+    ASSERT_EQ(top1.sample(x), 5);
+
+    // min-p 0.5 keeps tokens at least half as likely as the best one: exp(l - 3) >= 0.5
+    Sampler minp(vocabSize, 1.0f, 0.0f, 0, 0.5f, 12345, 1);
+    for (int i = 0; i < 1000; i++) {
+        std::memcpy(x, logits, sizeof(x));
+        ASSERT_EQ(minp.sample(x), 5);
+    }
+    Sampler topkMinp(vocabSize, 1.0f, 0.0f, 4, 0.3f, 12345, 1);
+    for (int i = 0; i < 1000; i++) {
+        std::memcpy(x, logits, sizeof(x));
+        int token = topkMinp.sample(x);
+        assert(token == 5 || token == 1 || token == 7);
+    }
+
+    printOk("samplerTopkMinp");
+}
+
+void testSamplerParallel() {
+    // The vocabulary is split into 4 slices, the result must match the single-threaded sampler
+    const int vocabSize = 4 * 8192;
+    std::vector<float> logits(vocabSize);
+    unsigned long long state = 88172645463325252ull;
+    for (int i = 0; i < vocabSize; i++) {
+        state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+        logits[i] = (float)(state >> 40) / (float)(1 << 24) * 30.0f; // peaky and almost free of ties
+    }
+    std::vector<float> x(vocabSize);
+
+    const float temperatures[] = {0.0f, 0.7f, 0.7f, 0.7f, 0.7f};
+    const float topps[] = {0.0f, 0.0f, 0.9f, 0.0f, 0.9f};
+    const int topks[] = {0, 0, 0, 40, 40};
+    // Without truncation every token is a candidate, the float cumulative sum over the whole
+    // vocabulary drifts differently when slices are walked separately
+    const int minEqual[] = {200, 195, 200, 200, 200};
+    for (int c = 0; c < 5; c++) {
+        Sampler serial(vocabSize, temperatures[c], topps[c], topks[c], 0.0f, 777, 1);
+        Sampler parallel(vocabSize, temperatures[c], topps[c], topks[c], 0.0f, 777, 4);
+        int nEqual = 0;
+        for (int i = 0; i < 200; i++) {
+            x = logits;
+            int a = serial.sample(x.data());
+            x = logits;
+            int b = parallel.sample(x.data());
+            assert(b >= 0 && b < vocabSize);
+            if (a == b)
+                nEqual++;
+        }
+        assert(nEqual >= minEqual[c]);
+    }
+
+    // Only a few logits are finite like after --logits-topk, the slices of -inf logits have no mass.
+    // The slices of a 32001 vocabulary split into 3 are not a multiple of the SIMD width
+    const int sparseVocabSize = 32001;
+    std::vector<float> sparseLogits(sparseVocabSize, -INFINITY);
+    for (int i = 0; i < 40; i++)
+        sparseLogits[i * 191] = logits[i];
+    x.resize(sparseVocabSize);
+    for (int c = 0; c < 2; c++) {
+        Sampler serial(sparseVocabSize, 0.8f, c == 0 ? 0.0f : 0.9f, 0, 0.0f, 777, 1);
+        Sampler parallel(sparseVocabSize, 0.8f, c == 0 ? 0.0f : 0.9f, 0, 0.0f, 777, 3);
+        for (int i = 0; i < 50; i++) {
+            x = sparseLogits;
+            int a = serial.sample(x.data());
+            x = sparseLogits;
+            int b = parallel.sample(x.data());
+            assert(b % 191 == 0 && b < 40 * 191);
+            assert(a == b);
+        }
+    }
+    printOk("samplerParallel");
+}
+
+// A small BPE tokenizer with byte tokens, a few merges and two special tokens
+void writeTestTokenizer(const char *path) {
+    const char *merges[] = {"th", "he", "the", " the", "an", "and", " and", "at", " c", " cat", " h", " hat", "in", "ing", " s", " sing"};
+    const int nMerges = sizeof(merges) / sizeof(merges[0]);
+    const char *specials[] = {"<s>", "<|sep|>"};
+    std::vector<std::string> vocab;
+    std::vector<float> scores;
+    for (int b = 1; b < 256; b++) {
+        vocab.push_back(std::string(1, (char)b));
+        scores.push_back(0.0f);
+    }
+    for (int i = 0; i < nMerges; i++) {
+        vocab.push_back(merges[i]);
+        scores.push_back(-(float)i);
+    }
+    const int bosId = vocab.size();
+    for (int i = 0; i < 2; i++) {
+        vocab.push_back(specials[i]);
+        scores.push_back(0.0f);
+    }
+
+    FILE *file = fopen(path, "wb");
+    assert(file != NULL);
+    const int header[] = {0x567124, 10 * sizeof(int), TOK_VERSION, 1, TOK_VOCAB_SIZE, (int)vocab.size(), MAX_TOKEN_LENGTH, 7, BOS_ID, bosId};
+    fwrite(header, sizeof(header), 1, file);
+    for (size_t i = 0; i < vocab.size(); i++) {
+        const int length = vocab[i].size();
+        fwrite(&scores[i], sizeof(float), 1, file);
+        fwrite(&length, sizeof(int), 1, file);
+        fwrite(vocab[i].data(), length, 1, file);
+    }
+    fclose(file);
+}
+
+void testEncodeParallel() {
+    // The text is long enough to be split into 4 chunks, the result must match the single-threaded encoder
+    const char *path = "tokenizer-test.t";
+    writeTestTokenizer(path);
+
+    const char *words[] = {"the", " cat", " and", " hat", "<|sep|>", " sing", "ing", "\n", " ", "thethe"};
+    std::string text;
+    unsigned long long state = 88172645463325252ull;
+    while (text.size() < 4 * 16384 + 1000) {
+        state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+        text += words[(state >> 32) % 10];
+    }
+
+    Tokenizer sequential(path, 1);
+    Tokenizer parallel(path, 4);
+    std::vector<int> expectedTokens(text.size() + 3);
+    std::vector<int> tokens(text.size() + 3);
+    int nExpectedTokens;
+    int nTokens;
+    sequential.encode((char *)text.c_str(), expectedTokens.data(), &nExpectedTokens, true, true);
+    parallel.encode((char *)text.c_str(), tokens.data(), &nTokens, true, true);
+    std::remove(path);
+
+    assert(nExpectedTokens < (int)text.size() / 2);
+    compare("encodeParallel", expectedTokens.data(), tokens.data(), nExpectedTokens, nTokens);
+}
+
+void testIncrementalEncoder() {
+    const char *path = "tokenizer-test.t";
+    writeTestTokenizer(path);
+    Tokenizer tokenizer(path, 1);
+    std::remove(path);
+    IncrementalEncoder encoder(&tokenizer);
+
+    // Every prompt must be encoded as a whole, the tokens before the changed tail are reused
+    const char *prompts[] = {
+        "<|sep|>the cat and the hat<|sep|>",
+        "<|sep|>the cat and the hat<|sep|> the cat sing",
+        "<|sep|>the cat and the hat<|sep|> the cat singing and",
+        "<|sep|>the cat and the hat<|sep|> the cat sin",
+        "<|sep|>the cat",
+        "the hat",
+        "",
+        "the hat and",
+    };
+    const int nReusedTokens[] = {0, 8, 11, 10, 4, 0, 0, 0};
+    for (int i = 0; i < 8; i++) {
+        std::vector<int> expectedTokens(std::strlen(prompts[i]) + 3);
+        int nExpectedTokens;
+        tokenizer.encode((char *)prompts[i], expectedTokens.data(), &nExpectedTokens, true, true);
+        ASSERT_EQ((int)encoder.encode(prompts[i]), nReusedTokens[i]);
+        const std::vector<int> &tokens = encoder.getTokens();
+        ASSERT_EQ((int)tokens.size(), nExpectedTokens);
+        for (int j = 0; j < nExpectedTokens; j++)
+            ASSERT_EQ(tokens[j], expectedTokens[j]);
+    }
+    printOk("incrementalEncoder");
+}
+
 int main() {
 #if DEV_TESTS
-    Tokenizer tokenizer("models/llama3_2_1b_instruct_q40/dllama_tokenizer_llama3_2_1b_instruct_q40.t");
+    Tokenizer tokenizer("models/llama3_2_1b_instruct_q40/dllama_tokenizer_llama3_2_1b_instruct_q40.t", 1);
     dev_testEncode(&tokenizer);
     dev_testDecoderEmoji(&tokenizer);
     dev_testDecoderEmojiWithEos(&tokenizer);
@@ -315,5 +496,9 @@ int main() {
     testEosDetectorWithPadding();
     testEosDetectorWithLongPadding();
     testEosDetectorWithoutPadding();
+    testSamplerTopkMinp();
+    testSamplerParallel();
+    testEncodeParallel();
+    testIncrementalEncoder();
     return 0;
 }
@@ -7,20 +7,24 @@
 #include <ctype.h>
 #include <ctime>
 #include <cassert>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <queue>
 #include <stdexcept>
 #include <sstream>
 #include <vector>
 #include "nn/nn-core.hpp"
 #include "nn/nn-cpu-ops.hpp"
+#include "nn/pthread.h"
 #include "tokenizer.hpp"
 #if defined(__ARM_NEON)
     #include <arm_neon.h>
 #endif
 
 #define DEBUG_TOKENIZER_ENCODER false
-#define DEBUG_TOKENIZER_BENCHMARK false
 #define DEBUG_TEMPLATE_GENERATOR false
-#define DEBUG_SAMPLER_BENCHMARK false
 
 unsigned int randomU32(unsigned long long *state) {
     // xorshift rng: https://en.wikipedia.org/wiki/Xorshift#xorshift.2A
@@ -35,15 +39,53 @@ float randomF32(unsigned long long *state) {
     return (randomU32(state) >> 8) / 16777216.0f;
 }
 
-int compareTokens(const void *a, const void *b) {
-    return strcmp(((TokenIndex*)a)->str, ((TokenIndex*)b)->str);
+static uint64_t hashPiece(uint64_t hash, const char *piece, size_t length) {
+    // FNV-1a, it can continue from the hash of a preceding piece
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)piece[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
 }
 
-Tokenizer::Tokenizer(const char* tokenizerPath)
-    : eosTokenIds() {
+#define PIECE_HASH_SEED 0xcbf29ce484222325ull
+
+typedef struct {
+    float score;
+    int left; // Symbol index, symbols keep the order of the text
+    int right;
+    int leftToken;
+    int rightToken;
+    int id;
+} TokenizerMerge;
+
+#define TOKENIZER_MIN_THREAD_CHUNK 16384
+
+typedef struct {
+    Tokenizer *tokenizer;
+    char *text;
+    char *end;
+    int *tokens;
+    int nTokens;
+    bool addSpecialTokens;
+    PthreadHandler handler;
+} TokenizerChunk;
+
+struct CompareTokenizerMerges {
+    bool operator()(const TokenizerMerge &a, const TokenizerMerge &b) const {
+        // The best score goes first, the leftmost pair wins a tie
+        if (a.score != b.score)
+            return a.score < b.score;
+        return a.left > b.left;
+    }
+};
+
+Tokenizer::Tokenizer(const char* tokenizerPath, unsigned int nThreads)
+    : nThreads(nThreads), eosTokenIds() {
     bosId = -1;
     chatTemplate = nullptr;
     maxTokenLength = 0;
+    addBos = true; // Tokenizers without the ADD_BOS key always added it
 
     // read in the file
     FILE *file = fopen(tokenizerPath, "rb");
@@ -139,17 +181,47 @@ Tokenizer::Tokenizer(const char* tokenizerPath)
     regularVocabSize = bosId;
     specialVocabSize = vocabSize - regularVocabSize;
 
-    regularVocab = new TokenIndex[regularVocabSize];
+    size_t nBuckets = 1;
+    while (nBuckets < regularVocabSize * 2)
+        nBuckets <<= 1;
+    regularTokenTable.resize(nBuckets, -1);
     for (int i = 0; i < regularVocabSize; i++) {
-        regularVocab[i].str = vocab[i];
-        regularVocab[i].id = i;
+        size_t bucket = hashPiece(PIECE_HASH_SEED, vocab[i], vocabLength[i]) & (nBuckets - 1);
+        while (regularTokenTable[bucket] != -1) {
+            int id = regularTokenTable[bucket];
+            if (vocabLength[id] == vocabLength[i] && std::memcmp(vocab[id], vocab[i], vocabLength[i]) == 0)
+                break; // A duplicate keeps the lowest id
+            bucket = (bucket + 1) & (nBuckets - 1);
+        }
+        if (regularTokenTable[bucket] == -1)
+            regularTokenTable[bucket] = i;
     }
-    qsort(regularVocab, regularVocabSize, sizeof(TokenIndex), compareTokens);
 
-    specialVocab = new TokenIndex[specialVocabSize];
-    for (int i = 0; i < specialVocabSize; i++) {
-        specialVocab[i].str = vocab[i + regularVocabSize];
-        specialVocab[i].id = i + regularVocabSize;
+    specialTokenTrie.push_back(SpecialTokenNode{-1, -1, -1, 0});
+    for (int i = regularVocabSize; i < vocabSize; i++) {
+        int node = 0;
+        for (unsigned int j = 0; j < vocabLength[i]; j++) {
+            const unsigned char c = vocab[i][j];
+            int child = specialTokenTrie[node].firstChild;
+            while (child != -1 && specialTokenTrie[child].c != c)
+                child = specialTokenTrie[child].nextSibling;
+            if (child == -1) {
+                child = specialTokenTrie.size();
+                specialTokenTrie.push_back(SpecialTokenNode{-1, -1, specialTokenTrie[node].firstChild, c});
+                specialTokenTrie[node].firstChild = child;
+            }
+            node = child;
+        }
+        if (node != 0 && specialTokenTrie[node].tokenId == -1)
+            specialTokenTrie[node].tokenId = i;
+    }
+
+    tokenBytePairs.resize(65536 / 64, 0);
+    for (int i = 0; i < vocabSize; i++) {
+        for (unsigned int j = 1; j < vocabLength[i]; j++) {
+            const unsigned int pair = ((unsigned char)vocab[i][j - 1] << 8) | (unsigned char)vocab[i][j];
+            tokenBytePairs[pair / 64] |= 1ull << (pair % 64);
+        }
     }
 
     strBufferSize = maxTokenLength * 2;
@@ -171,8 +243,6 @@ Tokenizer::~Tokenizer() {
     delete[] vocab;
     delete[] vocabLength;
     delete[] vocabScores;
-    delete[] regularVocab;
-    delete[] specialVocab;
     delete[] strBuffer;
     delete[] utf8Buffer;
 }
@@ -194,19 +264,40 @@ void Tokenizer::printHeader() {
 }
 
 int Tokenizer::findSpecialTokenStartWith(char *piece) {
-    for (unsigned int i = 0; i < specialVocabSize; i++) {
-        unsigned int tokenId = specialVocab[i].id;
-        unsigned int length = vocabLength[tokenId];
-        if (std::strncmp(vocab[tokenId], piece, length) == 0)
-            return tokenId;
+    // Walks the trie along the piece, if several special tokens are prefixes of the piece the lowest id wins
+    int tokenId = -1;
+    int node = 0;
+    for (const unsigned char *c = (const unsigned char *)piece; *c != '\0'; c++) {
+        node = specialTokenTrie[node].firstChild;
+        while (node != -1 && specialTokenTrie[node].c != *c)
+            node = specialTokenTrie[node].nextSibling;
+        if (node == -1)
+            break;
+        const int nodeTokenId = specialTokenTrie[node].tokenId;
+        if (nodeTokenId != -1 && (tokenId == -1 || nodeTokenId < tokenId))
+            tokenId = nodeTokenId;
     }
-    return -1;
+    return tokenId;
 }
 
 int Tokenizer::findRegularToken(char *piece) {
-    TokenIndex tok = { .str = piece };
-    TokenIndex *res = (TokenIndex*)bsearch(&tok, regularVocab, regularVocabSize, sizeof(TokenIndex), compareTokens);
-    return res != NULL ? res->id : -1;
+    return findRegularToken(piece, std::strlen(piece), nullptr, 0);
+}
+
+int Tokenizer::findRegularToken(const char *left, size_t leftLength, const char *right, size_t rightLength) {
+    const size_t mask = regularTokenTable.size() - 1;
+    const size_t length = leftLength + rightLength;
+    size_t bucket = hashPiece(hashPiece(PIECE_HASH_SEED, left, leftLength), right, rightLength) & mask;
+    for (;;) {
+        int id = regularTokenTable[bucket];
+        if (id == -1)
+            return -1;
+        if (vocabLength[id] == length &&
+            std::memcmp(vocab[id], left, leftLength) == 0 &&
+            std::memcmp(vocab[id] + leftLength, right, rightLength) == 0)
+            return id;
+        bucket = (bucket + 1) & mask;
+    }
 }
 
 bool Tokenizer::isEos(int token) {
@@ -221,6 +312,17 @@ void Tokenizer::resetDecoder() {
     strBufferPos = 0;
 }
 
+std::string Tokenizer::getDecoderState() {
+    return std::string(strBuffer, strBufferPos);
+}
+
+void Tokenizer::setDecoderState(const std::string &state) {
+    assert(state.size() + 1 < strBufferSize);
+    std::memcpy(strBuffer, state.data(), state.size());
+    strBufferPos = state.size();
+    strBuffer[strBufferPos] = '\0';
+}
+
 char *Tokenizer::detokUtf8() {
     char* src = strBuffer;
     char* dst = utf8Buffer;
@@ -308,21 +410,71 @@ char *Tokenizer::decode(int token) {
     return detokUtf8();
 }
 
+bool Tokenizer::isChunkBoundary(const char *c) {
+    const unsigned int pair = ((unsigned char)c[-1] << 8) | (unsigned char)c[0];
+    return (tokenBytePairs[pair / 64] & (1ull << (pair % 64))) == 0;
+}
+
+void *Tokenizer::encodeChunkThread(void *arg) {
+    TokenizerChunk *chunk = (TokenizerChunk *)arg;
+    chunk->tokenizer->encodeChunk(chunk->text, chunk->end, chunk->tokens, &chunk->nTokens, chunk->addSpecialTokens);
+    return nullptr;
+}
+
 void Tokenizer::encode(char *text, int *tokens, int *nTokens, bool isStart, bool addSpecialTokens) {
-#if DEBUG_TOKENIZER_BENCHMARK
-    Timer startTime;
-#endif
     if (text == nullptr)
         throw std::runtime_error("Input text is null");
 
-    size_t strLen = 0;
-
     *nTokens = 0;
 
     if (isStart && addBos && bosId >= 0)
         tokens[(*nTokens)++] = bosId;
 
-    for (char *c = text; *c != '\0'; c++) {
+    // A long text is split where no token spans two bytes, no merge crosses such a split so the chunks
+    // are encoded in parallel. Every chunk writes at the offset of its text, it has at most one token per byte
+    const size_t length = std::strlen(text);
+    const size_t nChunks = std::max((size_t)1, std::min((size_t)nThreads, length / TOKENIZER_MIN_THREAD_CHUNK));
+    std::vector<TokenizerChunk> chunks;
+    char *start = text;
+    for (size_t i = 1; i < nChunks; i++) {
+        char *c = std::max(start + 1, text + length * i / nChunks);
+        char *limit = text + length * (i + 1) / nChunks;
+        while (c < limit && !isChunkBoundary(c))
+            c++;
+        if (c == limit)
+            continue;
+        chunks.push_back(TokenizerChunk{this, start, c, &tokens[*nTokens + (start - text)], 0, addSpecialTokens});
+        start = c;
+    }
+    chunks.push_back(TokenizerChunk{this, start, text + length, &tokens[*nTokens + (start - text)], 0, addSpecialTokens});
+
+    for (size_t i = 1; i < chunks.size(); i++) {
+        int result = pthread_create(&chunks[i].handler, NULL, (PthreadFunc)encodeChunkThread, (void *)&chunks[i]);
+        assert(result == 0 && "Failed to create thread");
+    }
+    encodeChunk(chunks[0].text, chunks[0].end, chunks[0].tokens, &chunks[0].nTokens, addSpecialTokens);
+    for (size_t i = 1; i < chunks.size(); i++)
+        pthread_join(chunks[i].handler, NULL);
+
+    for (size_t i = 0; i < chunks.size(); i++) {
+        std::memmove(&tokens[*nTokens], chunks[i].tokens, chunks[i].nTokens * sizeof(int));
+        *nTokens += chunks[i].nTokens;
+    }
+
+#if DEBUG_TOKENIZER_ENCODER
+    printf("\033[1;33m[");
+    for (unsigned int i = 0; i < *nTokens; i++)
+        printf("%d,", tokens[i]);
+    printf("]\033[0m");
+#endif
+}
+
+void Tokenizer::encodeChunk(char *text, char *end, int *tokens, int *nTokens, bool addSpecialTokens) {
+    std::string piece;
+
+    *nTokens = 0;
+
+    for (char *c = text; c < end; c++) {
         if (addSpecialTokens) {
             int specialTokenId = findSpecialTokenStartWith(c);
             if (specialTokenId >= 0) {
@@ -332,61 +484,111 @@ void Tokenizer::encode(char *text, int *tokens, int *nTokens, bool isStart, bool
             }
         }
 
-        strBuffer[strLen] = *c;
-        strLen++;
-        assert(strLen < strBufferSize);
-        strBuffer[strLen] = '\0';
+        piece.push_back(*c);
+        assert(piece.size() <= maxTokenLength);
 
-        int id = findRegularToken(strBuffer);
+        int id = findRegularToken(piece.data(), piece.size(), nullptr, 0);
         if (id != -1) {
             tokens[(*nTokens)++] = id;
-            strLen = 0;
+            piece.clear();
         }
     }
 
-    assert(strLen == 0);
-
-    // merge the best consecutive pair each iteration, according the scores in vocab_scores
-    while (1) {
-        float best_score = -1e10;
-        int best_id = -1;
-        int best_idx = -1;
+    assert(piece.empty());
 
-        for (int i=0; i < (*nTokens-1); i++) {
-            // check if we can merge the pair (tokens[i], tokens[i+1])
-            snprintf(strBuffer, strBufferSize, "%s%s", vocab[tokens[i]], vocab[tokens[i+1]]);
-            int id = findRegularToken(strBuffer);
-            if (id != -1 && vocabScores[id] > best_score) {
-                // this merge pair exists in vocab! record its score and position
-                best_score = vocabScores[id];
-                best_id = id;
-                best_idx = i;
-            }
+    // merge the best consecutive pair each time, according the scores in vocab_scores. Symbols form
+    // a linked list and candidate pairs wait in a heap, a candidate is stale once one of its symbols
+    // has changed, so the whole text is never rescanned
+    const int n = *nTokens;
+    std::vector<int> next(n);
+    std::vector<int> prev(n);
+    for (int i = 0; i < n; i++) {
+        prev[i] = i - 1;
+        next[i] = i + 1 < n ? i + 1 : -1;
+    }
+    std::priority_queue<TokenizerMerge, std::vector<TokenizerMerge>, CompareTokenizerMerges> merges;
+    auto pushMerge = [&](int left) {
+        const int right = next[left];
+        const int leftToken = tokens[left];
+        const int rightToken = tokens[right];
+        int id = findRegularToken(vocab[leftToken], vocabLength[leftToken], vocab[rightToken], vocabLength[rightToken]);
+        if (id != -1 && vocabScores[id] > -1e10)
+            merges.push(TokenizerMerge{vocabScores[id], left, right, leftToken, rightToken, id});
+    };
+    for (int i = 0; i + 1 < n; i++)
+        pushMerge(i);
+
+    while (!merges.empty()) {
+        const TokenizerMerge merge = merges.top();
+        merges.pop();
+        if (next[merge.left] != merge.right || tokens[merge.left] != merge.leftToken || tokens[merge.right] != merge.rightToken)
+            continue;
+
+        // merge the consecutive pair (left, right) into new token id, the right symbol is unlinked
+        tokens[merge.left] = merge.id;
+        tokens[merge.right] = -1;
+        const int after = next[merge.right];
+        next[merge.left] = after;
+        if (after != -1) {
+            prev[after] = merge.left;
+            pushMerge(merge.left);
         }
+        if (prev[merge.left] != -1)
+            pushMerge(prev[merge.left]);
+    }
 
-        if (best_idx == -1) {
-            break; // we couldn't find any more pairs to merge, so we're done
-        }
+    *nTokens = 0;
+    for (int i = n > 0 ? 0 : -1; i != -1; i = next[i])
+        tokens[(*nTokens)++] = tokens[i];
+}
+
+IncrementalEncoder::IncrementalEncoder(Tokenizer *tokenizer)
+    : tokenizer(tokenizer) {}
 
-        // merge the consecutive pair (best_idx, best_idx+1) into new token best_id
-        tokens[best_idx] = best_id;
-        // delete token at position best_idx+1, shift the entire sequence back 1
-        for (int i = best_idx+1; i < (*nTokens-1); i++) {
-            tokens[i] = tokens[i+1];
+size_t IncrementalEncoder::match(const char *text) {
+    size_t length = 0;
+    while (length < this->text.size() && text[length] == this->text[length])
+        length++;
+    return length;
+}
+
+size_t IncrementalEncoder::encode(const char *text) {
+    const size_t length = std::strlen(text);
+    const size_t common = match(text);
+
+    // The reused tokens end at a position that splits both the old and the new text, the end of a text splits it too
+    const size_t nBosTokens = (!tokens.empty() && tokens[0] == tokenizer->bosId && tokenizer->addBos) ? 1 : 0;
+    size_t nReusedTokens = 0;
+    size_t reusedLength = 0;
+    size_t offset = 0;
+    for (size_t i = nBosTokens; i < tokens.size(); i++) {
+        offset += tokenizer->vocabLength[tokens[i]];
+        if (offset > common)
+            break;
+        if ((offset == this->text.size() || tokenizer->isChunkBoundary(&this->text[offset])) &&
+            (offset == length || tokenizer->isChunkBoundary(&text[offset]))) {
+            nReusedTokens = i + 1;
+            reusedLength = offset;
         }
-        (*nTokens)--; // token length decreased
     }
 
-#if DEBUG_TOKENIZER_BENCHMARK
-    NnUint duration = startTime.elapsedMicroseconds();
-    printf("🕒 [%22s] %u μs\n", "ENCODER", duration);
-#endif
-#if DEBUG_TOKENIZER_ENCODER
-    printf("\033[1;33m[");
-    for (unsigned int i = 0; i < *nTokens; i++)
-        printf("%d,", tokens[i]);
-    printf("]\033[0m");
-#endif
+    if (nReusedTokens == 0) {
+        tokens.resize(length + 3);
+        int nTokens;
+        tokenizer->encode((char *)text, tokens.data(), &nTokens, true, true);
+        tokens.resize(nTokens);
+    } else {
+        tokens.resize(nReusedTokens + length - reusedLength + 2);
+        int nTokens;
+        tokenizer->encode((char *)&text[reusedLength], &tokens[nReusedTokens], &nTokens, false, true);
+        tokens.resize(nReusedTokens + nTokens);
+    }
+    this->text.assign(text, length);
+    return nReusedTokens;
+}
+
+const std::vector<int> &IncrementalEncoder::getTokens() {
+    return tokens;
 }
 
 int sample_argmax(float* probabilities, int n) {
@@ -415,35 +617,13 @@ int sample_mult(float* probabilities, int n, float coin) {
     return n - 1; // in case of rounding errors
 }
 
-int compare(const void* a, const void* b) {
-    ProbIndex* a_ = (ProbIndex*) a;
-    ProbIndex* b_ = (ProbIndex*) b;
-    if (a_->prob > b_->prob) return -1;
-    if (a_->prob < b_->prob) return 1;
-    return 0;
+static bool compareProbIndex(const ProbIndex &a, const ProbIndex &b) {
+    return a.prob > b.prob;
 }
 
-int sample_topp(float* probabilities, int n, float topp, ProbIndex* probindex, float coin) {
-    // top-p sampling (or "nucleus sampling") samples from the smallest set of
-    // tokens that exceed probability topp. This way we never sample tokens that
-    // have very low probabilities and are less likely to go "off the rails".
-    // coin is a random number in [0, 1), usually from random_f32()
-
-    int n0 = 0;
-    // quicksort indices in descending order of probabilities
-    // values smaller than (1 - topp) / (n - 1) cannot be part of the result
-    // so for efficiency we crop these out as candidates before sorting
-    const float cutoff = (1.0f - topp) / (n - 1);
-    for (int i = 0; i < n; i++) {
-        if (probabilities[i] >= cutoff) {
-            probindex[n0].index = i;
-            probindex[n0].prob = probabilities[i];
-            n0++;
-        }
-    }
-    qsort(probindex, n0, sizeof(ProbIndex), compare);
-
-    // truncate the list where cumulative probability exceeds topp
+static int sample_sorted(ProbIndex* probindex, int n0, float topp, float coin) {
+    // probindex holds probabilities sorted in descending order, sample from the
+    // smallest prefix whose cumulative probability exceeds topp
     float cumulative_prob = 0.0f;
     int last_idx = n0 - 1; // in case of rounding errors consider all elements
     for (int i = 0; i < n0; i++) {
@@ -454,7 +634,6 @@ int sample_topp(float* probabilities, int n, float topp, ProbIndex* probindex, f
         }
     }
 
-    // sample from the truncated list
     float r = coin * cumulative_prob;
     float cdf = 0.0f;
     for (int i = 0; i <= last_idx; i++) {
@@ -466,48 +645,360 @@ int sample_topp(float* probabilities, int n, float topp, ProbIndex* probindex, f
     return probindex[last_idx].index; // in case of rounding errors
 }
 
-Sampler::Sampler(int vocab_size, float temperature, float topp, unsigned long long rngSeed) {
+static int sample_candidates(ProbIndex* probindex, int n0, float topp, float coin) {
+    // the nucleus is usually small, candidates are sorted in growing chunks until it is covered
+    float cumulative_prob = 0.0f;
+    int nSorted = 0;
+    while (nSorted < n0 && cumulative_prob <= topp) {
+        int end = std::min(n0, std::max(nSorted * 2, 64));
+        std::partial_sort(probindex + nSorted, probindex + end, probindex + n0, compareProbIndex);
+        for (int i = nSorted; i < end && cumulative_prob <= topp; i++)
+            cumulative_prob += probindex[i].prob;
+        nSorted = end;
+    }
+    return sample_sorted(probindex, nSorted, topp, coin);
+}
+
+static float topp_cutoff(int n, float topp) {
+    // values smaller than (1 - topp) / (n - 1) cannot be part of the result
+    // so for efficiency we crop these out as candidates before sorting
+    return topp < 1.0f ? (1.0f - topp) / (n - 1) : 0.0f;
+}
+
+static int collect_candidates(const float* probabilities, int start, int end, float cutoff, ProbIndex* probindex) {
+    int n0 = 0;
+    for (int i = start; i < end; i++) {
+        if (probabilities[i] >= cutoff) {
+            probindex[n0].index = i;
+            probindex[n0].prob = probabilities[i];
+            n0++;
+        }
+    }
+    return n0;
+}
+
+int sample_topp(float* probabilities, int n, float topp, float minp, ProbIndex* probindex, float coin) {
+    // top-p sampling (or "nucleus sampling") samples from the smallest set of
+    // tokens that exceed probability topp. This way we never sample tokens that
+    // have very low probabilities and are less likely to go "off the rails".
+    // min-p additionally drops tokens less likely than minp * the most likely one.
+    // coin is a random number in [0, 1), usually from random_f32()
+    float cutoff = topp_cutoff(n, topp);
+    if (minp > 0.0f)
+        cutoff = std::max(cutoff, minp * probabilities[sample_argmax(probabilities, n)]);
+
+    int n0 = collect_candidates(probabilities, 0, n, cutoff, probindex);
+    return sample_candidates(probindex, n0, topp, coin);
+}
+
+static int select_topk(const float* logits, int start, int end, int k, ProbIndex* heap) {
+    // keeps the k largest logits of the range in a min-heap, returns them sorted in descending order
+    k = std::min(k, end - start);
+    for (int i = 0; i < k; i++) {
+        heap[i].index = start + i;
+        heap[i].prob = logits[start + i];
+    }
+    std::make_heap(heap, heap + k, compareProbIndex);
+    for (int i = start + k; i < end; i++) {
+        if (logits[i] > heap[0].prob) {
+            std::pop_heap(heap, heap + k, compareProbIndex);
+            heap[k - 1].index = i;
+            heap[k - 1].prob = logits[i];
+            std::push_heap(heap, heap + k, compareProbIndex);
+        }
+    }
+    std::sort_heap(heap, heap + k, compareProbIndex);
+    return k;
+}
+
+static int sample_topk_sorted(ProbIndex* probindex, int k, float temperature, float topp, float minp, float coin) {
+    // probindex holds the k largest logits in descending order, the softmax is computed over them only
+    const float maxLogit = probindex[0].prob;
+    const float scale = 1.0f / temperature;
+    float sum = 0.0f;
+    for (int i = 0; i < k; i++) {
+        probindex[i].prob = expf((probindex[i].prob - maxLogit) * scale);
+        sum += probindex[i].prob;
+    }
+    const float invSum = 1.0f / sum;
+    int n0 = 0;
+    for (; n0 < k; n0++) {
+        probindex[n0].prob *= invSum;
+        if (n0 > 0 && probindex[n0].prob < minp * probindex[0].prob)
+            break;
+    }
+    return sample_sorted(probindex, n0, topp, coin);
+}
+
+int sample_topk(float* logits, int n, int k, float temperature, float topp, float minp, ProbIndex* probindex, float coin) {
+    assert(k > 0 && k <= n);
+    select_topk(logits, 0, n, k, probindex);
+    return sample_topk_sorted(probindex, k, temperature, topp, minp, coin);
+}
+
+// parallel sampling, every thread takes a slice of the vocabulary
+
+#define SAMPLER_MIN_THREAD_SLICE 8192
+
+enum SamplerPass {
+    PASS_ARGMAX,
+    PASS_TOPK,
+    PASS_SOFTMAX,
+};
+
+typedef struct {
+    float max;
+    int index;
+    float sum; // Probability mass of the slice after PASS_SOFTMAX
+    int nCandidates;
+} SamplerThreadState;
+
+struct SamplerThread {
+    Sampler *sampler;
+    NnUint threadIndex;
+    PthreadHandler handler;
+};
+
+struct SamplerTeam {
+    NnUint nThreads;
+    std::vector<SamplerThread> threads;
+    std::vector<SamplerThreadState> states;
+    std::vector<ProbIndex> topk; // nThreads * k candidates of PASS_TOPK
+    std::atomic_uint nArrived;
+    std::atomic_uint generation;
+    SamplerPass pass;
+    float *logits;
+    bool collect; // PASS_SOFTMAX collects top-p and min-p candidates
+    // The threads live as long as the sampler and sleep between passes
+    std::mutex mutex;
+    std::condition_variable startCond;
+    std::condition_variable doneCond;
+    NnUint nStartedPasses;
+    NnUint nBusyThreads;
+    bool isAlive;
+};
+
+void *Sampler::threadHandler(void *arg) {
+    SamplerThread *thread = (SamplerThread *)arg;
+    SamplerTeam *team = thread->sampler->team.get();
+    NnUint nPasses = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(team->mutex);
+            team->startCond.wait(lock, [&]() { return !team->isAlive || team->nStartedPasses != nPasses; });
+            if (!team->isAlive)
+                break;
+            nPasses = team->nStartedPasses;
+        }
+        thread->sampler->work(thread->threadIndex);
+        std::lock_guard<std::mutex> lock(team->mutex);
+        if (--team->nBusyThreads == 0)
+            team->doneCond.notify_one();
+    }
+    return nullptr;
+}
+
+void Sampler::barrier() {
+    const unsigned int generation = team->generation.load();
+    if (team->nArrived.fetch_add(1) == team->nThreads - 1) {
+        team->nArrived.store(0);
+        team->generation.fetch_add(1);
+    } else {
+        while (team->generation.load() == generation);
+    }
+}
+
+void Sampler::work(NnUint threadIndex) {
+    SPLIT_THREADS(start, end, (NnUint)vocab_size, team->nThreads, threadIndex);
+    SamplerThreadState *state = &team->states[threadIndex];
+    float *x = team->logits;
+
+    if (team->pass == PASS_ARGMAX) {
+        state->index = start + sample_argmax(&x[start], end - start);
+        state->max = x[state->index];
+        return;
+    }
+    if (team->pass == PASS_TOPK) {
+        state->nCandidates = select_topk(x, start, end, topk, &team->topk[threadIndex * topk]);
+        return;
+    }
+
+    // Every slice is normalized on its own first, then rescaled by its share of the whole sum
+    // A slice of -inf logits only has no probability mass, --logits-topk leaves such slices
+    const float scale = 1.0f / temperature;
+    state->max = x[start + sample_argmax(&x[start], end - start)];
+    if (state->max == -INFINITY) {
+        std::fill(&x[start], &x[end], 0.0f);
+        state->sum = 0.0f;
+    } else {
+        state->sum = softmaxScaled_F32(&x[start], end - start, scale);
+    }
+    barrier();
+
+    float max = team->states[0].max;
+    for (NnUint i = 1; i < team->nThreads; i++)
+        max = std::max(max, team->states[i].max);
+    float total = 0.0f;
+    for (NnUint i = 0; i < team->nThreads; i++) {
+        if (team->states[i].max != -INFINITY)
+            total += team->states[i].sum * expf((team->states[i].max - max) * scale);
+    }
+    barrier();
+
+    const float factor = state->max == -INFINITY ? 0.0f : state->sum * expf((state->max - max) * scale) / total;
+    for (NnUint i = start; i < end; i++)
+        x[i] *= factor;
+    state->sum = factor;
+
+    if (team->collect) {
+        // The most likely token has the probability 1 / total
+        float cutoff = topp_cutoff(vocab_size, topp);
+        if (minp > 0.0f)
+            cutoff = std::max(cutoff, minp / total);
+        state->nCandidates = collect_candidates(x, start, end, cutoff, &probindex[start]);
+    }
+}
+
+void Sampler::runPass(int pass, float *logits) {
+    team->pass = (SamplerPass)pass;
+    team->logits = logits;
+    team->nArrived.store(0);
+    team->generation.store(0);
+    {
+        std::lock_guard<std::mutex> lock(team->mutex);
+        team->nStartedPasses++;
+        team->nBusyThreads = team->nThreads - 1;
+    }
+    team->startCond.notify_all();
+    work(0);
+    std::unique_lock<std::mutex> lock(team->mutex);
+    team->doneCond.wait(lock, [&]() { return team->nBusyThreads == 0; });
+}
+
+int Sampler::sampleParallel(float *logits, float p, float coin) {
+    const NnUint nThreads = team->nThreads;
+    if (temperature == 0.0f) {
+        runPass(PASS_ARGMAX, logits);
+        NnUint best = 0;
+        for (NnUint i = 1; i < nThreads; i++) {
+            if (team->states[i].max > team->states[best].max)
+                best = i;
+        }
+        return team->states[best].index;
+    }
+    if (topk > 0 && topk < vocab_size) {
+        runPass(PASS_TOPK, logits);
+        int n0 = 0;
+        for (NnUint i = 0; i < nThreads; i++) {
+            std::memmove(&team->topk[n0], &team->topk[i * topk], team->states[i].nCandidates * sizeof(ProbIndex));
+            n0 += team->states[i].nCandidates;
+        }
+        std::partial_sort(team->topk.begin(), team->topk.begin() + topk, team->topk.begin() + n0, compareProbIndex);
+        std::memcpy(probindex, team->topk.data(), topk * sizeof(ProbIndex));
+        return sample_topk_sorted(probindex, topk, temperature, p, minp, coin);
+    }
+
+    team->collect = p < 1.0f || minp > 0.0f;
+    runPass(PASS_SOFTMAX, logits);
+    if (!team->collect) {
+        // find the slice holding the coin, then walk it only, rounding errors fall into the last slice with mass
+        NnUint last = 0;
+        for (NnUint i = 0; i < nThreads; i++) {
+            if (team->states[i].sum > 0.0f)
+                last = i;
+        }
+        float cdf = 0.0f;
+        for (NnUint i = 0; i < nThreads; i++) {
+            if (coin < cdf + team->states[i].sum || i == last) {
+                SPLIT_THREADS(start, end, (NnUint)vocab_size, nThreads, i);
+                return start + sample_mult(&logits[start], end - start, coin - cdf);
+            }
+            cdf += team->states[i].sum;
+        }
+    }
+    int n0 = 0;
+    for (NnUint i = 0; i < nThreads; i++) {
+        SPLIT_THREADS(start, end, (NnUint)vocab_size, nThreads, i);
+        std::memmove(&probindex[n0], &probindex[start], team->states[i].nCandidates * sizeof(ProbIndex));
+        n0 += team->states[i].nCandidates;
+    }
+    return sample_candidates(probindex, n0, p, coin);
+}
+
+Sampler::Sampler(int vocab_size, float temperature, float topp, int topk, float minp, unsigned long long rngSeed, unsigned int nThreads) {
     this->vocab_size = vocab_size;
     this->temperature = temperature;
     this->topp = topp;
+    this->topk = topk;
+    this->minp = minp;
     this->rngState = rngSeed;
-    // buffer only used with nucleus sampling; may not need but it's ~small
+    // buffer only used with nucleus and top-k sampling; may not need but it's ~small
     probindex = new ProbIndex[vocab_size];
+
+    nThreads = std::max(1u, std::min(nThreads, (unsigned int)vocab_size / SAMPLER_MIN_THREAD_SLICE));
+    if (nThreads > 1) {
+        team.reset(new SamplerTeam());
+        team->nThreads = nThreads;
+        team->threads.resize(nThreads);
+        team->states.resize(nThreads);
+        team->nStartedPasses = 0;
+        team->nBusyThreads = 0;
+        team->isAlive = true;
+        for (NnUint i = 0; i < nThreads; i++) {
+            team->threads[i].sampler = this;
+            team->threads[i].threadIndex = i;
+        }
+        for (NnUint i = 1; i < nThreads; i++) {
+            int result = pthread_create(&team->threads[i].handler, NULL, (PthreadFunc)threadHandler, (void *)&team->threads[i]);
+            assert(result == 0 && "Failed to create thread");
+        }
+    }
 }
 
 Sampler::~Sampler() {
+    if (team) {
+        {
+            std::lock_guard<std::mutex> lock(team->mutex);
+            team->isAlive = false;
+        }
+        team->startCond.notify_all();
+        for (NnUint i = 1; i < team->nThreads; i++)
+            pthread_join(team->threads[i].handler, NULL);
+    }
     delete[] probindex;
 }
 
 int Sampler::sample(float* logits) {
-#if DEBUG_SAMPLER_BENCHMARK
-    Timer startTime;
-#endif
     // sample the token given the logits and some hyperparameters
     int next;
-    if (temperature == 0.0f) {
+    // top-p is disabled outside of (0, 1)
+    float p = (topp <= 0 || topp >= 1) ? 1.0f : topp;
+    if (team) {
+        float coin = temperature == 0.0f ? 0.0f : randomF32(&rngState);
+        if (topk > 0 && topk < vocab_size)
+            team->topk.resize(team->nThreads * topk);
+        next = sampleParallel(logits, p, coin);
+    } else if (temperature == 0.0f) {
         // greedy argmax sampling: take the token with the highest probability
         next = sample_argmax(logits, vocab_size);
     } else {
-        // apply the temperature to the logits
-        for (int q=0; q < vocab_size; q++) { logits[q] /= temperature; }
-        // apply softmax to the logits to get the probabilities for next token
-        softmax_F32(logits, vocab_size);
         // flip a (float) coin (this is our source of entropy for sampling)
         float coin = randomF32(&rngState);
-        // we sample from this distribution to get the next token
-        if (topp <= 0 || topp >= 1) {
-            // simply sample from the predicted probability distribution
-            next = sample_mult(logits, vocab_size, coin);
+        if (topk > 0 && topk < vocab_size) {
+            // only the k most likely tokens get probabilities, the whole vocabulary is never exponentiated
+            next = sample_topk(logits, vocab_size, topk, temperature, p, minp, probindex, coin);
         } else {
-            // top-p (nucleus) sampling, clamping the least likely tokens to zero
-            next = sample_topp(logits, vocab_size, topp, probindex, coin);
+            // apply the temperature and softmax to the logits to get the probabilities for next token
+            softmaxScaled_F32(logits, vocab_size, 1.0f / temperature);
+            if (p == 1.0f && minp <= 0.0f) {
+                // simply sample from the predicted probability distribution
+                next = sample_mult(logits, vocab_size, coin);
+            } else {
+                // top-p (nucleus) and min-p sampling, clamping the least likely tokens to zero
+                next = sample_topp(logits, vocab_size, p, minp, probindex, coin);
+            }
         }
     }
-#if DEBUG_SAMPLER_BENCHMARK
-    NnUint duration = startTime.elapsedMicroseconds();
-    printf("🕒 [%22s] %u μs\n", "SAMPLER", duration);
-#endif
     return next;
 }
 
@@ -519,6 +1010,18 @@ void Sampler::setSeed(unsigned long long seed) {
     this->rngState = seed;
 }
 
+void Sampler::setTopp(float topp) {
+    this->topp = topp;
+}
+
+void Sampler::setTopk(int topk) {
+    this->topk = topk;
+}
+
+void Sampler::setMinp(float minp) {
+    this->minp = minp;
+}
+
 TokenizerChatStops::TokenizerChatStops(Tokenizer* tokenizer) {
     nStops = tokenizer->eosTokenIds.size();
     char** s = new char*[nStops];
@@ -2,13 +2,17 @@
 #define TOKENIZER_HPP
 
 #include <cstdio>
+#include <cstdint>
 #include <string>
+#include <memory>
 #include <vector>
 
 typedef struct {
-    char *str;
-    unsigned int id;
-} TokenIndex;
+    int tokenId; // Special token ending at this node, -1 if none
+    int firstChild;
+    int nextSibling;
+    unsigned char c;
+} SpecialTokenNode;
 
 struct TokenizerOldHeader {
     unsigned int vocabSize;
@@ -39,8 +43,10 @@ private:
     unsigned int specialVocabSize;
     float *vocabScores;
     unsigned int *vocabLength;
-    TokenIndex *regularVocab;
-    TokenIndex *specialVocab;
+    std::vector<int> regularTokenTable; // Open addressing hash table of regular token ids, -1 marks an empty bucket
+    std::vector<SpecialTokenNode> specialTokenTrie; // The first node is the root
+    std::vector<uint64_t> tokenBytePairs; // Bit (a << 8) | b is set if any token contains the bytes a, b in a row
+    unsigned int nThreads;
     size_t strBufferSize;
     char *strBuffer;
     char *utf8Buffer;
@@ -55,7 +61,7 @@ public:
     bool addBos;
     char *chatTemplate;
 
-    Tokenizer(const char *tokenizer_path);
+    Tokenizer(const char *tokenizer_path, unsigned int nThreads);
     ~Tokenizer();
     void printHeader();
     int findSpecialTokenStartWith(char *piece);
@@ -64,9 +70,37 @@ public:
     bool isEos(int token);
     char *decode(int token);
     void resetDecoder();
+    // Pending bytes of an incomplete UTF-8 sequence, lets several streams share one decoder
+    std::string getDecoderState();
+    void setDecoderState(const std::string &state);
 
 private:
     char *detokUtf8();
+    // No token spans the position, so the text may be encoded in separate chunks split there
+    bool isChunkBoundary(const char *c);
+    void encodeChunk(char *text, char *end, int *tokens, int *nTokens, bool addSpecialTokens);
+    static void *encodeChunkThread(void *arg);
+    // Finds the regular token equal to the concatenation of two pieces without building it
+    int findRegularToken(const char *left, size_t leftLength, const char *right, size_t rightLength);
+
+    friend class IncrementalEncoder;
+};
+
+// Keeps the tokens of the last encoded prompt. A prompt starting with the same text is encoded
+// only from the last position within the common text that no token spans, the tokens before it
+// are reused. The result is the same as encoding the whole prompt.
+class IncrementalEncoder {
+private:
+    Tokenizer *tokenizer;
+    std::string text;
+    std::vector<int> tokens;
+public:
+    IncrementalEncoder(Tokenizer *tokenizer);
+    // Number of leading bytes the text has in common with the last encoded one
+    size_t match(const char *text);
+    // Returns the number of reused tokens
+    size_t encode(const char *text);
+    const std::vector<int> &getTokens();
 };
 
 typedef struct {
@@ -74,20 +108,34 @@ typedef struct {
     int index;
 } ProbIndex;
 
+struct SamplerTeam;
+
 class Sampler {
 private:
     int vocab_size;
     ProbIndex *probindex;
     float temperature;
     float topp;
+    int topk; // 0 disables top-k
+    float minp; // 0 disables min-p
     unsigned long long rngState;
+    std::unique_ptr<SamplerTeam> team; // nullptr if the sampler runs on the calling thread only
 
 public:
-    Sampler(int vocab_size, float temperature, float topp, unsigned long long rngSeed);
+    Sampler(int vocab_size, float temperature, float topp, int topk, float minp, unsigned long long rngSeed, unsigned int nThreads);
     ~Sampler();
     int sample(float *logits);
     void setTemp(float temp);
     void setSeed(unsigned long long rngSeed);
+    void setTopp(float topp);
+    void setTopk(int topk);
+    void setMinp(float minp);
+private:
+    static void *threadHandler(void *arg);
+    void barrier();
+    void work(unsigned int threadIndex);
+    void runPass(int pass, float *logits);
+    int sampleParallel(float *logits, float p, float coin);
 };
 
 class TokenizerChatStops {